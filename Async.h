@@ -0,0 +1,378 @@
+#ifndef ASYNC_H
+#define ASYNC_H
+
+#if !defined(__cpp_impl_coroutine)
+#error "Async.h needs C++20 coroutines (compile with -std=c++20)"
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "Derivatives.h"
+#include "Parallel.h"
+
+// Awaitable batch gradient evaluation for coroutine code that must not block
+// its own thread (e.g. a reactor):
+//
+//     std::vector<GradientSample<2, double>> samples = co_await asyncEvaluate(pool, Rosenbrock(), points);
+//
+// The batch runs on a worker of an EvaluationPool and the awaiting coroutine
+// is resumed on that worker once it is done; code that has to continue on
+// its own thread should hop back from there. At most maxInFlight batches
+// are queued or running per pool. Further callers stay suspended (holding no
+// thread) until a slot frees, which gives the producers backpressure.
+// A CancellationToken stops a batch between points, or before it starts,
+// and the co_await then throws EvaluationCancelled; a batch still waiting
+// for a slot leaves the queue as soon as it is cancelled. Exceptions from f
+// are rethrown from the co_await as well.
+
+template<size_t K, typename T>
+struct GradientSample
+{
+    T value = T();
+    Vector<K, T> gradient = {};
+};
+
+class EvaluationCancelled : public std::runtime_error
+{
+    public:
+        EvaluationCancelled() : std::runtime_error("Batch evaluation was cancelled") {}
+};
+
+// Shared flag: copies observe the same cancellation. Callbacks registered
+// with onCancel run on the cancelling thread, under the token's lock, so
+// once removeCallback returns a callback is neither running nor pending.
+class CancellationToken
+{
+    public:
+        CancellationToken() : state(std::make_shared<State>()) {}
+
+        void cancel()
+        {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            if (state->cancelled.exchange(true, std::memory_order_relaxed))
+            {
+                return;
+            }
+            for (const std::pair<size_t, std::function<void()>>& entry : state->callbacks)
+            {
+                entry.second();
+            }
+            state->callbacks.clear();
+        }
+
+        bool isCancelled() const { return state->cancelled.load(std::memory_order_relaxed); }
+
+        // Runs callback on cancellation, or straight away if that already
+        // happened. Returns the id for removeCallback, 0 if it already ran.
+        size_t onCancel(std::function<void()> callback)
+        {
+            {
+                std::lock_guard<std::mutex> lock(state->mutex);
+                if (!state->cancelled.load(std::memory_order_relaxed))
+                {
+                    state->callbacks.emplace_back(++state->nextId, std::move(callback));
+                    return state->nextId;
+                }
+            }
+            callback();
+            return 0;
+        }
+
+        void removeCallback(size_t id)
+        {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            auto found = std::find_if(state->callbacks.begin(), state->callbacks.end(),
+                                      [id](const std::pair<size_t, std::function<void()>>& entry) { return entry.first == id; });
+            if (found != state->callbacks.end())
+            {
+                state->callbacks.erase(found);
+            }
+        }
+
+    private:
+        struct State
+        {
+            std::atomic<bool> cancelled{false};
+            std::mutex mutex;
+            size_t nextId = 0;
+            std::vector<std::pair<size_t, std::function<void()>>> callbacks;
+        };
+
+        std::shared_ptr<State> state;
+};
+
+class EvaluationPool
+{
+    public:
+        // maxInFlight = 0 allows two batches per thread
+        explicit EvaluationPool(size_t numThreads = hardwareThreads(), size_t maxInFlight = 0)
+            : limit(maxInFlight == 0 ? 2 * std::max<size_t>(numThreads, 1) : maxInFlight)
+        {
+            for (size_t t = 0; t < std::max<size_t>(numThreads, 1); ++t)
+            {
+                workers.emplace_back([this]() { work(); });
+            }
+        }
+
+        // Finishes every batch already submitted, then stops the workers
+        ~EvaluationPool()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            wake.notify_all();
+            for (std::thread& worker : workers)
+            {
+                worker.join();
+            }
+        }
+
+        EvaluationPool(const EvaluationPool&) = delete;
+        EvaluationPool& operator=(const EvaluationPool&) = delete;
+
+        // Process-wide pool used when none is given
+        static EvaluationPool& shared()
+        {
+            static EvaluationPool pool;
+            return pool;
+        }
+
+        // Runs job on a worker once a slot is free, then frees the slot and
+        // runs continuation on the same worker. Never blocks the caller.
+        // Cancelling token while the job still waits for a slot gives up its
+        // place in the queue: the next free worker runs only the continuation.
+        void submit(std::function<void()> job, std::function<void()> continuation, CancellationToken token = {})
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (inFlight < limit)
+            {
+                ++inFlight;
+                ready.push_back(Task{std::move(job), std::move(continuation), true});
+                lock.unlock();
+                wake.notify_one();
+                return;
+            }
+            const size_t id = ++lastWaiting;
+            waiting.push_back(Task{std::move(job), std::move(continuation), true, id, token});
+            lock.unlock();
+
+            // Registered after queuing so a cancellation in between still finds
+            // the task; if it was promoted meanwhile the callback is dropped again
+            size_t callback = token.onCancel([this, id]() { release(id); });
+            lock.lock();
+            auto queued = findWaiting(id);
+            if (queued != waiting.end())
+            {
+                queued->callback = callback;
+                return;
+            }
+            lock.unlock();
+            token.removeCallback(callback);
+        }
+
+        size_t getInFlight() const
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            return inFlight;
+        }
+
+        size_t getWaiting() const
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            return waiting.size();
+        }
+
+        size_t getLimit() const { return limit; }
+
+    private:
+        struct Task
+        {
+            std::function<void()> job;
+            std::function<void()> continuation;
+            bool holdsSlot = true;      // false once released by a cancellation
+            size_t id = 0;              // set while waiting
+            CancellationToken token;
+            size_t callback = 0;        // the token's callback releasing it, if any
+        };
+
+        std::deque<Task>::iterator findWaiting(size_t id)
+        {
+            return std::find_if(waiting.begin(), waiting.end(), [id](const Task& task) { return task.id == id; });
+        }
+
+        // A waiting task was cancelled: it leaves the queue without a slot and
+        // the next free worker resumes its caller
+        void release(size_t id)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto queued = findWaiting(id);
+            if (queued == waiting.end())
+            {
+                return;
+            }
+            Task task = std::move(*queued);
+            waiting.erase(queued);
+            task.holdsSlot = false;
+            ready.push_front(std::move(task));
+            wake.notify_one();
+        }
+
+        void work()
+        {
+            for (;;)
+            {
+                Task task;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    wake.wait(lock, [this]() { return stopping || !ready.empty(); });
+                    if (ready.empty())
+                    {
+                        return;
+                    }
+                    task = std::move(ready.front());
+                    ready.pop_front();
+                }
+
+                if (!task.holdsSlot)
+                {
+                    task.continuation();
+                    continue;
+                }
+
+                task.job();
+
+                bool promoted = false;
+                CancellationToken promotedToken;
+                size_t promotedCallback = 0;
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (waiting.empty())
+                    {
+                        --inFlight;
+                    }
+                    else
+                    {
+                        promotedToken = waiting.front().token;
+                        promotedCallback = waiting.front().callback;
+                        ready.push_back(std::move(waiting.front()));
+                        waiting.pop_front();
+                        promoted = true;
+                    }
+                }
+                if (promoted)
+                {
+                    wake.notify_one();
+                    // Outside the pool lock, since cancel() takes the locks the other way round
+                    promotedToken.removeCallback(promotedCallback);
+                }
+
+                task.continuation();
+            }
+        }
+
+        size_t limit;
+        size_t inFlight = 0;
+        size_t lastWaiting = 0;
+        bool stopping = false;
+        std::deque<Task> ready;
+        std::deque<Task> waiting;
+        mutable std::mutex mutex;
+        std::condition_variable wake;
+        std::vector<std::thread> workers;
+};
+
+// The awaitable returned by asyncEvaluate; holds the batch and the results
+// in the awaiting coroutine's frame while it is suspended
+template<size_t K, typename T, typename Function>
+class BatchEvaluation
+{
+    public:
+        BatchEvaluation(EvaluationPool& evaluationPool, Function function, std::vector<Vector<K, T>> points,
+                        CancellationToken cancellation)
+            : pool(evaluationPool), f(std::move(function)), batch(std::move(points)), token(std::move(cancellation)) {}
+
+        bool await_ready() const noexcept { return batch.empty(); }
+
+        // Already cancelled batches resume straight away without touching the pool
+        bool await_suspend(std::coroutine_handle<> caller)
+        {
+            if (token.isCancelled())
+            {
+                return false;
+            }
+            pool.submit([this]() { run(); }, [caller]() { caller.resume(); }, token);
+            return true;
+        }
+
+        std::vector<GradientSample<K, T>> await_resume()
+        {
+            if (failure)
+            {
+                std::rethrow_exception(failure);
+            }
+            if (token.isCancelled() && results.size() < batch.size())
+            {
+                throw EvaluationCancelled();
+            }
+            return std::move(results);
+        }
+
+    private:
+        void run()
+        {
+            try
+            {
+                results.reserve(batch.size());
+                for (const Vector<K, T>& x : batch)
+                {
+                    if (token.isCancelled())
+                    {
+                        return;
+                    }
+                    GradientSample<K, T> sample;
+                    sample.value = valueAndGradient(f, x, sample.gradient);
+                    results.push_back(sample);
+                }
+            }
+            catch (...)
+            {
+                failure = std::current_exception();
+            }
+        }
+
+        EvaluationPool& pool;
+        Function f;
+        std::vector<Vector<K, T>> batch;
+        CancellationToken token;
+        std::vector<GradientSample<K, T>> results;
+        std::exception_ptr failure;
+};
+
+// co_await asyncEvaluate(pool, f, points) yields the value and gradient of f at every point
+template<size_t K, typename T, typename Function>
+BatchEvaluation<K, T, Function> asyncEvaluate(EvaluationPool& pool, Function f, std::vector<Vector<K, T>> batch,
+                                             CancellationToken token = {})
+{
+    return BatchEvaluation<K, T, Function>(pool, std::move(f), std::move(batch), std::move(token));
+}
+
+// The same on the shared pool
+template<size_t K, typename T, typename Function>
+BatchEvaluation<K, T, Function> asyncEvaluate(Function f, std::vector<Vector<K, T>> batch, CancellationToken token = {})
+{
+    return asyncEvaluate(EvaluationPool::shared(), std::move(f), std::move(batch), std::move(token));
+}
+
+#endif
@@ -0,0 +1,575 @@
+#include <chrono>
+#include <iomanip>
+#include <string>
+#include "Duals.h"
+#include "Optimize.h"
+#include "LeastSquares.h"
+#include "Ode.h"
+#include "Expression.h"
+#include "Jit.h"
+#include "Checkpoint.h"
+#include "Numa.h"
+
+using namespace std;
+
+// Runs body repeatedly and returns the average time per run in microseconds
+template <typename Body>
+double timeMicroseconds(size_t runs, Body&& body)
+{
+    auto start = chrono::steady_clock::now();
+    for (size_t run = 0; run < runs; ++run)
+    {
+        body();
+    }
+    auto stop = chrono::steady_clock::now();
+    return chrono::duration<double, micro>(stop - start).count() / double(runs);
+}
+
+// Keeps the optimizer from discarding results it thinks are unused
+template <typename T>
+void doNotOptimize(const T& value)
+{
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+template <size_t N>
+struct ExtendedRosenbrock
+{
+    template <typename S>
+    S operator()(const std::array<S, N>& x) const
+    {
+        S sum = S(0.0);
+        for (size_t i = 0; i + 1 < N; ++i)
+        {
+            S a = S(1.0) - x[i];
+            S b = x[i + 1] - x[i] * x[i];
+            sum = sum + a * a + S(100.0) * b * b;
+        }
+        return sum;
+    }
+};
+
+struct Beale
+{
+    template <typename S>
+    S operator()(const std::array<S, 2>& x) const
+    {
+        S a = S(1.5) - x[0] + x[0] * x[1];
+        S b = S(2.25) - x[0] + x[0] * x[1] * x[1];
+        S c = S(2.625) - x[0] + x[0] * x[1] * x[1] * x[1];
+        return a * a + b * b + c * c;
+    }
+};
+
+template <typename Optimizer, size_t N, typename Function>
+void benchOptimizer(const string& name, const Function& f, const Vector<N, double>& start, Optimizer optimize, size_t runs)
+{
+    OptimizerResult<double> result;
+    double micros = timeMicroseconds(runs, [&]()
+    {
+        Vector<N, double> x = start;
+        result = optimize(f, x);
+        doNotOptimize(x);
+    });
+
+    cout << "  " << left << setw(28) << name
+         << right << setw(10) << fixed << setprecision(2) << micros << " us"
+         << setw(8) << result.iterations << " iters"
+         << setw(8) << result.evaluations << " evals"
+         << "  f = " << scientific << setprecision(3) << result.value
+         << (result.converged ? "" : "  (not converged)") << '\n';
+}
+
+void benchOptimizers()
+{
+    cout << "Optimizers (value + gradient from one Duals evaluation)\n";
+
+    OptimizerOptions<double> options;
+    options.gradientTolerance = 1e-8;
+    options.maxIterations = 100000;
+
+    auto descent = [&](const auto& f, auto& x) { return gradientDescent(f, x, options); };
+    auto quasiNewton = [&](const auto& f, auto& x) { return lbfgs(f, x, options); };
+    auto fullNewton = [&](const auto& f, auto& x) { return newton(f, x, options); };
+
+    Vector<2, double> rosenbrockStart = {-1.2, 1.0};
+    benchOptimizer("Rosenbrock-2 descent", ExtendedRosenbrock<2>(), rosenbrockStart, descent, 5);
+    benchOptimizer("Rosenbrock-2 L-BFGS", ExtendedRosenbrock<2>(), rosenbrockStart, quasiNewton, 1000);
+    benchOptimizer("Rosenbrock-2 Newton", ExtendedRosenbrock<2>(), rosenbrockStart, fullNewton, 1000);
+
+    Vector<8, double> wideStart;
+    for (size_t i = 0; i < 8; ++i)
+    {
+        wideStart[i] = i % 2 == 0 ? -1.2 : 1.0;
+    }
+    benchOptimizer("Rosenbrock-8 L-BFGS", ExtendedRosenbrock<8>(), wideStart, quasiNewton, 200);
+    benchOptimizer("Rosenbrock-8 Newton", ExtendedRosenbrock<8>(), wideStart, fullNewton, 200);
+
+    Vector<2, double> bealeStart = {1.0, 1.0};
+    benchOptimizer("Beale descent", Beale(), bealeStart, descent, 20);
+    benchOptimizer("Beale L-BFGS", Beale(), bealeStart, quasiNewton, 1000);
+    benchOptimizer("Beale Newton", Beale(), bealeStart, fullNewton, 1000);
+}
+
+struct DecayModel
+{
+    template <typename S>
+    S operator()(const std::array<S, 3>& p, const std::array<double, 2>& sample) const
+    {
+        return p[0] * exp(S(-sample[0]) * p[1]) + p[2] - S(sample[1]);
+    }
+};
+
+void benchLeastSquares()
+{
+    cout << "Levenberg-Marquardt on 1M residuals\n";
+
+    std::vector<std::array<double, 2>> data(1000000);
+    for (size_t k = 0; k < data.size(); ++k)
+    {
+        double t = 5.0 * double(k) / double(data.size());
+        data[k] = {t, 2.5 * std::exp(-1.3 * t) + 0.7 + 1e-3 * std::sin(37.0 * t)};
+    }
+
+    std::vector<size_t> threadCounts = {1};
+    if (hardwareThreads() > 1)
+    {
+        threadCounts.push_back(hardwareThreads());
+    }
+
+    for (size_t threads : threadCounts)
+    {
+        LeastSquaresOptions<double> options;
+        options.numThreads = threads;
+        LeastSquaresResult<double> result;
+        double micros = timeMicroseconds(1, [&]()
+        {
+            Vector<3, double> params = {1.0, 1.0, 0.0};
+            result = levenbergMarquardt(DecayModel(), data, params, options);
+            doNotOptimize(params);
+        });
+        cout << "  " << left << setw(28) << (to_string(threads) + " thread(s)")
+             << right << setw(10) << fixed << setprecision(2) << micros / 1000.0 << " ms"
+             << setw(8) << result.iterations << " iters"
+             << "  cost = " << scientific << setprecision(3) << result.cost << '\n';
+    }
+}
+
+// Predator-prey model with four parameters
+template <typename S>
+struct LotkaVolterra
+{
+    std::array<S, 4> theta;
+
+    void operator()(double, const std::array<S, 2>& y, std::array<S, 2>& dydt) const
+    {
+        dydt[0] = theta[0] * y[0] - theta[1] * y[0] * y[1];
+        dydt[1] = theta[3] * y[0] * y[1] - theta[2] * y[1];
+    }
+};
+
+template <typename S>
+LotkaVolterra<S> makeLotkaVolterra()
+{
+    const double theta[4] = {1.5, 1.0, 3.0, 1.0};
+    LotkaVolterra<S> system;
+    for (size_t p = 0; p < 4; ++p)
+    {
+        system.theta[p] = S(theta[p]);
+    }
+    return system;
+}
+
+template <>
+LotkaVolterra<Duals<4, double>> makeLotkaVolterra()
+{
+    const double theta[4] = {1.5, 1.0, 3.0, 1.0};
+    LotkaVolterra<Duals<4, double>> system;
+    for (size_t p = 0; p < 4; ++p)
+    {
+        system.theta[p] = Duals<4, double>(theta[p]);
+        system.theta[p].setDerivative(p, 1.0);
+    }
+    return system;
+}
+
+template <typename S>
+void benchOdeScalar(const string& name, size_t runs)
+{
+    LotkaVolterra<S> system = makeLotkaVolterra<S>();
+    RungeKutta4<2, S> rk4;
+    DormandPrince<2, S> dopri;
+    AdaptiveStats stats;
+
+    double fixedMicros = timeMicroseconds(runs, [&]()
+    {
+        std::array<S, 2> y = {S(10.0), S(5.0)};
+        rk4.integrate(system, 0.0, 10.0, 2000, y);
+        doNotOptimize(y);
+    });
+    double adaptiveMicros = timeMicroseconds(runs, [&]()
+    {
+        std::array<S, 2> y = {S(10.0), S(5.0)};
+        stats = dopri.integrate(system, 0.0, 10.0, y);
+        doNotOptimize(y);
+    });
+
+    cout << "  " << left << setw(28) << (name + " RK4 (2000 steps)")
+         << right << setw(10) << fixed << setprecision(2) << fixedMicros << " us\n";
+    cout << "  " << left << setw(28) << (name + " Dormand-Prince")
+         << right << setw(10) << fixed << setprecision(2) << adaptiveMicros << " us"
+         << setw(8) << stats.accepted << " steps" << setw(8) << stats.rejected << " rejected\n";
+}
+
+void benchOdeSensitivities()
+{
+    cout << "Lotka-Volterra over [0, 10], plain vs 4-parameter forward sensitivities\n";
+    benchOdeScalar<double>("double", 200);
+    benchOdeScalar<Duals<4, double>>("Duals<4>", 200);
+}
+
+struct Wave
+{
+    template <typename S>
+    S operator()(const std::array<S, 3>& v) const
+    {
+        return sin(v[0] * cos(S(2.0) * v[1])) / tan(v[2]) + sqrt(v[0] * v[0] + v[1] * v[1]) * exp(S(0.0) - v[2]);
+    }
+};
+
+// Directional derivative along v at many points using Duals<LANES, double>
+// with the direction in lane 0 and any further lanes left at zero
+template <size_t LANES>
+double directionalSweep(const std::vector<Vector<3, double>>& points, const Vector<3, double>& v)
+{
+    Wave f;
+    double sum = 0.0;
+    for (const Vector<3, double>& x : points)
+    {
+        std::array<Duals<LANES, double>, 3> seeded;
+        for (size_t i = 0; i < 3; ++i)
+        {
+            seeded[i].setValue(x[i]);
+            seeded[i].setDerivative(0, v[i]);
+        }
+        sum += f(seeded).getDerivative(0);
+    }
+    return sum;
+}
+
+void benchDirectionalDerivative()
+{
+    cout << "Directional derivative over 1M points\n";
+
+    std::vector<Vector<3, double>> points(1000000);
+    for (size_t k = 0; k < points.size(); ++k)
+    {
+        double s = double(k) / double(points.size());
+        points[k] = {1.0 + s, 0.5 - s, 0.7 + 0.5 * s};
+    }
+    Vector<3, double> v = {0.3, -0.2, 0.9};
+
+    double sumGeneric = 0.0;
+    double sumScalar = 0.0;
+    double sumJvp = 0.0;
+    double generic = timeMicroseconds(3, [&]() { sumGeneric = directionalSweep<2>(points, v); });
+    double scalar = timeMicroseconds(3, [&]() { sumScalar = directionalSweep<1>(points, v); });
+    double viaJvp = timeMicroseconds(3, [&]()
+    {
+        double sum = 0.0;
+        for (const Vector<3, double>& x : points)
+        {
+            sum += jvp(Wave(), x, v).getDerivative();
+        }
+        sumJvp = sum;
+    });
+    doNotOptimize(sumGeneric);
+    doNotOptimize(sumScalar);
+    doNotOptimize(sumJvp);
+
+    cout << "  " << left << setw(28) << "generic Duals<2> (1 idle)" << right << setw(10) << fixed << setprecision(2) << generic / 1000.0 << " ms\n";
+    cout << "  " << left << setw(28) << "specialized Duals<1>" << right << setw(10) << fixed << setprecision(2) << scalar / 1000.0 << " ms\n";
+    cout << "  " << left << setw(28) << "jvp()" << right << setw(10) << fixed << setprecision(2) << viaJvp / 1000.0 << " ms\n";
+}
+
+// Naively written model that recomputes its shared subterms in every term
+struct RepeatedTerms
+{
+    template <typename S>
+    S operator()(const std::array<S, 3>& v) const
+    {
+        S sum = S(0.0);
+        for (int k = 1; k <= 8; ++k)
+        {
+            S weight = S(double(k)) * S(0.5);
+            sum = sum + weight * (v[0] * v[0] * v[1] + cos(S(2.0) * v[1]) * sin(v[0] * cos(S(2.0) * v[1])) / tan(v[2]));
+        }
+        return sum;
+    }
+};
+
+void benchExpressionReplay()
+{
+    cout << "Traced + optimized replay vs direct Duals<3> evaluation (100k points)\n";
+
+    ExpressionGraph<double> graph = traceFunction<3, double>(RepeatedTerms());
+    ExpressionProgram<double> program = graph.compile();
+    cout << "  recorded " << graph.getNodes().size() << " nodes, replaying " << program.getInstructions().size() << " instructions\n";
+
+    std::vector<std::array<Duals<3, double>, 3>> points(100000);
+    for (size_t k = 0; k < points.size(); ++k)
+    {
+        double s = double(k) / double(points.size());
+        points[k] = {Duals<3, double>(1.0 + s, {1.0, 0.0, 0.0}), Duals<3, double>(0.5 - s, {0.0, 1.0, 0.0}),
+                     Duals<3, double>(0.7 + 0.5 * s, {0.0, 0.0, 1.0})};
+    }
+
+    double directSum = 0.0;
+    double replaySum = 0.0;
+    double direct = timeMicroseconds(3, [&]()
+    {
+        double sum = 0.0;
+        for (const auto& point : points)
+        {
+            sum += RepeatedTerms()(point).getDerivative(1);
+        }
+        directSum = sum;
+    });
+    std::vector<Duals<3, double>> registers;
+    double replay = timeMicroseconds(3, [&]()
+    {
+        double sum = 0.0;
+        std::array<Duals<3, double>, 1> result;
+        for (const auto& point : points)
+        {
+            program.evaluate(point, result, registers);
+            sum += result[0].getDerivative(1);
+        }
+        replaySum = sum;
+    });
+    std::shared_ptr<const JitProgram<3>> native = jitCompile<3>(program);
+    std::vector<double> scratch;
+    double jitSum = 0.0;
+    double jit = timeMicroseconds(3, [&]()
+    {
+        double sum = 0.0;
+        std::array<Duals<3, double>, 1> result;
+        for (const auto& point : points)
+        {
+            native->evaluate(point, result, scratch);
+            sum += result[0].getDerivative(1);
+        }
+        jitSum = sum;
+    });
+    doNotOptimize(directSum);
+    doNotOptimize(replaySum);
+    doNotOptimize(jitSum);
+
+    cout << "  " << left << setw(28) << "direct" << right << setw(10) << fixed << setprecision(2) << direct / 1000.0 << " ms\n";
+    cout << "  " << left << setw(28) << "replay" << right << setw(10) << fixed << setprecision(2) << replay / 1000.0 << " ms\n";
+    cout << "  " << left << setw(28) << (native->isNative() ? "jit" : "jit (replay fallback)") << right << setw(10) << fixed
+         << setprecision(2) << jit / 1000.0 << " ms  (" << native->getCodeSize() << " bytes)\n";
+}
+
+void benchCheckpointing()
+{
+    const size_t steps = 100000;
+    cout << "Reverse sweep over " << steps << " RK4 steps of Lotka-Volterra with Duals<4> state\n";
+    cout << "  " << left << setw(28) << "snapshots" << right << setw(12) << "memory KB" << setw(14) << "steps run"
+         << setw(12) << "ms" << "\n";
+
+    using State = std::array<Duals<4, double>, 2>;
+    LotkaVolterra<Duals<4, double>> system = makeLotkaVolterra<Duals<4, double>>();
+    RungeKutta4<2, Duals<4, double>> rk4;
+    const double h = 1e-4;
+    auto step = [&](State& y, size_t i) { rk4.step(system, double(i) * h, h, y); };
+    const State initial = {Duals<4, double>(10.0), Duals<4, double>(5.0)};
+
+    for (size_t snapshots : {steps, size_t(1000), size_t(100), size_t(30), size_t(12)})
+    {
+        double sum = 0.0;
+        auto visit = [&](size_t, const State& y) { sum += y[0].getDerivative(1); };
+        CheckpointStats stats;
+        double micros = timeMicroseconds(1, [&]()
+        {
+            stats = reverseWithCheckpoints(initial, steps, snapshots, step, visit);
+        });
+        doNotOptimize(sum);
+
+        cout << "  " << left << setw(28) << (snapshots == steps ? string("all") : to_string(snapshots))
+             << right << setw(12) << stats.storedStates * sizeof(State) / 1024
+             << setw(14) << stats.forwardSteps << setw(12) << fixed << setprecision(2) << micros / 1000.0 << "\n";
+    }
+}
+
+// Operator throughput (a dependent chain held in registers) and a streaming
+// sweep over std::vector for one lane storage policy
+template <size_t N, typename Storage>
+void benchStorage(const string& name, size_t count)
+{
+    using D = Duals<N, double, Storage>;
+    std::vector<D> x(count), y(count), out(count);
+    for (size_t k = 0; k < count; ++k)
+    {
+        std::array<double, N> lanes;
+        for (size_t i = 0; i < N; ++i)
+        {
+            lanes[i] = 1e-3 * double((k + i) % 17);
+        }
+        x[k] = D(1.0 + 1e-9 * double(k), lanes);
+        y[k] = D(1.0 - 1e-9 * double(k % 64), lanes);
+    }
+
+    double chain = timeMicroseconds(5, [&]()
+    {
+        D acc = x[0];
+        for (size_t k = 0; k < count; ++k)
+        {
+            acc = acc * y[k % 64] - x[k % 64] * 0.5;
+        }
+        doNotOptimize(acc);
+    });
+    double sweep = timeMicroseconds(5, [&]()
+    {
+        for (size_t k = 0; k < count; ++k)
+        {
+            out[k] = x[k] * y[k] + x[k];
+        }
+        doNotOptimize(out[count / 2]);
+    });
+
+    cout << "  " << left << setw(32) << name << right << setw(8) << sizeof(D) << setw(12) << fixed << setprecision(2)
+         << chain / 1000.0 << setw(12) << sweep / 1000.0 << "\n";
+}
+
+void benchStorageLayouts()
+{
+    const size_t count = 1000000;
+    cout << "Lane storage policies over " << count << " Duals\n";
+    cout << "  " << left << setw(32) << "layout" << right << setw(8) << "bytes" << setw(12) << "chain ms" << setw(12) << "sweep ms" << "\n";
+    benchStorage<6, DualsPacked>("Duals<6> packed", count);
+    benchStorage<6, DualsAligned<32>>("Duals<6> aligned 32", count);
+    benchStorage<6, DualsAligned<32, 4>>("Duals<6> aligned 32, padded to 8", count);
+    benchStorage<8, DualsPacked>("Duals<8> packed", count);
+    benchStorage<8, DualsAligned<32>>("Duals<8> aligned 32", count);
+    benchStorage<8, DualsAligned<64>>("Duals<8> aligned 64", count);
+}
+
+// H v from the full nested-duals Hessian against forward-over-forward hvp,
+// one direction at a time and four directions batched
+template <size_t N>
+void benchHessianVector(size_t runs)
+{
+    Vector<N, double> x;
+    std::array<Vector<N, double>, 4> directions;
+    for (size_t i = 0; i < N; ++i)
+    {
+        x[i] = i % 2 == 0 ? -1.2 : 1.0;
+        for (size_t k = 0; k < 4; ++k)
+        {
+            directions[k][i] = 0.1 * double((i + k) % 5) - 0.2;
+        }
+    }
+
+    double viaHessian = timeMicroseconds(runs, [&]()
+    {
+        Vector<N, double> gradient;
+        Matrix<N, double> hessian;
+        valueGradientAndHessian(ExtendedRosenbrock<N>(), x, gradient, hessian);
+        std::array<Vector<N, double>, 4> products = {};
+        for (size_t k = 0; k < 4; ++k)
+        {
+            for (size_t i = 0; i < N; ++i)
+            {
+                for (size_t j = 0; j < N; ++j)
+                {
+                    products[k][i] += hessian[i][j] * directions[k][j];
+                }
+            }
+        }
+        doNotOptimize(products);
+    });
+    double single = timeMicroseconds(runs, [&]()
+    {
+        for (size_t k = 0; k < 4; ++k)
+        {
+            Vector<N, double> product = hvp(ExtendedRosenbrock<N>(), x, directions[k]);
+            doNotOptimize(product);
+        }
+    });
+    double batched = timeMicroseconds(runs, [&]()
+    {
+        std::array<Vector<N, double>, 4> products = hvp(ExtendedRosenbrock<N>(), x, directions);
+        doNotOptimize(products);
+    });
+
+    cout << "  " << right << setw(4) << N << setw(14) << fixed << setprecision(2) << viaHessian << setw(14) << single
+         << setw(14) << batched << "\n";
+}
+
+void benchHessianVectorProducts()
+{
+    cout << "Four Hessian-vector products of the extended Rosenbrock function (us)\n";
+    cout << "  " << right << setw(4) << "N" << setw(14) << "via Hessian" << setw(14) << "4 x hvp" << setw(14) << "batched hvp" << "\n";
+    benchHessianVector<8>(20000);
+    benchHessianVector<16>(5000);
+    benchHessianVector<32>(1000);
+    benchHessianVector<64>(200);
+}
+
+// Batch gradient throughput against the number of workers, with buffers
+// placed and evaluated per node versus touched by the caller and shared
+void benchNumaBatch()
+{
+    const size_t count = 1 << 20;
+    NumaTopology topology = NumaTopology::system();
+    if (topology.nodeCount() == 1)
+    {
+        topology = NumaTopology::simulated(2);
+    }
+    cout << "NUMA batch evaluation of " << count << " points on " << topology.nodeCount()
+         << (topology.isSimulated() ? " simulated" : "") << " nodes\n";
+    cout << "  " << right << setw(8) << "threads" << setw(16) << "shared Mpts/s" << setw(16) << "numa Mpts/s" << "\n";
+
+    auto generate = [](size_t i, Vector<8, double>& x)
+    {
+        for (size_t j = 0; j < 8; ++j)
+        {
+            x[j] = 1e-6 * double((i * 8 + j) % 1000003);
+        }
+    };
+    for (size_t threads = 1; threads <= 2 * hardwareThreads(); threads *= 2)
+    {
+        double rates[2];
+        for (size_t aware = 0; aware < 2; ++aware)
+        {
+            NumaOptions options;
+            options.topology = topology;
+            options.numThreads = threads;
+            options.numaAware = aware == 1;
+            NumaBatch<8, double> batch(count, options);
+            batch.fill(generate);
+            double micros = timeMicroseconds(3, [&]()
+            {
+                batch.evaluate(ExtendedRosenbrock<8>());
+                doNotOptimize(batch.value(count / 2));
+            });
+            rates[aware] = double(count) / micros;
+        }
+        cout << "  " << setw(8) << threads << setw(16) << fixed << setprecision(2) << rates[0] << setw(16) << rates[1] << "\n";
+    }
+}
+
+int main()
+{
+    benchOptimizers();
+    benchLeastSquares();
+    benchOdeSensitivities();
+    benchDirectionalDerivative();
+    benchExpressionReplay();
+    benchCheckpointing();
+    benchStorageLayouts();
+    benchNumaBatch();
+    benchHessianVectorProducts();
+    return 0;
+}
@@ -0,0 +1,177 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <algorithm>
+#include <cstddef>
+#include <limits>
+#include <vector>
+
+// Binomial (Revolve) checkpointing for walking a long step sequence
+// backwards, e.g. to accumulate sensitivities over a time-stepping loop with
+// Duals-valued state, without keeping every intermediate state alive:
+//
+//     RungeKutta4<2, Duals<4, double>> rk;
+//     auto step = [&](std::array<Duals<4, double>, 2>& y, size_t i) { rk.step(f, t0 + i * h, h, y); };
+//     auto visit = [&](size_t i, const std::array<Duals<4, double>, 2>& y) { ... };   // i = steps - 1, ..., 0
+//     reverseWithCheckpoints(y0, steps, 10, step, visit);
+//
+// step(state, i) advances a state from index i to i + 1 and visit(i, state)
+// receives the state at index i, in order of decreasing i. Besides the
+// initial state at most `snapshots` further states are stored (plus one
+// scratch state once the budget is exhausted). With c = snapshots + 1 stored
+// states, up to C(c + r, c) steps are reversed running no step more than r
+// times, so a budget logarithmic in the number of steps keeps recomputation
+// logarithmic too. Snapshots are placed by the binomial schedule of Griewank
+// and Walther's Revolve, which minimizes the total number of steps run.
+
+struct CheckpointStats
+{
+    size_t forwardSteps = 0;    // calls to step, including recomputation
+    size_t storedStates = 0;    // most states held at once
+};
+
+// C(n, k), saturating instead of overflowing
+inline size_t checkpointBinomial(size_t n, size_t k)
+{
+    k = std::min(k, n - k);
+    size_t result = 1;
+    for (size_t i = 1; i <= k; ++i)
+    {
+        size_t numerator = n - k + i;
+        if (result > std::numeric_limits<size_t>::max() / numerator)
+        {
+            return std::numeric_limits<size_t>::max();
+        }
+        result = result * numerator / i;
+    }
+    return result;
+}
+
+// Smallest repetition count r with C(states + r, states) >= steps
+inline size_t checkpointRepetitions(size_t steps, size_t states)
+{
+    size_t r = 0;
+    while (checkpointBinomial(states + r, states) < steps)
+    {
+        ++r;
+    }
+    return r;
+}
+
+// Number of forward steps reverseWithCheckpoints runs for the given budget,
+// which is the minimum any schedule can achieve
+inline size_t checkpointForwardSteps(size_t steps, size_t snapshots)
+{
+    if (steps <= 1)
+    {
+        return 0;
+    }
+    size_t states = snapshots + 1;
+    size_t r = checkpointRepetitions(steps, states);
+    return r * steps - checkpointBinomial(states + r, states + 1);
+}
+
+template<typename State, typename Step, typename Visit>
+class CheckpointReversal
+{
+    public:
+        CheckpointReversal(const Step& advance, const Visit& visitor, size_t snapshots)
+            : step(advance), visit(visitor), states(snapshots + 1) {}
+
+        CheckpointStats run(const State& initial, size_t steps)
+        {
+            states[0] = initial;
+            held = 1;
+            stats.storedStates = 1;
+            reverse(0, 0, steps, states.size() - 1);
+            return stats;
+        }
+
+    private:
+        void advance(State& state, size_t from, size_t to)
+        {
+            for (size_t i = from; i < to; ++i)
+            {
+                step(state, i);
+                ++stats.forwardSteps;
+            }
+        }
+
+        // states[slot] holds the state at begin and slots above it are free
+        void reverse(size_t slot, size_t begin, size_t end, size_t snapshots)
+        {
+            while (end > begin)
+            {
+                size_t length = end - begin;
+                if (length == 1)
+                {
+                    visit(begin, static_cast<const State&>(states[slot]));
+                    return;
+                }
+                if (snapshots == 0)
+                {
+                    // No room left: recompute each state from the start of the range
+                    stats.storedStates = std::max(stats.storedStates, held + 1);
+                    for (size_t i = end; i-- > begin;)
+                    {
+                        scratch = states[slot];
+                        advance(scratch, begin, i);
+                        visit(i, static_cast<const State&>(scratch));
+                    }
+                    return;
+                }
+                if (length <= snapshots + 1)
+                {
+                    // Enough room to keep every state of the range (done without recursing)
+                    for (size_t k = 1; k < length; ++k)
+                    {
+                        states[slot + k] = states[slot + k - 1];
+                        advance(states[slot + k], begin + k - 1, begin + k);
+                    }
+                    stats.storedStates = std::max(stats.storedStates, held + length - 1);
+                    for (size_t k = length; k-- > 0;)
+                    {
+                        visit(begin + k, static_cast<const State&>(states[slot + k]));
+                    }
+                    return;
+                }
+
+                // Any snapshot position in [max(C(c + r - 2, c), length - C(c + r - 1, c - 1)),
+                // min(C(c + r - 1, c), length - C(c + r - 2, c - 1))] is optimal; take the lowest
+                size_t c = snapshots + 1;
+                size_t r = checkpointRepetitions(length, c);
+                size_t left = r >= 2 ? checkpointBinomial(c + r - 2, c) : 1;
+                size_t right = checkpointBinomial(c + r - 1, c - 1);
+                if (length > right)
+                {
+                    left = std::max(left, length - right);
+                }
+                size_t middle = begin + std::max<size_t>(left, 1);
+
+                states[slot + 1] = states[slot];
+                stats.storedStates = std::max(stats.storedStates, ++held);
+                advance(states[slot + 1], begin, middle);
+                reverse(slot + 1, middle, end, snapshots - 1);
+                --held;
+                end = middle;
+            }
+        }
+
+        const Step& step;
+        const Visit& visit;
+        std::vector<State> states;
+        State scratch;
+        size_t held = 0;
+        CheckpointStats stats;
+};
+
+// Calls visit(i, state_i) for i = steps - 1 down to 0, where state_0 is
+// initial and state_{i+1} is step applied to state_i, holding at most
+// snapshots + 2 states
+template<typename State, typename Step, typename Visit>
+CheckpointStats reverseWithCheckpoints(const State& initial, size_t steps, size_t snapshots, const Step& step, const Visit& visit)
+{
+    return CheckpointReversal<State, Step, Visit>(step, visit, std::min(snapshots, steps)).run(initial, steps);
+}
+
+#endif
@@ -0,0 +1,347 @@
+#ifndef CODEGEN_H
+#define CODEGEN_H
+
+#include <cmath>
+#include <iomanip>
+#include <limits>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "Expression.h"
+
+// Emits a compiled expression program (see Expression.h) as a standalone,
+// straight-line C++ function computing the values and gradients of all
+// outputs:
+//
+//     inline void name(const T* x, T* value, T* gradient)
+//
+// gradient is row-major, outputs x inputs. Derivative lanes are tracked
+// symbolically while emitting, so lanes that are known to be zero are never
+// computed and the unit seeds of the inputs are multiplied away; the result
+// has none of the loops or array traffic of Duals<N, T>. The emitted code
+// needs <cmath> and <limits>, and <stdexcept> under the Throw domain policy.
+
+template<typename T>
+const char* codeGenTypeName()
+{
+    static_assert(std::is_same_v<T, double> || std::is_same_v<T, float>, "Code generation supports float and double");
+    return std::is_same_v<T, double> ? "double" : "float";
+}
+
+template<typename T>
+class GradientKernelEmitter
+{
+    public:
+        GradientKernelEmitter(std::ostream& stream, const ExpressionProgram<T>& compiled)
+            : out(stream), program(compiled), numInputs(compiled.inputCount()),
+              lanes(compiled.getRegisterCount(), std::vector<Lane>(compiled.inputCount())) {}
+
+        void emit(const std::string& name)
+        {
+            const char* type = codeGenTypeName<T>();
+            out << "inline void " << name << "(const " << type << "* x, " << type << "* value, " << type << "* gradient)\n{\n";
+
+            for (const ExpressionInstruction<T>& instruction : program.getInstructions())
+            {
+                emitInstruction(instruction);
+            }
+
+            const std::vector<uint32_t>& outputs = program.getOutputs();
+            for (size_t k = 0; k < outputs.size(); ++k)
+            {
+                out << "    value[" << k << "] = " << valueName(outputs[k]) << ";\n";
+                for (size_t i = 0; i < numInputs; ++i)
+                {
+                    out << "    gradient[" << k * numInputs + i << "] = " << laneText(lanes[outputs[k]][i]) << ";\n";
+                }
+            }
+            out << "}\n";
+        }
+
+    private:
+        // Symbolic state of one derivative lane
+        struct Lane
+        {
+            enum Kind { Zero, One, Named } kind = Zero;
+            std::string name;
+        };
+
+        static std::string valueName(uint32_t r) { return "v" + std::to_string(r); }
+
+        // Infinities and NaNs have no literal form and are spelled through numeric_limits
+        static std::string literal(T value)
+        {
+            if (std::isinf(value) || std::isnan(value))
+            {
+                std::string limit = std::string("std::numeric_limits<") + codeGenTypeName<T>() + ">::"
+                                  + (std::isnan(value) ? "quiet_NaN()" : "infinity()");
+                return std::signbit(value) ? "-" + limit : limit;
+            }
+            std::ostringstream text;
+            text << std::setprecision(std::numeric_limits<T>::max_digits10) << value;
+            std::string result = text.str();
+            if (result.find_first_of(".eE") == std::string::npos)
+            {
+                result += ".0";
+            }
+            return std::is_same_v<T, float> ? result + "f" : result;
+        }
+
+        // Under the Throw policy the kernel throws where Duals would
+        void emitDomainCheck(const std::string& outside, const char* message)
+        {
+            out << "    if (" << outside << ") throw std::runtime_error(\"" << message << "\");\n";
+        }
+
+        static std::string laneText(const Lane& lane)
+        {
+            return lane.kind == Lane::Zero ? "0" : lane.kind == Lane::One ? "1" : lane.name;
+        }
+
+        // value * lane with the unit and zero cases folded; empty if zero
+        static std::string product(const std::string& value, const Lane& lane)
+        {
+            if (lane.kind == Lane::Zero)
+            {
+                return "";
+            }
+            return lane.kind == Lane::One ? value : value + " * " + lane.name;
+        }
+
+        // Names lane i of register r; a bare variable is aliased rather than copied
+        Lane declare(uint32_t r, size_t i, const std::string& expression)
+        {
+            Lane lane;
+            lane.kind = Lane::Named;
+            if (expression.find_first_not_of("abcdefghijklmnopqrstuvwxyz0123456789_") == std::string::npos)
+            {
+                lane.name = expression;
+                return lane;
+            }
+            lane.name = "d" + std::to_string(r) + "_" + std::to_string(i);
+            out << "    const " << codeGenTypeName<T>() << " " << lane.name << " = " << expression << ";\n";
+            return lane;
+        }
+
+        void emitValue(uint32_t r, const std::string& expression)
+        {
+            out << "    const " << codeGenTypeName<T>() << " " << valueName(r) << " = " << expression << ";\n";
+        }
+
+        // Emits derivative lanes for r = f(a) given the name of f'(a)
+        void emitChain(uint32_t r, uint32_t a, const std::string& factor)
+        {
+            for (size_t i = 0; i < numInputs; ++i)
+            {
+                const Lane& da = lanes[a][i];
+                if (da.kind == Lane::One)
+                {
+                    lanes[r][i].kind = Lane::Named;
+                    lanes[r][i].name = factor;
+                }
+                else if (da.kind == Lane::Named)
+                {
+                    lanes[r][i] = declare(r, i, da.name + " * " + factor);
+                }
+            }
+        }
+
+        bool anyLane(uint32_t r) const
+        {
+            for (const Lane& lane : lanes[r])
+            {
+                if (lane.kind != Lane::Zero)
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void emitInstruction(const ExpressionInstruction<T>& instruction)
+        {
+            uint32_t r = instruction.target;
+            std::string a = valueName(instruction.left);
+            std::string b = valueName(instruction.right);
+            std::string f = "f" + std::to_string(r);
+            const char* type = codeGenTypeName<T>();
+            const T nan = std::numeric_limits<T>::quiet_NaN();
+
+            switch (instruction.op)
+            {
+                case ExpressionOp::Input:
+                    emitValue(r, "x[" + std::to_string(instruction.left) + "]");
+                    lanes[r][instruction.left].kind = Lane::One;
+                    return;
+                case ExpressionOp::Constant:
+                    emitValue(r, literal(instruction.constant));
+                    return;
+                case ExpressionOp::Add:
+                case ExpressionOp::Subtract:
+                {
+                    const char* sign = instruction.op == ExpressionOp::Add ? " + " : " - ";
+                    emitValue(r, a + sign + b);
+                    for (size_t i = 0; i < numInputs; ++i)
+                    {
+                        const Lane& da = lanes[instruction.left][i];
+                        const Lane& db = lanes[instruction.right][i];
+                        if (db.kind == Lane::Zero)
+                        {
+                            lanes[r][i] = da;
+                        }
+                        else if (da.kind == Lane::Zero)
+                        {
+                            lanes[r][i] = instruction.op == ExpressionOp::Add ? db : declare(r, i, "-" + laneText(db));
+                        }
+                        else
+                        {
+                            lanes[r][i] = declare(r, i, laneText(da) + sign + laneText(db));
+                        }
+                    }
+                    return;
+                }
+                case ExpressionOp::Negate:
+                    emitValue(r, "-" + a);
+                    for (size_t i = 0; i < numInputs; ++i)
+                    {
+                        const Lane& da = lanes[instruction.left][i];
+                        if (da.kind != Lane::Zero)
+                        {
+                            lanes[r][i] = declare(r, i, "-" + laneText(da));
+                        }
+                    }
+                    return;
+                case ExpressionOp::Multiply:
+                    emitValue(r, a + " * " + b);
+                    for (size_t i = 0; i < numInputs; ++i)
+                    {
+                        std::string left = product(a, lanes[instruction.right][i]);
+                        std::string right = product(b, lanes[instruction.left][i]);
+                        if (!left.empty() && !right.empty())
+                        {
+                            lanes[r][i] = declare(r, i, left + " + " + right);
+                        }
+                        else if (!left.empty() || !right.empty())
+                        {
+                            lanes[r][i] = declare(r, i, left.empty() ? right : left);
+                        }
+                    }
+                    return;
+                case ExpressionOp::Divide:
+                    // d(a / b) = (da - r * db) / b
+                    emitValue(r, a + " / " + b);
+                    for (size_t i = 0; i < numInputs; ++i)
+                    {
+                        const Lane& da = lanes[instruction.left][i];
+                        std::string scaled = product(valueName(r), lanes[instruction.right][i]);
+                        if (da.kind == Lane::Zero && scaled.empty())
+                        {
+                            continue;
+                        }
+                        std::string numerator = scaled.empty() ? laneText(da)
+                                              : da.kind == Lane::Zero ? "-(" + scaled + ")"
+                                              : "(" + laneText(da) + " - " + scaled + ")";
+                        lanes[r][i] = declare(r, i, numerator + " / " + b);
+                    }
+                    return;
+                default:
+                    break;
+            }
+
+            // Elementary functions: value, then the chain-rule factor once, then the lanes
+            std::string value;
+            std::string factor;
+            switch (instruction.op)
+            {
+                case ExpressionOp::Sin: value = "std::sin(" + a + ")"; factor = "std::cos(" + a + ")"; break;
+                case ExpressionOp::Cos: value = "std::cos(" + a + ")"; factor = "-std::sin(" + a + ")"; break;
+                case ExpressionOp::Tan: value = "std::tan(" + a + ")"; factor = "1 / (std::cos(" + a + ") * std::cos(" + a + "))"; break;
+                case ExpressionOp::ArcSin: value = "std::asin(" + a + ")"; factor = "1 / std::sqrt(1 - " + a + " * " + a + ")"; break;
+                case ExpressionOp::ArcCos: value = "std::acos(" + a + ")"; factor = "-1 / std::sqrt(1 - " + a + " * " + a + ")"; break;
+                case ExpressionOp::ArcTan: value = "std::atan(" + a + ")"; factor = "1 / (1 + " + a + " * " + a + ")"; break;
+                case ExpressionOp::Pow:
+                {
+                    std::string p = literal(instruction.constant);
+                    value = "std::pow(" + a + ", " + p + ")";
+                    factor = p + " * std::pow(" + a + ", " + literal(instruction.constant - T(1)) + ")";
+                    break;
+                }
+                case ExpressionOp::Exp: value = "std::exp(" + a + ")"; factor = valueName(r); break;
+                // The domain-checked functions follow the DualsDomain policy the
+                // generator was compiled with, like Duals and JitHelpers
+                case ExpressionOp::Log:
+                    value = "std::log(" + a + ")";
+                    factor = "1 / " + a;
+                    if (dualsDomain == DualsDomain::Throw)
+                    {
+                        emitDomainCheck(a + " <= 0", "Log is undefined for values 0 or less");
+                    }
+                    else if (dualsDomain == DualsDomain::NaN)
+                    {
+                        value = "(" + a + " > 0 ? " + value + " : " + literal(nan) + ")";
+                        factor = "(" + a + " > 0 ? " + factor + " : " + literal(nan) + ")";
+                    }
+                    else
+                    {
+                        factor = "(" + a + " > 0 ? " + factor + " : " + type + "(0))";
+                    }
+                    break;
+                case ExpressionOp::Abs:
+                    value = "std::abs(" + a + ")";
+                    factor = type + std::string("(int(") + a + " > 0) - int(" + a + " < 0))";
+                    if (dualsDomain == DualsDomain::Throw)
+                    {
+                        emitDomainCheck(a + " == 0", "Derivative for the absolute value function doesn't exist at 0.");
+                    }
+                    else if (dualsDomain == DualsDomain::NaN)
+                    {
+                        factor = "(" + a + " != 0 ? " + factor + " : " + literal(nan) + ")";
+                    }
+                    break;
+                case ExpressionOp::Sqrt:
+                    value = "std::sqrt(" + a + ")";
+                    factor = "0.5 / " + valueName(r);
+                    if (dualsSqrtDomain == DualsDomain::Subgradient)
+                    {
+                        factor = "(" + a + " > 0 ? " + factor + " : " + type + "(0))";
+                    }
+                    break;
+                default: break;
+            }
+
+            emitValue(r, value);
+            if (!anyLane(instruction.left))
+            {
+                return;
+            }
+            if (factor != valueName(r))
+            {
+                out << "    const " << type << " " << f << " = " << factor << ";\n";
+                factor = f;
+            }
+            emitChain(r, instruction.left, factor);
+        }
+
+        std::ostream& out;
+        const ExpressionProgram<T>& program;
+        size_t numInputs;
+        std::vector<std::vector<Lane>> lanes;
+};
+
+// Writes the kernel for a compiled program
+template<typename T>
+void emitGradientKernel(std::ostream& out, const std::string& name, const ExpressionProgram<T>& program)
+{
+    GradientKernelEmitter<T>(out, program).emit(name);
+}
+
+// Traces f over INPUTS scalars, optimizes it and writes its kernel
+template<size_t INPUTS, typename T, typename Function>
+void emitGradientKernel(std::ostream& out, const std::string& name, const Function& f)
+{
+    ExpressionProgram<T> program = traceFunction<INPUTS, T>(f).compile();
+    emitGradientKernel(out, name, program);
+}
+
+#endif
@@ -0,0 +1,205 @@
+#ifndef DERIVATIVES_H
+#define DERIVATIVES_H
+
+#include <algorithm>
+#include "Duals.h"
+#include "LinearAlgebra.h"
+
+// Drivers that seed Duals for a user function and unpack the derivatives.
+// The function is any callable templated on its scalar type, taking
+// const std::array<S, N>& and returning S, e.g.
+//
+//     struct Rosenbrock
+//     {
+//         template <typename S>
+//         S operator()(const std::array<S, 2>& x) const { ... }
+//     };
+//
+// so the same code can be evaluated with T, Duals<N, T> or nested duals.
+
+// Seeds x[i] with the i-th unit direction so one evaluation yields the full gradient
+template<size_t N, typename T>
+std::array<Duals<N, T>, N> seedGradient(const Vector<N, T>& x)
+{
+    std::array<Duals<N, T>, N> seeded;
+    for (size_t i = 0; i < N; ++i)
+    {
+        seeded[i].setValue(x[i]);
+        seeded[i].setDerivative(i, T(1));
+    }
+    return seeded;
+}
+
+// Evaluates f once with Duals and returns its value, writing the gradient
+template<size_t N, typename T, typename Function>
+T valueAndGradient(const Function& f, const Vector<N, T>& x, Vector<N, T>& gradient)
+{
+    Duals<N, T> y = f(seedGradient(x));
+    gradient = y.getAllDerivatives();
+    return y.getValue();
+}
+
+// Jacobian-vector product: evaluates f at x + eps * v with Duals<1, T>, so
+// each output carries its value and its directional derivative along v.
+// Returns whatever f returns (a Duals<1, T> or an array of them).
+template<size_t N, typename T, typename Function>
+auto jvp(const Function& f, const Vector<N, T>& x, const Vector<N, T>& v)
+{
+    std::array<Duals<1, T>, N> seeded;
+    for (size_t i = 0; i < N; ++i)
+    {
+        seeded[i] = Duals<1, T>(x[i], v[i]);
+    }
+    return f(seeded);
+}
+
+// Jacobian-vector product of a vector function f: R^N -> R^M, writing f(x) and J * v
+template<size_t N, size_t M, typename T, typename Function>
+void jvp(const Function& f, const Vector<N, T>& x, const Vector<N, T>& v, Vector<M, T>& value, Vector<M, T>& tangent)
+{
+    std::array<Duals<1, T>, M> y = jvp(f, x, v);
+    for (size_t row = 0; row < M; ++row)
+    {
+        value[row] = y[row].getValue();
+        tangent[row] = y[row].getDerivative();
+    }
+}
+
+// Evaluates a vector function f: R^N -> R^M and its M x N Jacobian.
+// Each forward pass seeds CHUNK input directions at once using Duals<CHUNK, T>,
+// so the Jacobian takes ceil(N / CHUNK) passes; CHUNK = 0 means all N at once.
+template<size_t CHUNK = 0, size_t N, size_t M, typename T, typename Function>
+void valueAndJacobian(const Function& f, const Vector<N, T>& x, Vector<M, T>& value, RectMatrix<M, N, T>& jacobian)
+{
+    constexpr size_t LANES = CHUNK == 0 ? N : CHUNK;
+    static_assert(LANES <= N, "Chunk size cannot exceed the number of inputs");
+
+    std::array<Duals<LANES, T>, N> seeded;
+    for (size_t i = 0; i < N; ++i)
+    {
+        seeded[i].setValue(x[i]);
+    }
+
+    for (size_t first = 0; first < N; first += LANES)
+    {
+        size_t count = std::min(LANES, N - first);
+        for (size_t lane = 0; lane < count; ++lane)
+        {
+            seeded[first + lane].setDerivative(lane, T(1));
+        }
+
+        std::array<Duals<LANES, T>, M> y = f(seeded);
+        for (size_t row = 0; row < M; ++row)
+        {
+            value[row] = y[row].getValue();
+            for (size_t lane = 0; lane < count; ++lane)
+            {
+                jacobian[row][first + lane] = y[row].getDerivative(lane);
+            }
+        }
+
+        for (size_t lane = 0; lane < count; ++lane)
+        {
+            seeded[first + lane].setDerivative(lane, T(0));
+        }
+    }
+}
+
+// Evaluates f once with nested duals (Duals<N, Duals<N, T>>) and returns its value,
+// writing the gradient and the full Hessian
+template<size_t N, typename T, typename Function>
+T valueGradientAndHessian(const Function& f, const Vector<N, T>& x, Vector<N, T>& gradient, Matrix<N, T>& hessian)
+{
+    using Inner = Duals<N, T>;
+    using Outer = Duals<N, Inner>;
+
+    std::array<Outer, N> seeded;
+    for (size_t i = 0; i < N; ++i)
+    {
+        Inner value(x[i]);
+        value.setDerivative(i, T(1));
+        seeded[i].setValue(value);
+        seeded[i].setDerivative(i, Inner(T(1)));
+    }
+
+    Outer y = f(seeded);
+    for (size_t i = 0; i < N; ++i)
+    {
+        gradient[i] = y.getValue().getDerivative(i);
+        for (size_t j = 0; j < N; ++j)
+        {
+            hessian[i][j] = y.getDerivative(i).getDerivative(j);
+        }
+    }
+    return y.getValue().getValue();
+}
+
+// Hessian-vector products H(x) * v_k without forming H, by forward-over-forward
+// nesting: the outer Duals<N> lanes carry the gradient directions and the
+// inner Duals<K> lanes the directions v_k, so outer lane i ends up holding
+// (H v_k)_i in inner lane k. Every operation costs O(N K), against O(N^2)
+// for valueGradientAndHessian, and the primal and gradient work is shared
+// by all K directions. Also writes the gradient and returns f(x).
+template<size_t K, size_t N, typename T, typename Function>
+T valueGradientAndHvp(const Function& f, const Vector<N, T>& x, const std::array<Vector<N, T>, K>& directions,
+                      Vector<N, T>& gradient, std::array<Vector<N, T>, K>& products)
+{
+    using Inner = Duals<K, T>;
+    using Outer = Duals<N, Inner>;
+
+    std::array<Outer, N> seeded;
+    for (size_t i = 0; i < N; ++i)
+    {
+        Inner value(x[i]);
+        for (size_t k = 0; k < K; ++k)
+        {
+            value.setDerivative(k, directions[k][i]);
+        }
+        seeded[i].setValue(value);
+        seeded[i].setDerivative(i, Inner(T(1)));
+    }
+
+    Outer y = f(seeded);
+    for (size_t i = 0; i < N; ++i)
+    {
+        gradient[i] = y.getDerivative(i).getValue();
+        for (size_t k = 0; k < K; ++k)
+        {
+            products[k][i] = y.getDerivative(i).getDerivative(k);
+        }
+    }
+    return y.getValue().getValue();
+}
+
+// The same for a single direction v, i.e. with Duals<N, Duals<1, T>>
+template<size_t N, typename T, typename Function>
+T valueGradientAndHvp(const Function& f, const Vector<N, T>& x, const Vector<N, T>& v, Vector<N, T>& gradient,
+                      Vector<N, T>& product)
+{
+    std::array<Vector<N, T>, 1> products;
+    T value = valueGradientAndHvp(f, x, std::array<Vector<N, T>, 1>{v}, gradient, products);
+    product = products[0];
+    return value;
+}
+
+// H(x) * v
+template<size_t N, typename T, typename Function>
+Vector<N, T> hvp(const Function& f, const Vector<N, T>& x, const Vector<N, T>& v)
+{
+    Vector<N, T> gradient;
+    Vector<N, T> product;
+    valueGradientAndHvp(f, x, v, gradient, product);
+    return product;
+}
+
+// H(x) * v_k for each of the K directions, in one pass
+template<size_t K, size_t N, typename T, typename Function>
+std::array<Vector<N, T>, K> hvp(const Function& f, const Vector<N, T>& x, const std::array<Vector<N, T>, K>& directions)
+{
+    Vector<N, T> gradient;
+    std::array<Vector<N, T>, K> products;
+    valueGradientAndHvp(f, x, directions, gradient, products);
+    return products;
+}
+
+#endif
@@ -2,39 +2,89 @@
 #define DUALS_H
 
 #include <iostream>
+#include <algorithm>
+#include <cassert>
 #include <cmath>
 #include <stdexcept>
 #include <array> // Required for handling multiple derivatives
+#include <limits>
+#include <type_traits>
+#include "DualsCounters.h"
 
 #define PI 3.14159265359f
  
 #define EPSILON 0.001f  // for numeric derivatives calculation
 
-template<size_t NUMVARIABLES = 1, typename T = double>
+// Tag for constructing Duals whose value and lanes are left uninitialized
+// (for plain scalar T), for kernels that overwrite all of them right away
+struct DualsUninitialized {};
+constexpr DualsUninitialized dualsUninitialized{};
+
+// Storage policies for the derivative lanes. DualsPacked stores them right
+// after the value. DualsAligned<ALIGNMENT, WIDTH> aligns the lane block to
+// ALIGNMENT bytes and pads the lane count up to a multiple of WIDTH, so whole
+// SIMD registers cover the lanes with aligned loads and, e.g. with 64 bytes
+// and 8 doubles, the block never straddles a cache line. Padding lanes are
+// kept out of every accessor and comparison.
+template<size_t ALIGNMENT = 0, size_t WIDTH = 1>
+struct DualsStorage
+{
+    template<typename T>
+    static constexpr size_t alignment() { return ALIGNMENT > alignof(T) ? ALIGNMENT : alignof(T); }
+
+    static constexpr size_t lanes(size_t count) { return (count + WIDTH - 1) / WIDTH * WIDTH; }
+};
+
+using DualsPacked = DualsStorage<>;
+
+template<size_t ALIGNMENT, size_t WIDTH = 1>
+using DualsAligned = DualsStorage<ALIGNMENT, WIDTH>;
+
+// Duals has no user-declared copy, move or destructor, so for a trivially
+// copyable T it is trivially copyable and standard layout itself (checked
+// below): vectors of Duals reallocate and copy with plain memcpy.
+//
+// The ordering operators compare the value and break ties on the derivative
+// lanes, so Duals can key ordered containers. Compile with
+// -DDUALS_VALUE_COMPARISONS to order by value alone, which is what piecewise
+// code and sorting by function value need and costs no lane scan.
+template<size_t NUMVARIABLES = 1, typename T = double, typename Storage = DualsPacked>
 class Duals 
 {
     private:
         T value;
-        std::array<T, NUMVARIABLES> derivatives;
+        alignas(Storage::template alignment<T>()) std::array<T, Storage::lanes(NUMVARIABLES)> derivatives;
 
     public:
+        // Lanes held in memory, NUMVARIABLES plus any padding
+        static constexpr size_t STORED_LANES = Storage::lanes(NUMVARIABLES);
+
         // Default constructor initializes to zero
-        Duals() : value(T()), derivatives({}) {}
+        Duals() noexcept : value(T()), derivatives({}) {}
+
+        // Leaves value and derivatives for the caller to fill in; padding lanes are zeroed
+        explicit Duals(DualsUninitialized) noexcept
+        {
+            for (size_t i = NUMVARIABLES; i < STORED_LANES; ++i)
+            {
+                derivatives[i] = T();
+            }
+        }
 
         // Constructor for value with zero derivative
-        Duals(T val) : value(val), derivatives({}) {}
+        Duals(T val) noexcept : value(val), derivatives({}) {}
 
         // Constructor for both value and derivative
-        Duals(T val, T der) : value(val), derivatives({der}) {}
+        Duals(T val, T der) noexcept : value(val), derivatives({der}) {}
 
         // Constructor for value and multiple derivatives
-        Duals(T val, const std::array<T, NUMVARIABLES>& der) : value(val), derivatives(der) {}
+        Duals(T val, const std::array<T, NUMVARIABLES>& der) noexcept : value(val), derivatives(padded(der)) {}
 
         // Getter for value (for const correctness)
-        T getValue() const { return value; }
+        T getValue() const noexcept { return value; }
 
         // Getter for derivative (single variable)
-        T getDerivative() const { return derivatives[0]; }
+        T getDerivative() const noexcept { return derivatives[0]; }
 
         // Getter for derivative (multiple variables)
         T getDerivative(size_t index) const 
@@ -46,17 +96,30 @@ class Duals
             return derivatives[index];
         }
 
-            // Getter for the entire array of derivatives
-        const std::array<T, NUMVARIABLES>& getAllDerivatives() const 
+            // Getter for the entire array of derivatives, by reference unless the storage is padded
+        decltype(auto) getAllDerivatives() const noexcept
         {
-            return derivatives;
+            if constexpr (STORED_LANES == NUMVARIABLES)
+            {
+                return (derivatives);
+            }
+            else
+            {
+                std::array<T, NUMVARIABLES> lanes;
+                std::copy(derivatives.begin(), derivatives.begin() + NUMVARIABLES, lanes.begin());
+                return lanes;
+            }
         }
 
+        // All STORED_LANES lanes, for kernels that sweep the padded block
+        const T* laneData() const noexcept { return derivatives.data(); }
+        T* laneData() noexcept { return derivatives.data(); }
+
         // Setter for value
-        void setValue(T val) { value = val; }
+        void setValue(T val) noexcept { value = val; }
 
         // Setter for derivative (single variable)
-        void setDerivative(T der) { derivatives[0] = der; }
+        void setDerivative(T der) noexcept { derivatives[0] = der; }
 
         // Setter for derivative (multiple variables)
         void setDerivative(size_t index, T der) 
@@ -69,336 +132,1108 @@ class Duals
         }
 
             // Setter for the entire array of derivatives
-        void setAllDerivatives(const std::array<T, NUMVARIABLES>& newDerivatives) 
+        void setAllDerivatives(const std::array<T, NUMVARIABLES>& newDerivatives) noexcept
         {
-            derivatives = newDerivatives;
+            derivatives = padded(newDerivatives);
         }
 
-        bool operator==(const Duals<NUMVARIABLES, T>& other) const 
+        bool operator==(const Duals<NUMVARIABLES, T, Storage>& other) const noexcept
         {
-           return (this->value == other.value && this->derivatives == other.derivatives);
+           return (this->value == other.value && std::equal(this->lanesBegin(), this->lanesEnd(), other.lanesBegin()));
         }
 
-        bool operator<(const Duals<NUMVARIABLES, T>& other) const 
+        bool operator!=(const Duals<NUMVARIABLES, T, Storage>& other) const noexcept
+        {
+            return !(*this == other);
+        }
+
+#ifdef DUALS_VALUE_COMPARISONS
+        // Ordered by value alone, like the function being differentiated
+        bool operator<(const Duals<NUMVARIABLES, T, Storage>& other) const noexcept { return this->value < other.value; }
+        bool operator>(const Duals<NUMVARIABLES, T, Storage>& other) const noexcept { return this->value > other.value; }
+        bool operator<=(const Duals<NUMVARIABLES, T, Storage>& other) const noexcept { return this->value <= other.value; }
+        bool operator>=(const Duals<NUMVARIABLES, T, Storage>& other) const noexcept { return this->value >= other.value; }
+#else
+        bool operator<(const Duals<NUMVARIABLES, T, Storage>& other) const noexcept
+        {
+            if (this->value < other.value) return true;
+            if (this->value > other.value) return false;
+            return lanesLess(*this, other); // Use deriv as a tiebreaker if values are equal
+        }
+
+        bool operator>(const Duals<NUMVARIABLES, T, Storage>& other) const noexcept
+        {
+            if (this->value > other.value) return true;
+            if (this->value < other.value) return false;
+            return lanesLess(other, *this); // Use deriv as a tiebreaker if values are equal
+        }
+
+        // Single pass over the lanes rather than < followed by ==
+        bool operator<=(const Duals<NUMVARIABLES, T, Storage>& other) const noexcept
         {
             if (this->value < other.value) return true;
             if (this->value > other.value) return false;
-            return this->derivatives < other.derivatives; // Use deriv as a tiebreaker if values are equal
+            return !lanesLess(other, *this);
         }
 
-        bool operator>(const Duals<NUMVARIABLES, T>& other) const
+        bool operator>=(const Duals<NUMVARIABLES, T, Storage>& other) const noexcept
         {
             if (this->value > other.value) return true;
             if (this->value < other.value) return false;
-            return this->derivatives > other.derivatives; // Use deriv as a tiebreaker if values are equal
+            return !lanesLess(*this, other);
+        }
+#endif
+
+        // Friend function for operator<< to allow access to private members for printing
+        template<size_t VARIABLES, typename U, typename OtherStorage>
+        friend std::ostream& operator<<(std::ostream& os, const Duals<VARIABLES, U, OtherStorage>& d);
+
+    private:
+        static std::array<T, STORED_LANES> padded(const std::array<T, NUMVARIABLES>& lanes) noexcept
+        {
+            if constexpr (STORED_LANES == NUMVARIABLES)
+            {
+                return lanes;
+            }
+            else
+            {
+                std::array<T, STORED_LANES> result = {};
+                std::copy(lanes.begin(), lanes.end(), result.begin());
+                return result;
+            }
+        }
+
+        const T* lanesBegin() const noexcept { return derivatives.data(); }
+        const T* lanesEnd() const noexcept { return derivatives.data() + NUMVARIABLES; }
+
+        static bool lanesLess(const Duals& a, const Duals& b) noexcept
+        {
+            return std::lexicographical_compare(a.lanesBegin(), a.lanesEnd(), b.lanesBegin(), b.lanesEnd());
+        }
+};
+
+// Single-variable specialization: a value and one derivative stored as two
+// plain scalars. This is the shape of every directional derivative / JVP, so
+// it keeps the same interface as the general template but with no array,
+// no loops and no bounds checks; lane indices other than 0 are a logic error.
+template<typename T>
+class Duals<1, T, DualsPacked>
+{
+    private:
+        T value;
+        T derivative;
+
+    public:
+        // Default constructor initializes to zero
+        Duals() noexcept : value(T()), derivative(T()) {}
+
+        // Leaves value and derivative for the caller to fill in
+        explicit Duals(DualsUninitialized) noexcept {}
+
+        // Constructor for value with zero derivative
+        Duals(T val) noexcept : value(val), derivative(T()) {}
+
+        // Constructor for both value and derivative
+        Duals(T val, T der) noexcept : value(val), derivative(der) {}
+
+        // Constructor for value and a one-element derivative array
+        Duals(T val, const std::array<T, 1>& der) noexcept : value(val), derivative(der[0]) {}
+
+        T getValue() const noexcept { return value; }
+
+        T getDerivative() const noexcept { return derivative; }
+
+        T getDerivative(size_t index) const noexcept
+        {
+            assert(index == 0);
+            (void)index;
+            return derivative;
+        }
+
+        // Returned by value since there is no array to refer to
+        std::array<T, 1> getAllDerivatives() const noexcept { return {derivative}; }
+
+        static constexpr size_t STORED_LANES = 1;
+
+        const T* laneData() const noexcept { return &derivative; }
+        T* laneData() noexcept { return &derivative; }
+
+        void setValue(T val) noexcept { value = val; }
+
+        void setDerivative(T der) noexcept { derivative = der; }
+
+        void setDerivative(size_t index, T der) noexcept
+        {
+            assert(index == 0);
+            (void)index;
+            derivative = der;
+        }
+
+        void setAllDerivatives(const std::array<T, 1>& newDerivatives) noexcept { derivative = newDerivatives[0]; }
+
+        bool operator==(const Duals<1, T>& other) const noexcept
+        {
+            return value == other.value && derivative == other.derivative;
         }
 
-        bool operator!=(const Duals<NUMVARIABLES, T>& other) const
+        bool operator!=(const Duals<1, T>& other) const noexcept
         {
             return !(*this == other);
         }
 
-        bool operator<=(const Duals<NUMVARIABLES, T>& other) const 
+#ifdef DUALS_VALUE_COMPARISONS
+        bool operator<(const Duals<1, T>& other) const noexcept { return value < other.value; }
+        bool operator>(const Duals<1, T>& other) const noexcept { return value > other.value; }
+        bool operator<=(const Duals<1, T>& other) const noexcept { return value <= other.value; }
+        bool operator>=(const Duals<1, T>& other) const noexcept { return value >= other.value; }
+#else
+        bool operator<(const Duals<1, T>& other) const noexcept
         {
-            return *this < other || *this == other;
+            if (value < other.value) return true;
+            if (value > other.value) return false;
+            return derivative < other.derivative;
         }
 
-        bool operator>=(const Duals<NUMVARIABLES, T>& other) const 
+        bool operator>(const Duals<1, T>& other) const noexcept
         {
-            return *this > other || *this == other;
+            if (value > other.value) return true;
+            if (value < other.value) return false;
+            return derivative > other.derivative;
         }
 
-        // Friend function for operator<< to allow access to private members for printing
-        template<size_t VARIABLES, typename U>
-        friend std::ostream& operator<<(std::ostream& os, const Duals<VARIABLES, U>& d);
+        bool operator<=(const Duals<1, T>& other) const noexcept
+        {
+            if (value < other.value) return true;
+            if (value > other.value) return false;
+            return derivative <= other.derivative;
+        }
+
+        bool operator>=(const Duals<1, T>& other) const noexcept
+        {
+            if (value > other.value) return true;
+            if (value < other.value) return false;
+            return derivative >= other.derivative;
+        }
+#endif
+};
+
+// Underlying scalar type of (possibly nested) duals, e.g. double for Duals<N, Duals<M, double>>
+template<typename T>
+struct DualsScalar
+{
+    using type = T;
+};
+
+template<size_t VARIABLES, typename U, typename Storage>
+struct DualsScalar<Duals<VARIABLES, U, Storage>>
+{
+    using type = typename DualsScalar<U>::type;
+};
+
+// Primal value of a plain scalar or of (possibly nested) duals
+template<typename T>
+T primalValue(const T& x)
+{
+    return x;
+}
+
+template<size_t VARIABLES, typename U, typename Storage>
+typename DualsScalar<U>::type primalValue(const Duals<VARIABLES, U, Storage>& d)
+{
+    return primalValue(d.getValue());
+}
+
+// How log, log1p, abs and sqrt treat arguments outside their domain (or at
+// a point where the derivative does not exist). Chosen at compile time with
+// -DDUALS_DOMAIN=Throw|NaN|Subgradient, default Throw:
+//   Throw        log, log1p and abs throw std::runtime_error, as they always
+//                have; sqrt keeps returning NaN as it always has, and throws
+//                only when asked explicitly with sqrt<DualsDomain::Throw>(x)
+//   NaN          never throw; the value and every derivative lane become NaN
+//                (sqrt follows IEEE, so sqrt(0) has infinite lanes)
+//   Subgradient  never throw; abs uses 0 at the kink, and log, log1p and sqrt
+//                give zero lanes wherever their derivative is not finite
+// The non-throwing policies select between precomputed values instead of
+// branching, so loops over them stay free of unwinding paths and vectorize.
+// Each function also takes the policy as an explicit template argument,
+// e.g. log<DualsDomain::NaN>(x), which is passed down to nested duals.
+enum class DualsDomain
+{
+    Throw,
+    NaN,
+    Subgradient
 };
 
-// Overloaded operator+ for addition between Duals and primitive types
-template<size_t NUMVARIABLES, typename T>
-Duals<NUMVARIABLES, T> operator+(const Duals<NUMVARIABLES, T>& lhs, const T& rhs) 
+#ifndef DUALS_DOMAIN
+#define DUALS_DOMAIN Throw
+#endif
+
+constexpr DualsDomain dualsDomain = DualsDomain::DUALS_DOMAIN;
+
+// sqrt never threw before the policies existed, so its default stays NaN under Throw
+constexpr DualsDomain dualsSqrtDomain = dualsDomain == DualsDomain::Throw ? DualsDomain::NaN : dualsDomain;
+
+// Layout guarantees relied on by containers of Duals and by kernels that
+// copy them as raw memory
+static_assert(std::is_trivially_copyable_v<Duals<4, double>> && std::is_standard_layout_v<Duals<4, double>>,
+              "Duals<N, T> must be trivially copyable and standard layout");
+static_assert(std::is_trivially_copyable_v<Duals<1, double>> && std::is_standard_layout_v<Duals<1, double>>,
+              "Duals<1, T> must be trivially copyable and standard layout");
+static_assert(std::is_trivially_copyable_v<Duals<3, Duals<1, float>>>, "Nested duals must stay trivially copyable");
+static_assert(sizeof(Duals<4, double>) == 5 * sizeof(double) && sizeof(Duals<1, double>) == 2 * sizeof(double),
+              "Duals must hold exactly the value and its lanes");
+static_assert(std::is_nothrow_move_constructible_v<Duals<4, double>> && std::is_nothrow_default_constructible_v<Duals<4, double>>,
+              "Duals must reallocate without exceptions");
+
+// Unary minus negates the value and every derivative
+template<size_t NUMVARIABLES, typename T, typename Storage>
+Duals<NUMVARIABLES, T, Storage> operator-(const Duals<NUMVARIABLES, T, Storage>& d) noexcept
+{
+    DUALS_COUNT(Subtract, NUMVARIABLES);
+    Duals<NUMVARIABLES, T, Storage> result(dualsUninitialized);
+    result.setValue(-d.getValue());
+    const T* lanes = d.laneData();
+    T* out = result.laneData();
+    for (size_t i = 0; i < Duals<NUMVARIABLES, T, Storage>::STORED_LANES; ++i)
+    {
+        out[i] = -lanes[i];
+    }
+    return result;
+}
+
+// Overloaded operator+ for Duals plus a scalar; the derivatives carry over unchanged
+template<size_t NUMVARIABLES, typename T, typename Storage>
+Duals<NUMVARIABLES, T, Storage> operator+(const Duals<NUMVARIABLES, T, Storage>& lhs, const T& rhs) noexcept
 {
-    Duals<NUMVARIABLES, T> result;
+    DUALS_COUNT(Add, NUMVARIABLES);
+    Duals<NUMVARIABLES, T, Storage> result = lhs;
     result.setValue(lhs.getValue() + rhs);
-    const auto& derivatives = lhs.getAllDerivatives();
-    result.setAllDerivatives(derivatives);
     return result;
 }
 
-// Overloaded operator+ for addition between primitive types and Duals
-template<size_t NUMVARIABLES, typename T>
-Duals<NUMVARIABLES, T> operator+(const T& lhs, const Duals<NUMVARIABLES, T>& rhs) 
+// Overloaded operator+ for a scalar plus Duals
+template<size_t NUMVARIABLES, typename T, typename Storage>
+Duals<NUMVARIABLES, T, Storage> operator+(const T& lhs, const Duals<NUMVARIABLES, T, Storage>& rhs) noexcept
 {
-    Duals<NUMVARIABLES, T> result;
+    DUALS_COUNT(Add, NUMVARIABLES);
+    Duals<NUMVARIABLES, T, Storage> result = rhs;
     result.setValue(lhs + rhs.getValue());
-    const auto& derivatives = rhs.getAllDerivatives();
-    result.setAllDerivatives(derivatives);
     return result;
 }
 
+// Any other arithmetic scalar, e.g. an int literal, converted once to T; the
+// exact T overloads above are preferred, and also cover nested duals
+template<size_t NUMVARIABLES, typename T, typename Storage, typename S, typename = std::enable_if_t<std::is_arithmetic_v<S>>>
+Duals<NUMVARIABLES, T, Storage> operator+(const Duals<NUMVARIABLES, T, Storage>& lhs, S rhs) noexcept
+{
+    return lhs + T(rhs);
+}
+
+template<size_t NUMVARIABLES, typename T, typename Storage, typename S, typename = std::enable_if_t<std::is_arithmetic_v<S>>>
+Duals<NUMVARIABLES, T, Storage> operator+(S lhs, const Duals<NUMVARIABLES, T, Storage>& rhs) noexcept
+{
+    return T(lhs) + rhs;
+}
+
 // Original operator+ for addition between two Duals remains unchanged
-template<size_t NUMVARIABLES, typename T>
-Duals<NUMVARIABLES, T> operator+(const Duals<NUMVARIABLES, T>& lhs, const Duals<NUMVARIABLES, T>& rhs) 
+template<size_t NUMVARIABLES, typename T, typename Storage>
+Duals<NUMVARIABLES, T, Storage> operator+(const Duals<NUMVARIABLES, T, Storage>& lhs, const Duals<NUMVARIABLES, T, Storage>& rhs) noexcept
 {
-    Duals<NUMVARIABLES, T> result;
+    DUALS_COUNT(Add, NUMVARIABLES);
+    Duals<NUMVARIABLES, T, Storage> result(dualsUninitialized);
     result.setValue(lhs.getValue() + rhs.getValue());
-    for (size_t i = 0; i < NUMVARIABLES; ++i)
+    // Over the padded block too, so the loop is whole SIMD registers
+    const T* a = lhs.laneData();
+    const T* b = rhs.laneData();
+    T* out = result.laneData();
+    for (size_t i = 0; i < Duals<NUMVARIABLES, T, Storage>::STORED_LANES; ++i)
     {
-         result.setDerivative(i, lhs.getDerivative(i) + rhs.getDerivative(i));
+        out[i] = a[i] + b[i];
     }
     return result;
 }
 
-// Overloaded operator- for addition between Duals and primitive types
-template<size_t NUMVARIABLES, typename T>
-Duals<NUMVARIABLES, T> operator-(const Duals<NUMVARIABLES, T>& lhs, const T& rhs) 
+// Overloaded operator- for Duals minus a scalar
+template<size_t NUMVARIABLES, typename T, typename Storage>
+Duals<NUMVARIABLES, T, Storage> operator-(const Duals<NUMVARIABLES, T, Storage>& lhs, const T& rhs) noexcept
 {
-    Duals<NUMVARIABLES, T> result;
+    DUALS_COUNT(Subtract, NUMVARIABLES);
+    Duals<NUMVARIABLES, T, Storage> result = lhs;
     result.setValue(lhs.getValue() - rhs);
-    const auto& derivatives = lhs.getAllDerivatives();
-    result.setAllDerivatives(derivatives);
     return result;
 }
 
-// Overloaded operator- for addition between primitive types and Duals
-template<size_t NUMVARIABLES, typename T>
-Duals<NUMVARIABLES, T> operator-(const T& lhs, const Duals<NUMVARIABLES, T>& rhs) 
+// Overloaded operator- for a scalar minus Duals; the derivatives are negated
+template<size_t NUMVARIABLES, typename T, typename Storage>
+Duals<NUMVARIABLES, T, Storage> operator-(const T& lhs, const Duals<NUMVARIABLES, T, Storage>& rhs) noexcept
 {
-    Duals<NUMVARIABLES, T> result;
+    DUALS_COUNT(Subtract, NUMVARIABLES);
+    Duals<NUMVARIABLES, T, Storage> result(dualsUninitialized);
     result.setValue(lhs - rhs.getValue());
-    const auto& derivatives = rhs.getAllDerivatives();
-    result.setAllDerivatives(derivatives);
+    const T* lanes = rhs.laneData();
+    T* out = result.laneData();
+    for (size_t i = 0; i < Duals<NUMVARIABLES, T, Storage>::STORED_LANES; ++i)
+    {
+        out[i] = -lanes[i];
+    }
     return result;
 }
 
+// Other arithmetic scalars, converted once to T
+template<size_t NUMVARIABLES, typename T, typename Storage, typename S, typename = std::enable_if_t<std::is_arithmetic_v<S>>>
+Duals<NUMVARIABLES, T, Storage> operator-(const Duals<NUMVARIABLES, T, Storage>& lhs, S rhs) noexcept
+{
+    return lhs - T(rhs);
+}
+
+template<size_t NUMVARIABLES, typename T, typename Storage, typename S, typename = std::enable_if_t<std::is_arithmetic_v<S>>>
+Duals<NUMVARIABLES, T, Storage> operator-(S lhs, const Duals<NUMVARIABLES, T, Storage>& rhs) noexcept
+{
+    return T(lhs) - rhs;
+}
+
 // Original operator+ for addition between two Duals remains unchanged
-template<size_t NUMVARIABLES, typename T>
-Duals<NUMVARIABLES, T> operator-(const Duals<NUMVARIABLES, T>& lhs, const Duals<NUMVARIABLES, T>& rhs) 
+template<size_t NUMVARIABLES, typename T, typename Storage>
+Duals<NUMVARIABLES, T, Storage> operator-(const Duals<NUMVARIABLES, T, Storage>& lhs, const Duals<NUMVARIABLES, T, Storage>& rhs) noexcept
 {
-    Duals<NUMVARIABLES, T> result;
+    DUALS_COUNT(Subtract, NUMVARIABLES);
+    Duals<NUMVARIABLES, T, Storage> result(dualsUninitialized);
     result.setValue(lhs.getValue() - rhs.getValue());
-    for (size_t i = 0; i < NUMVARIABLES; ++i)
+    const T* a = lhs.laneData();
+    const T* b = rhs.laneData();
+    T* out = result.laneData();
+    for (size_t i = 0; i < Duals<NUMVARIABLES, T, Storage>::STORED_LANES; ++i)
     {
-         result.setDerivative(i, lhs.getDerivative(i) - rhs.getDerivative(i));
+        out[i] = a[i] - b[i];
     }
     return result;
 }
 
-// Overloaded operator* for addition between Duals and primitive types
-template<size_t NUMVARIABLES, typename T>
-Duals<NUMVARIABLES, T> operator*(const Duals<NUMVARIABLES, T>& lhs, const T& rhs) 
+// Overloaded operator* for Duals times a scalar; the derivatives are scaled
+template<size_t NUMVARIABLES, typename T, typename Storage>
+Duals<NUMVARIABLES, T, Storage> operator*(const Duals<NUMVARIABLES, T, Storage>& lhs, const T& rhs) noexcept
 {
-    Duals<NUMVARIABLES, T> result;
-    result.setValue(lhs.getValue() * rhs);
-    const auto& derivatives = lhs.getAllDerivatives();
-    result.setAllDerivatives(derivatives);
+    DUALS_COUNT(Multiply, NUMVARIABLES);
+    const T scalar = rhs;
+    Duals<NUMVARIABLES, T, Storage> result(dualsUninitialized);
+    result.setValue(lhs.getValue() * scalar);
+    const T* lanes = lhs.laneData();
+    T* out = result.laneData();
+    for (size_t i = 0; i < Duals<NUMVARIABLES, T, Storage>::STORED_LANES; ++i)
+    {
+        out[i] = lanes[i] * scalar;
+    }
     return result;
 }
 
-// Overloaded operator* for addition between primitive types and Duals
-template<size_t NUMVARIABLES, typename T>
-Duals<NUMVARIABLES, T> operator*(const T& lhs, const Duals<NUMVARIABLES, T>& rhs) 
+// Overloaded operator* for a scalar times Duals
+template<size_t NUMVARIABLES, typename T, typename Storage>
+Duals<NUMVARIABLES, T, Storage> operator*(const T& lhs, const Duals<NUMVARIABLES, T, Storage>& rhs) noexcept
 {
-    Duals<NUMVARIABLES, T> result;
-    result.setValue(lhs * rhs.getValue());
-    const auto& derivatives = rhs.getAllDerivatives();
-    result.setAllDerivatives(derivatives);
+    DUALS_COUNT(Multiply, NUMVARIABLES);
+    const T scalar = lhs;
+    Duals<NUMVARIABLES, T, Storage> result(dualsUninitialized);
+    result.setValue(scalar * rhs.getValue());
+    const T* lanes = rhs.laneData();
+    T* out = result.laneData();
+    for (size_t i = 0; i < Duals<NUMVARIABLES, T, Storage>::STORED_LANES; ++i)
+    {
+        out[i] = scalar * lanes[i];
+    }
     return result;
 }
 
+// Other arithmetic scalars, converted once to T
+template<size_t NUMVARIABLES, typename T, typename Storage, typename S, typename = std::enable_if_t<std::is_arithmetic_v<S>>>
+Duals<NUMVARIABLES, T, Storage> operator*(const Duals<NUMVARIABLES, T, Storage>& lhs, S rhs) noexcept
+{
+    return lhs * T(rhs);
+}
+
+template<size_t NUMVARIABLES, typename T, typename Storage, typename S, typename = std::enable_if_t<std::is_arithmetic_v<S>>>
+Duals<NUMVARIABLES, T, Storage> operator*(S lhs, const Duals<NUMVARIABLES, T, Storage>& rhs) noexcept
+{
+    return T(lhs) * rhs;
+}
+
 // Original operator* for addition between two Duals remains unchanged
-template<size_t NUMVARIABLES, typename T>
-Duals<NUMVARIABLES, T> operator*(const Duals<NUMVARIABLES, T>& lhs, const Duals<NUMVARIABLES, T>& rhs) 
+template<size_t NUMVARIABLES, typename T, typename Storage>
+Duals<NUMVARIABLES, T, Storage> operator*(const Duals<NUMVARIABLES, T, Storage>& lhs, const Duals<NUMVARIABLES, T, Storage>& rhs) noexcept
 {
-    Duals<NUMVARIABLES, T> result;
-    result.setValue(lhs.getValue() * rhs.getValue());
-    for (size_t i = 0; i < NUMVARIABLES; ++i)
+    DUALS_COUNT(Multiply, NUMVARIABLES);
+    const T u = lhs.getValue();
+    const T v = rhs.getValue();
+    Duals<NUMVARIABLES, T, Storage> result(dualsUninitialized);
+    result.setValue(u * v);
+    const T* a = lhs.laneData();
+    const T* b = rhs.laneData();
+    T* out = result.laneData();
+    for (size_t i = 0; i < Duals<NUMVARIABLES, T, Storage>::STORED_LANES; ++i)
     {
-         result.setDerivative(i, lhs.getValue() * rhs.getDerivative(i) + lhs.getDerivative(i) * rhs.getValue());
+        out[i] = u * b[i] + a[i] * v;
     }
     return result;
 }
 
-// Overloaded operator/ for addition between Duals and primitive types
-template<size_t NUMVARIABLES, typename T>
-Duals<NUMVARIABLES, T> operator/(const Duals<NUMVARIABLES, T>& lhs, const T& rhs) 
+// The divisions sweep only the real lanes and leave the padding zeroed; with
+// a zero divisor a padded sweep would fill it with 0 / 0 = NaN
+
+// Overloaded operator/ for Duals divided by a scalar
+template<size_t NUMVARIABLES, typename T, typename Storage>
+Duals<NUMVARIABLES, T, Storage> operator/(const Duals<NUMVARIABLES, T, Storage>& lhs, const T& rhs) noexcept
 {
-    Duals<NUMVARIABLES, T> result;
-    result.setValue(lhs.getValue() / rhs);
-    const auto& derivatives = lhs.getAllDerivatives();
-    result.setAllDerivatives(derivatives);
+    DUALS_COUNT(Divide, NUMVARIABLES);
+    const T scalar = rhs;
+    Duals<NUMVARIABLES, T, Storage> result(dualsUninitialized);
+    result.setValue(lhs.getValue() / scalar);
+    const T* lanes = lhs.laneData();
+    T* out = result.laneData();
+    for (size_t i = 0; i < NUMVARIABLES; ++i)
+    {
+        out[i] = lanes[i] / scalar;
+    }
     return result;
 }
 
-// Overloaded operator/ for addition between primitive types and Duals
-template<size_t NUMVARIABLES, typename T>
-Duals<NUMVARIABLES, T> operator/(const T& lhs, const Duals<NUMVARIABLES, T>& rhs) 
+// Overloaded operator/ for a scalar divided by Duals: d(s / x) = -(s / x) / x dx
+template<size_t NUMVARIABLES, typename T, typename Storage>
+Duals<NUMVARIABLES, T, Storage> operator/(const T& lhs, const Duals<NUMVARIABLES, T, Storage>& rhs) noexcept
 {
-    Duals<NUMVARIABLES, T> result;
-    result.setValue(lhs / rhs.getValue());
-    const auto& derivatives = rhs.getAllDerivatives();
-    result.setAllDerivatives(derivatives);
+    DUALS_COUNT(Divide, NUMVARIABLES);
+    const T quotient = lhs / rhs.getValue();
+    const T factor = -quotient / rhs.getValue();
+    Duals<NUMVARIABLES, T, Storage> result(dualsUninitialized);
+    result.setValue(quotient);
+    const T* lanes = rhs.laneData();
+    T* out = result.laneData();
+    for (size_t i = 0; i < NUMVARIABLES; ++i)
+    {
+        out[i] = lanes[i] * factor;
+    }
     return result;
 }
 
+// Other arithmetic scalars, converted once to T
+template<size_t NUMVARIABLES, typename T, typename Storage, typename S, typename = std::enable_if_t<std::is_arithmetic_v<S>>>
+Duals<NUMVARIABLES, T, Storage> operator/(const Duals<NUMVARIABLES, T, Storage>& lhs, S rhs) noexcept
+{
+    return lhs / T(rhs);
+}
+
+template<size_t NUMVARIABLES, typename T, typename Storage, typename S, typename = std::enable_if_t<std::is_arithmetic_v<S>>>
+Duals<NUMVARIABLES, T, Storage> operator/(S lhs, const Duals<NUMVARIABLES, T, Storage>& rhs) noexcept
+{
+    return T(lhs) / rhs;
+}
+
 // Original operator/ for addition between two Duals remains unchanged
-template<size_t NUMVARIABLES, typename T>
-Duals<NUMVARIABLES, T> operator/(const Duals<NUMVARIABLES, T>& lhs, const Duals<NUMVARIABLES, T>& rhs) 
+template<size_t NUMVARIABLES, typename T, typename Storage>
+Duals<NUMVARIABLES, T, Storage> operator/(const Duals<NUMVARIABLES, T, Storage>& lhs, const Duals<NUMVARIABLES, T, Storage>& rhs) noexcept
 {
-    Duals<NUMVARIABLES, T> result;
-    result.setValue(lhs.getValue() / rhs.getValue());
+    DUALS_COUNT(Divide, NUMVARIABLES);
+    const T u = lhs.getValue();
+    const T v = rhs.getValue();
+    const T square = v * v;
+    Duals<NUMVARIABLES, T, Storage> result(dualsUninitialized);
+    result.setValue(u / v);
+    const T* a = lhs.laneData();
+    const T* b = rhs.laneData();
+    T* out = result.laneData();
     for (size_t i = 0; i < NUMVARIABLES; ++i)
     {
-         result.setDerivative(i, (lhs.getDerivative(i) * rhs.getValue() - rhs.getDerivative(i) * lhs.getValue()) / (rhs.getValue() * rhs.getValue()));
+        out[i] = (a[i] * v - b[i] * u) / square;
     }
     return result;
 }
 
-// Non-member functions for mathematical operations using the public interface
-template<size_t VARIABLES, typename U>
-Duals<VARIABLES, U> sin(const Duals<VARIABLES, U>& d) 
+// Non-member functions for mathematical operations using the public interface.
+// The std functions are pulled in with using-declarations so that nested duals
+// (e.g. Duals<N, Duals<N, T>> for second derivatives) resolve to these overloads.
+// The lanes are written through laneData() like the operators, but only the
+// real ones: a non-finite factor would otherwise turn the zero padding into NaN.
+// Only the domain-checked functions can throw, and only under the Throw policy.
+template<size_t VARIABLES, typename U, typename Storage>
+Duals<VARIABLES, U, Storage> sin(const Duals<VARIABLES, U, Storage>& d) noexcept
 {
-    Duals<VARIABLES, U> result;
-    result.setValue(std::sin(d.getValue()));
+    DUALS_COUNT(Sin, VARIABLES);
+    using std::sin;
+    using std::cos;
+    Duals<VARIABLES, U, Storage> result(dualsUninitialized);
+    result.setValue(sin(d.getValue()));
+    const U slope = cos(d.getValue());
+    const U* lanes = d.laneData();
+    U* out = result.laneData();
     for (size_t i = 0; i < VARIABLES; ++i)
     {
-        result.setDerivative(i, d.getDerivative(i) * std::cos(d.getValue()));
+        out[i] = lanes[i] * slope;
     }
     return result;
 }
 
-template<size_t VARIABLES, typename U>
-Duals<VARIABLES, U> cos(const Duals<VARIABLES, U>& d) 
+template<size_t VARIABLES, typename U, typename Storage>
+Duals<VARIABLES, U, Storage> cos(const Duals<VARIABLES, U, Storage>& d) noexcept
 {
-    Duals<VARIABLES, U> result;
-    result.setValue(std::cos(d.getValue()));
+    DUALS_COUNT(Cos, VARIABLES);
+    using std::sin;
+    using std::cos;
+    Duals<VARIABLES, U, Storage> result(dualsUninitialized);
+    result.setValue(cos(d.getValue()));
+    const U sine = sin(d.getValue());
+    const U* lanes = d.laneData();
+    U* out = result.laneData();
     for (size_t i = 0; i < VARIABLES; ++i)
     {
-        result.setDerivative(i, -d.getDerivative(i) * std::sin(d.getValue()));
+        out[i] = -lanes[i] * sine;
     }
     return result;
 }
 
-template<size_t VARIABLES, typename U>
-Duals<VARIABLES, U> tan(const Duals<VARIABLES, U>& d) 
+template<size_t VARIABLES, typename U, typename Storage>
+Duals<VARIABLES, U, Storage> tan(const Duals<VARIABLES, U, Storage>& d) noexcept
 {
-    Duals<VARIABLES, U> result;
-    result.setValue(std::tan(d.getValue()));
+    DUALS_COUNT(Tan, VARIABLES);
+    using std::tan;
+    using std::cos;
+    Duals<VARIABLES, U, Storage> result(dualsUninitialized);
+    result.setValue(tan(d.getValue()));
+    const U cosine = cos(d.getValue());
+    const U denominator = cosine * cosine;
+    const U* lanes = d.laneData();
+    U* out = result.laneData();
     for (size_t i = 0; i < VARIABLES; ++i)
     {
-        result.setDerivative(i, d.getDerivative(i) / (std::cos(d.getValue()) * std::cos(d.getValue())));
+        out[i] = lanes[i] / denominator;
     }
     return result;
 }
 
-template<size_t VARIABLES, typename U>
-Duals<VARIABLES, U> arcsin(const Duals<VARIABLES, U>& d) 
+template<size_t VARIABLES, typename U, typename Storage>
+Duals<VARIABLES, U, Storage> arcsin(const Duals<VARIABLES, U, Storage>& d) noexcept
 {
-    Duals<VARIABLES, U> result;
-    result.setValue(std::asin(d.getValue()));
+    DUALS_COUNT(ArcSin, VARIABLES);
+    using std::asin;
+    using std::sqrt;
+    Duals<VARIABLES, U, Storage> result(dualsUninitialized);
+    result.setValue(asin(d.getValue()));
+    const U denominator = sqrt(U(1.0) - d.getValue() * d.getValue());
+    const U* lanes = d.laneData();
+    U* out = result.laneData();
     for (size_t i = 0; i < VARIABLES; ++i)
     {
-        result.setDerivative(i, d.getDerivative(i) / std::sqrt(U(1.0) - d.getValue() * d.getValue()));
+        out[i] = lanes[i] / denominator;
     }
     return result;
 }
 
-template<size_t VARIABLES, typename U>
-Duals<VARIABLES, U> arccos(const Duals<VARIABLES, U>& d) 
+template<size_t VARIABLES, typename U, typename Storage>
+Duals<VARIABLES, U, Storage> arccos(const Duals<VARIABLES, U, Storage>& d) noexcept
 {
-    Duals<VARIABLES, U> result;
-    result.setValue(std::acos(d.getValue()));
+    DUALS_COUNT(ArcCos, VARIABLES);
+    using std::acos;
+    using std::sqrt;
+    Duals<VARIABLES, U, Storage> result(dualsUninitialized);
+    result.setValue(acos(d.getValue()));
+    const U denominator = sqrt(U(1.0) - d.getValue() * d.getValue());
+    const U* lanes = d.laneData();
+    U* out = result.laneData();
     for (size_t i = 0; i < VARIABLES; ++i)
     {
-        result.setDerivative(i, -d.getDerivative(i) / std::sqrt(U(1.0) - d.getValue() * d.getValue()));
+        out[i] = -lanes[i] / denominator;
     }
     return result;
 }
 
-template<size_t VARIABLES, typename U>
-Duals<VARIABLES, U> arctan(const Duals<VARIABLES, U>& d) 
+template<size_t VARIABLES, typename U, typename Storage>
+Duals<VARIABLES, U, Storage> arctan(const Duals<VARIABLES, U, Storage>& d) noexcept
 {
-    Duals<VARIABLES, U> result;
-    result.setValue(std::atan(d.getValue()));
+    DUALS_COUNT(ArcTan, VARIABLES);
+    using std::atan;
+    Duals<VARIABLES, U, Storage> result(dualsUninitialized);
+    result.setValue(atan(d.getValue()));
+    const U denominator = U(1.0) + d.getValue() * d.getValue();
+    const U* lanes = d.laneData();
+    U* out = result.laneData();
     for (size_t i = 0; i < VARIABLES; ++i)
     {
-        result.setDerivative(i, d.getDerivative(i) / (U(1.0) + d.getValue() * d.getValue()));
+        out[i] = lanes[i] / denominator;
     }
     return result;
 }
 
-template<size_t VARIABLES, typename U>
-Duals<VARIABLES, U> pow(const Duals<VARIABLES, U>& d, float p)
+template<size_t VARIABLES, typename U, typename Storage>
+Duals<VARIABLES, U, Storage> pow(const Duals<VARIABLES, U, Storage>& d, float p) noexcept
 {
-    Duals<VARIABLES, U> result;
-    result.setValue(std::pow(d.getValue(), p));
+    DUALS_COUNT(Pow, VARIABLES);
+    using std::pow;
+    Duals<VARIABLES, U, Storage> result(dualsUninitialized);
+    result.setValue(pow(d.getValue(), p));
+    const U power = pow(d.getValue(), p - 1.0f);
+    const U* lanes = d.laneData();
+    U* out = result.laneData();
     for (size_t i = 0; i < VARIABLES; ++i)
     {
-        result.setDerivative(i, U(p) * d.getDerivative(i) * std::pow(d.getValue(), p - U(1.0)));
+        out[i] = U(p) * lanes[i] * power;
     }
     return result;
 }
 
-template<size_t VARIABLES, typename U>
-Duals<VARIABLES, U> exp(const Duals<VARIABLES, U>& d) 
+template<size_t VARIABLES, typename U, typename Storage>
+Duals<VARIABLES, U, Storage> exp(const Duals<VARIABLES, U, Storage>& d) noexcept
 {
-    Duals<VARIABLES, U> result;
-    result.setValue(std::exp(d.getValue()));
+    DUALS_COUNT(Exp, VARIABLES);
+    using std::exp;
+    Duals<VARIABLES, U, Storage> result(dualsUninitialized);
+    const U exponential = exp(d.getValue());
+    result.setValue(exponential);
+    const U* lanes = d.laneData();
+    U* out = result.laneData();
     for (size_t i = 0; i < VARIABLES; ++i)
     {
-        result.setDerivative(i, d.getDerivative(i) * std::exp(d.getValue()));
+        out[i] = lanes[i] * exponential;
     }
     return result;
 }
 
-template<size_t VARIABLES, typename U>
-Duals<VARIABLES, U> log(const Duals<VARIABLES, U>& d)
+// Whether T is itself duals, so nested values can be passed the same policy
+template<typename T>
+struct IsDuals : std::false_type {};
+
+template<size_t VARIABLES, typename U, typename Storage>
+struct IsDuals<Duals<VARIABLES, U, Storage>> : std::true_type {};
+
+// Added to a value and its chain-rule factor: zero inside the domain, NaN outside
+template<typename Scalar>
+Scalar dualsDomainPoison(bool inDomain)
+{
+    return inDomain ? Scalar(0) : std::numeric_limits<Scalar>::quiet_NaN();
+}
+
+template<DualsDomain POLICY = dualsDomain, size_t VARIABLES, typename U, typename Storage>
+Duals<VARIABLES, U, Storage> log(const Duals<VARIABLES, U, Storage>& d) noexcept(POLICY != DualsDomain::Throw)
 {
-    if (d.getValue() <= U(0))
+    DUALS_COUNT(Log, VARIABLES);
+    using Scalar = typename DualsScalar<U>::type;
+    const Scalar x = primalValue(d.getValue());
+    if constexpr (POLICY == DualsDomain::Throw)
+    {
+        if (x <= Scalar(0))
+        {
+            throw std::runtime_error("Log is undefined for values 0 or less");
+        }
+    }
+    const bool inDomain = x > Scalar(0);
+    U logarithm;
+    if constexpr (IsDuals<U>::value)
+    {
+        logarithm = log<POLICY>(d.getValue());
+    }
+    else
+    {
+        using std::log;
+        logarithm = log(d.getValue());
+    }
+    U factor = U(1) / (inDomain ? d.getValue() : U(1));
+    if constexpr (POLICY == DualsDomain::NaN)
+    {
+        const Scalar poison = dualsDomainPoison<Scalar>(inDomain);
+        logarithm = logarithm + poison;
+        factor = factor + poison;
+    }
+    else if constexpr (POLICY == DualsDomain::Subgradient)
     {
-        throw std::runtime_error("Log is undefined for values 0 or less");
+        factor = inDomain ? factor : U(0);
     }
-    Duals<VARIABLES, U> result;
-    result.setValue(std::log(d.getValue()));
+    Duals<VARIABLES, U, Storage> result(dualsUninitialized);
+    result.setValue(logarithm);
+    const U* lanes = d.laneData();
+    U* out = result.laneData();
     for (size_t i = 0; i < VARIABLES; ++i)
     {
-        result.setDerivative(i, d.getDerivative(i) / d.getValue());
+        out[i] = lanes[i] * factor;
     }
     return result;
 }
 
-template<size_t VARIABLES, typename U>
-Duals<VARIABLES, U> abs(const Duals<VARIABLES, U>& d)
+template<DualsDomain POLICY = dualsDomain, size_t VARIABLES, typename U, typename Storage>
+Duals<VARIABLES, U, Storage> abs(const Duals<VARIABLES, U, Storage>& d) noexcept(POLICY != DualsDomain::Throw)
 {
-    if (d.getValue() == U(0)) 
+    DUALS_COUNT(Abs, VARIABLES);
+    using Scalar = typename DualsScalar<U>::type;
+    const Scalar x = primalValue(d.getValue());
+    if constexpr (POLICY == DualsDomain::Throw)
+    {
+        if (x == Scalar(0))
+        {
+            throw std::runtime_error("Derivative for the absolute value function doesn't exist at 0.");
+        }
+    }
+    U absolute;
+    if constexpr (IsDuals<U>::value)
+    {
+        absolute = abs<POLICY>(d.getValue());
+    }
+    else
+    {
+        using std::abs;
+        absolute = abs(d.getValue());
+    }
+    // -1, 0 or 1 without a branch; 0 (the subgradient) only at the kink
+    Scalar sign = Scalar(int(x > Scalar(0)) - int(x < Scalar(0)));
+    if constexpr (POLICY == DualsDomain::NaN)
     {
-        throw std::runtime_error("Derivative for the absolute value function doesn't exist at 0.");
+        sign = sign + dualsDomainPoison<Scalar>(x > Scalar(0) || x < Scalar(0));
     }
-    int sign = d.getValue() > U(0) ? 1 : -1;
-    Duals<VARIABLES, U> result;
-    result.setValue(std::abs(d.getValue()));
+    Duals<VARIABLES, U, Storage> result(dualsUninitialized);
+    result.setValue(absolute);
+    const U* lanes = d.laneData();
+    U* out = result.laneData();
     for (size_t i = 0; i < VARIABLES; ++i)
     {
-        result.setDerivative(i, d.getDerivative(i) * sign);
+        out[i] = lanes[i] * sign;
     }
     return result;
 }
 
-template<size_t VARIABLES, typename U>
-Duals<VARIABLES, U> sqrt(const Duals<VARIABLES, U>& d)
+template<DualsDomain POLICY = dualsSqrtDomain, size_t VARIABLES, typename U, typename Storage>
+Duals<VARIABLES, U, Storage> sqrt(const Duals<VARIABLES, U, Storage>& d) noexcept(POLICY != DualsDomain::Throw)
 {
-    Duals<VARIABLES, U> result;
-    U squareRoot = std::sqrt(d.getValue());
+    DUALS_COUNT(Sqrt, VARIABLES);
+    using Scalar = typename DualsScalar<U>::type;
+    const Scalar x = primalValue(d.getValue());
+    if constexpr (POLICY == DualsDomain::Throw)
+    {
+        if (x < Scalar(0))
+        {
+            throw std::runtime_error("Sqrt is undefined for negative values");
+        }
+    }
+    U squareRoot;
+    if constexpr (IsDuals<U>::value)
+    {
+        squareRoot = sqrt<POLICY>(d.getValue());
+    }
+    else
+    {
+        using std::sqrt;
+        squareRoot = sqrt(d.getValue());
+    }
+    U factor = U(0.5) / squareRoot;
+    if constexpr (POLICY == DualsDomain::Subgradient)
+    {
+        factor = x > Scalar(0) ? factor : U(0);
+    }
+    Duals<VARIABLES, U, Storage> result(dualsUninitialized);
     result.setValue(squareRoot);
+    const U* lanes = d.laneData();
+    U* out = result.laneData();
+    for (size_t i = 0; i < VARIABLES; ++i)
+    {
+        out[i] = lanes[i] * factor;
+    }
+    return result;
+}
+
+// Further elementary functions. Each computes its value and chain-rule
+// factor(s) once and then scales the derivative lanes in a single pass.
+
+template<size_t VARIABLES, typename U, typename Storage>
+Duals<VARIABLES, U, Storage> sinh(const Duals<VARIABLES, U, Storage>& d) noexcept
+{
+    DUALS_COUNT(Sinh, VARIABLES);
+    using std::sinh;
+    using std::cosh;
+    Duals<VARIABLES, U, Storage> result(dualsUninitialized);
+    result.setValue(sinh(d.getValue()));
+    U factor = cosh(d.getValue());
+    const U* lanes = d.laneData();
+    U* out = result.laneData();
+    for (size_t i = 0; i < VARIABLES; ++i)
+    {
+        out[i] = lanes[i] * factor;
+    }
+    return result;
+}
+
+template<size_t VARIABLES, typename U, typename Storage>
+Duals<VARIABLES, U, Storage> cosh(const Duals<VARIABLES, U, Storage>& d) noexcept
+{
+    DUALS_COUNT(Cosh, VARIABLES);
+    using std::sinh;
+    using std::cosh;
+    Duals<VARIABLES, U, Storage> result(dualsUninitialized);
+    result.setValue(cosh(d.getValue()));
+    U factor = sinh(d.getValue());
+    const U* lanes = d.laneData();
+    U* out = result.laneData();
+    for (size_t i = 0; i < VARIABLES; ++i)
+    {
+        out[i] = lanes[i] * factor;
+    }
+    return result;
+}
+
+// Written in terms of e = exp(-2|x|) so that neither the value nor
+// sech^2 = 4e / (1 + e)^2 cancels or overflows for large |x|
+template<size_t VARIABLES, typename U, typename Storage>
+Duals<VARIABLES, U, Storage> tanh(const Duals<VARIABLES, U, Storage>& d) noexcept
+{
+    DUALS_COUNT(Tanh, VARIABLES);
+    using std::exp;
+    bool negative = primalValue(d.getValue()) < 0;
+    U magnitude = negative ? U(0.0) - d.getValue() : d.getValue();
+    U e = exp(U(-2.0) * magnitude);
+    U denominator = U(1.0) + e;
+    U t = (U(1.0) - e) / denominator;
+    Duals<VARIABLES, U, Storage> result(dualsUninitialized);
+    result.setValue(negative ? U(0.0) - t : t);
+    U factor = U(4.0) * e / (denominator * denominator);
+    const U* lanes = d.laneData();
+    U* out = result.laneData();
+    for (size_t i = 0; i < VARIABLES; ++i)
+    {
+        out[i] = lanes[i] * factor;
+    }
+    return result;
+}
+
+template<DualsDomain POLICY = dualsDomain, size_t VARIABLES, typename U, typename Storage>
+Duals<VARIABLES, U, Storage> log1p(const Duals<VARIABLES, U, Storage>& d) noexcept(POLICY != DualsDomain::Throw)
+{
+    DUALS_COUNT(Log1p, VARIABLES);
+    using Scalar = typename DualsScalar<U>::type;
+    const Scalar x = primalValue(d.getValue());
+    if constexpr (POLICY == DualsDomain::Throw)
+    {
+        if (x <= Scalar(-1))
+        {
+            throw std::runtime_error("Log1p is undefined for values -1 or less");
+        }
+    }
+    const bool inDomain = x > Scalar(-1);
+    U logarithm;
+    if constexpr (IsDuals<U>::value)
+    {
+        logarithm = log1p<POLICY>(d.getValue());
+    }
+    else
+    {
+        using std::log1p;
+        logarithm = log1p(d.getValue());
+    }
+    U factor = U(1.0) / (inDomain ? U(1.0) + d.getValue() : U(1.0));
+    if constexpr (POLICY == DualsDomain::NaN)
+    {
+        const Scalar poison = dualsDomainPoison<Scalar>(inDomain);
+        logarithm = logarithm + poison;
+        factor = factor + poison;
+    }
+    else if constexpr (POLICY == DualsDomain::Subgradient)
+    {
+        factor = inDomain ? factor : U(0);
+    }
+    Duals<VARIABLES, U, Storage> result(dualsUninitialized);
+    result.setValue(logarithm);
+    const U* lanes = d.laneData();
+    U* out = result.laneData();
+    for (size_t i = 0; i < VARIABLES; ++i)
+    {
+        out[i] = lanes[i] * factor;
+    }
+    return result;
+}
+
+template<size_t VARIABLES, typename U, typename Storage>
+Duals<VARIABLES, U, Storage> expm1(const Duals<VARIABLES, U, Storage>& d) noexcept
+{
+    DUALS_COUNT(Expm1, VARIABLES);
+    using std::expm1;
+    using std::exp;
+    Duals<VARIABLES, U, Storage> result(dualsUninitialized);
+    result.setValue(expm1(d.getValue()));
+    U factor = exp(d.getValue());
+    const U* lanes = d.laneData();
+    U* out = result.laneData();
+    for (size_t i = 0; i < VARIABLES; ++i)
+    {
+        out[i] = lanes[i] * factor;
+    }
+    return result;
+}
+
+template<size_t VARIABLES, typename U, typename Storage>
+Duals<VARIABLES, U, Storage> cbrt(const Duals<VARIABLES, U, Storage>& d) noexcept
+{
+    DUALS_COUNT(Cbrt, VARIABLES);
+    using std::cbrt;
+    Duals<VARIABLES, U, Storage> result(dualsUninitialized);
+    U root = cbrt(d.getValue());
+    result.setValue(root);
+    U factor = U(1.0) / (U(3.0) * root * root);
+    const U* lanes = d.laneData();
+    U* out = result.laneData();
+    for (size_t i = 0; i < VARIABLES; ++i)
+    {
+        out[i] = lanes[i] * factor;
+    }
+    return result;
+}
+
+template<size_t VARIABLES, typename U, typename Storage>
+Duals<VARIABLES, U, Storage> erf(const Duals<VARIABLES, U, Storage>& d) noexcept
+{
+    DUALS_COUNT(Erf, VARIABLES);
+    using std::erf;
+    using std::exp;
+    Duals<VARIABLES, U, Storage> result(dualsUninitialized);
+    result.setValue(erf(d.getValue()));
+    // 2 / sqrt(pi)
+    U factor = U(1.1283791670955126) * exp(U(0.0) - d.getValue() * d.getValue());
+    const U* lanes = d.laneData();
+    U* out = result.laneData();
+    for (size_t i = 0; i < VARIABLES; ++i)
+    {
+        out[i] = lanes[i] * factor;
+    }
+    return result;
+}
+
+// Angle of (x, y); the factors are scaled by the hypotenuse twice rather
+// than divided by x^2 + y^2 so they cannot overflow
+template<size_t VARIABLES, typename U, typename Storage>
+Duals<VARIABLES, U, Storage> atan2(const Duals<VARIABLES, U, Storage>& y, const Duals<VARIABLES, U, Storage>& x) noexcept
+{
+    DUALS_COUNT(ArcTan2, VARIABLES);
+    using std::atan2;
+    using std::hypot;
+    Duals<VARIABLES, U, Storage> result(dualsUninitialized);
+    result.setValue(atan2(y.getValue(), x.getValue()));
+    U radius = hypot(x.getValue(), y.getValue());
+    U yFactor = x.getValue() / radius / radius;
+    U xFactor = U(0.0) - y.getValue() / radius / radius;
+    const U* yLanes = y.laneData();
+    const U* xLanes = x.laneData();
+    U* out = result.laneData();
+    for (size_t i = 0; i < VARIABLES; ++i)
+    {
+        out[i] = yLanes[i] * yFactor + xLanes[i] * xFactor;
+    }
+    return result;
+}
+
+template<size_t VARIABLES, typename U, typename Storage>
+Duals<VARIABLES, U, Storage> hypot(const Duals<VARIABLES, U, Storage>& x, const Duals<VARIABLES, U, Storage>& y) noexcept
+{
+    DUALS_COUNT(Hypot, VARIABLES);
+    using std::hypot;
+    Duals<VARIABLES, U, Storage> result(dualsUninitialized);
+    U radius = hypot(x.getValue(), y.getValue());
+    result.setValue(radius);
+    U xFactor = x.getValue() / radius;
+    U yFactor = y.getValue() / radius;
+    const U* xLanes = x.laneData();
+    const U* yLanes = y.laneData();
+    U* out = result.laneData();
+    for (size_t i = 0; i < VARIABLES; ++i)
+    {
+        out[i] = xLanes[i] * xFactor + yLanes[i] * yFactor;
+    }
+    return result;
+}
+
+// a where condition holds, else b, picked lane by lane with the same
+// condition so loops over it compile to blends instead of jumps. The scalar
+// overload lets generic code use it at every nesting level:
+//
+//     S y = select(primalValue(x) < 0, -x, x);   // |x| without a branch
+template<typename S, typename = std::enable_if_t<std::is_arithmetic_v<S>>>
+S select(bool condition, S a, S b) noexcept
+{
+    return condition ? a : b;
+}
+
+template<size_t VARIABLES, typename U, typename Storage>
+Duals<VARIABLES, U, Storage> select(bool condition, const Duals<VARIABLES, U, Storage>& a, const Duals<VARIABLES, U, Storage>& b) noexcept
+{
+    Duals<VARIABLES, U, Storage> result(dualsUninitialized);
+    result.setValue(select(condition, a.getValue(), b.getValue()));
+    const U* aLanes = a.laneData();
+    const U* bLanes = b.laneData();
+    U* out = result.laneData();
+    for (size_t i = 0; i < VARIABLES; ++i)
+    {
+        out[i] = select(condition, aLanes[i], bLanes[i]);
+    }
+    return result;
+}
+
+// Power with a dual exponent. The exponent derivative b^x log(b) is zero for
+// a zero base and NaN for a negative one, where the logarithm is undefined;
+// it is only added to lanes the exponent moves in, so a negative base raised
+// to a constant exponent keeps the gradient of pow(x, p).
+template<size_t VARIABLES, typename U, typename Storage>
+Duals<VARIABLES, U, Storage> pow(const Duals<VARIABLES, U, Storage>& base, const Duals<VARIABLES, U, Storage>& exponent) noexcept
+{
+    DUALS_COUNT(PowDuals, VARIABLES);
+    using std::pow;
+    using std::log;
+    using Scalar = typename DualsScalar<U>::type;
+    Duals<VARIABLES, U, Storage> result(dualsUninitialized);
+    U power = pow(base.getValue(), exponent.getValue());
+    result.setValue(power);
+    U baseFactor = exponent.getValue() * pow(base.getValue(), exponent.getValue() - U(1.0));
+    Scalar primalBase = primalValue(base.getValue());
+    U exponentFactor = primalBase > 0 ? power * log(base.getValue())
+                     : U(primalBase == 0 ? Scalar(0) : std::numeric_limits<Scalar>::quiet_NaN());
+    const U* baseLanes = base.laneData();
+    const U* exponentLanes = exponent.laneData();
+    U* out = result.laneData();
+    for (size_t i = 0; i < VARIABLES; ++i)
+    {
+        U baseTerm = baseLanes[i] * baseFactor;
+        bool exponentMoves = primalBase > 0 || primalValue(exponentLanes[i]) != Scalar(0);
+        out[i] = select(exponentMoves, baseTerm + exponentLanes[i] * exponentFactor, baseTerm);
+    }
+    return result;
+}
+
+// The smaller/larger argument by value (not the lexicographic operator<),
+// taking its derivatives along; ties pick the first argument
+template<size_t VARIABLES, typename U, typename Storage>
+Duals<VARIABLES, U, Storage> min(const Duals<VARIABLES, U, Storage>& a, const Duals<VARIABLES, U, Storage>& b) noexcept
+{
+    DUALS_COUNT(Min, VARIABLES);
+    return select(primalValue(b) < primalValue(a), b, a);
+}
+
+template<size_t VARIABLES, typename U, typename Storage>
+Duals<VARIABLES, U, Storage> max(const Duals<VARIABLES, U, Storage>& a, const Duals<VARIABLES, U, Storage>& b) noexcept
+{
+    DUALS_COUNT(Max, VARIABLES);
+    return select(primalValue(a) < primalValue(b), b, a);
+}
+
+// Remainder a - q b with q = trunc(a / b) held constant
+template<size_t VARIABLES, typename U, typename Storage>
+Duals<VARIABLES, U, Storage> fmod(const Duals<VARIABLES, U, Storage>& a, const Duals<VARIABLES, U, Storage>& b) noexcept
+{
+    DUALS_COUNT(Fmod, VARIABLES);
+    using std::fmod;
+    Duals<VARIABLES, U, Storage> result(dualsUninitialized);
+    result.setValue(fmod(a.getValue(), b.getValue()));
+    U quotient = U(std::trunc(primalValue(a) / primalValue(b)));
+    const U* aLanes = a.laneData();
+    const U* bLanes = b.laneData();
+    U* out = result.laneData();
     for (size_t i = 0; i < VARIABLES; ++i)
     {
-        result.setDerivative(i, U(0.5) * d.getDerivative(i) / squareRoot);
+        out[i] = aLanes[i] - quotient * bLanes[i];
     }
     return result;
 }
 
 // Overload of operator<< as a non-member function
-template<size_t VARIABLES, typename U>
-std::ostream& operator<<(std::ostream& outs, const Duals<VARIABLES, U>& d) 
+template<size_t VARIABLES, typename U, typename Storage>
+std::ostream& operator<<(std::ostream& outs, const Duals<VARIABLES, U, Storage>& d) 
 {
     outs << "Value: " << d.getValue() << ", Derivatives: [";
     for (size_t i = 0; i < VARIABLES; ++i) 
@@ -0,0 +1,282 @@
+#ifndef DUALS_COUNTERS_H
+#define DUALS_COUNTERS_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <mutex>
+#include <ostream>
+#include <utility>
+
+// Operation counters for Duals. Compile with -DDUALS_INSTRUMENT to have every
+// Duals operator and elementary function count itself and the number of
+// derivative lanes it touched. Without it DUALS_COUNT expands to nothing and
+// the operators are exactly as before; the report functions still exist and
+// simply return zeros.
+//
+// Each thread counts into its own thread_local block (plain relaxed stores,
+// no shared cache lines). dualsCounters() sums all live threads plus the
+// totals left behind by threads that have exited.
+
+enum class DualsOperation : size_t
+{
+    Add,
+    Subtract,
+    Multiply,
+    Divide,
+    Sin,
+    Cos,
+    Tan,
+    ArcSin,
+    ArcCos,
+    ArcTan,
+    Pow,
+    Exp,
+    Log,
+    Abs,
+    Sqrt,
+    Sinh,
+    Cosh,
+    Tanh,
+    Log1p,
+    Expm1,
+    Cbrt,
+    Erf,
+    ArcTan2,
+    Hypot,
+    PowDuals,
+    Min,
+    Max,
+    Fmod,
+    Count
+};
+
+constexpr size_t DUALS_OPERATION_COUNT = static_cast<size_t>(DualsOperation::Count);
+
+inline const char* dualsOperationName(DualsOperation operation)
+{
+    static const char* const names[DUALS_OPERATION_COUNT] = {
+        "add", "subtract", "multiply", "divide", "sin", "cos", "tan", "arcsin",
+        "arccos", "arctan", "pow", "exp", "log", "abs", "sqrt", "sinh", "cosh", "tanh",
+        "log1p", "expm1", "cbrt", "erf", "atan2", "hypot", "pow(d, d)", "min", "max", "fmod"};
+    size_t index = static_cast<size_t>(operation);
+    return index < DUALS_OPERATION_COUNT ? names[index] : "unknown";
+}
+
+// Snapshot of the counters: calls per operation and derivative lanes processed
+struct DualsCounts
+{
+    std::array<uint64_t, DUALS_OPERATION_COUNT> calls = {};
+    std::array<uint64_t, DUALS_OPERATION_COUNT> lanes = {};
+
+    uint64_t operator[](DualsOperation operation) const { return calls[static_cast<size_t>(operation)]; }
+
+    uint64_t lanesFor(DualsOperation operation) const { return lanes[static_cast<size_t>(operation)]; }
+
+    uint64_t totalCalls() const
+    {
+        uint64_t total = 0;
+        for (uint64_t count : calls)
+        {
+            total += count;
+        }
+        return total;
+    }
+
+    uint64_t totalLanes() const
+    {
+        uint64_t total = 0;
+        for (uint64_t count : lanes)
+        {
+            total += count;
+        }
+        return total;
+    }
+};
+
+#ifdef DUALS_INSTRUMENT
+
+class DualsThreadCounters;
+
+// Registry of the live per-thread counters and the totals of finished threads.
+// The counters are linked into an intrusive list under a spin lock, so a
+// thread's first count registers it without allocating or throwing, which
+// keeps DUALS_COUNT safe inside the noexcept operators.
+struct DualsCounterRegistry
+{
+    std::atomic_flag busy;
+    DualsThreadCounters* head = nullptr;
+    DualsCounts retired;
+
+    static DualsCounterRegistry& instance() noexcept
+    {
+        static DualsCounterRegistry registry;
+        return registry;
+    }
+
+    void lock() noexcept
+    {
+        while (busy.test_and_set(std::memory_order_acquire))
+        {
+            busy.wait(true, std::memory_order_relaxed);
+        }
+    }
+
+    void unlock() noexcept
+    {
+        busy.clear(std::memory_order_release);
+        busy.notify_one();
+    }
+};
+
+class DualsThreadCounters
+{
+    public:
+        DualsThreadCounters() noexcept
+        {
+            DualsCounterRegistry& registry = DualsCounterRegistry::instance();
+            std::lock_guard<DualsCounterRegistry> lock(registry);
+            next = registry.head;
+            if (next != nullptr)
+            {
+                next->previous = this;
+            }
+            registry.head = this;
+        }
+
+        ~DualsThreadCounters()
+        {
+            DualsCounterRegistry& registry = DualsCounterRegistry::instance();
+            std::lock_guard<DualsCounterRegistry> lock(registry);
+            addTo(registry.retired);
+            (previous != nullptr ? previous->next : registry.head) = next;
+            if (next != nullptr)
+            {
+                next->previous = previous;
+            }
+        }
+
+        DualsThreadCounters(const DualsThreadCounters&) = delete;
+        DualsThreadCounters& operator=(const DualsThreadCounters&) = delete;
+
+        // Only the owning thread writes, so a relaxed load + store is enough
+        void count(DualsOperation operation, size_t laneCount) noexcept
+        {
+            size_t index = static_cast<size_t>(operation);
+            calls[index].store(calls[index].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            lanes[index].store(lanes[index].load(std::memory_order_relaxed) + laneCount, std::memory_order_relaxed);
+        }
+
+        void addTo(DualsCounts& totals) const noexcept
+        {
+            for (size_t i = 0; i < DUALS_OPERATION_COUNT; ++i)
+            {
+                totals.calls[i] += calls[i].load(std::memory_order_relaxed);
+                totals.lanes[i] += lanes[i].load(std::memory_order_relaxed);
+            }
+        }
+
+        void reset() noexcept
+        {
+            for (size_t i = 0; i < DUALS_OPERATION_COUNT; ++i)
+            {
+                calls[i].store(0, std::memory_order_relaxed);
+                lanes[i].store(0, std::memory_order_relaxed);
+            }
+        }
+
+        static DualsThreadCounters& local() noexcept
+        {
+            thread_local DualsThreadCounters counters;
+            return counters;
+        }
+
+        DualsThreadCounters* getNext() const noexcept { return next; }
+
+    private:
+        std::array<std::atomic<uint64_t>, DUALS_OPERATION_COUNT> calls = {};
+        std::array<std::atomic<uint64_t>, DUALS_OPERATION_COUNT> lanes = {};
+        DualsThreadCounters* next = nullptr;
+        DualsThreadCounters* previous = nullptr;
+};
+
+#define DUALS_COUNT(operation, laneCount) DualsThreadCounters::local().count(DualsOperation::operation, (laneCount))
+
+// Aggregates the counters of all threads
+inline DualsCounts dualsCounters()
+{
+    DualsCounterRegistry& registry = DualsCounterRegistry::instance();
+    std::lock_guard<DualsCounterRegistry> lock(registry);
+    DualsCounts totals = registry.retired;
+    for (const DualsThreadCounters* counters = registry.head; counters != nullptr; counters = counters->getNext())
+    {
+        counters->addTo(totals);
+    }
+    return totals;
+}
+
+// Zeroes the counters of all threads. Counts made concurrently may be lost.
+inline void resetDualsCounters()
+{
+    DualsCounterRegistry& registry = DualsCounterRegistry::instance();
+    std::lock_guard<DualsCounterRegistry> lock(registry);
+    registry.retired = DualsCounts();
+    for (DualsThreadCounters* counters = registry.head; counters != nullptr; counters = counters->getNext())
+    {
+        counters->reset();
+    }
+}
+
+constexpr bool dualsInstrumented() { return true; }
+
+#else
+
+#define DUALS_COUNT(operation, laneCount) ((void)0)
+
+inline DualsCounts dualsCounters() { return DualsCounts(); }
+
+inline void resetDualsCounters() {}
+
+constexpr bool dualsInstrumented() { return false; }
+
+#endif
+
+// Prints one line per operation that was used, most lane work first
+inline void reportDualsCounters(std::ostream& outs, const DualsCounts& counts = dualsCounters())
+{
+    if (!dualsInstrumented())
+    {
+        outs << "Duals instrumentation disabled (compile with -DDUALS_INSTRUMENT)\n";
+        return;
+    }
+
+    std::array<size_t, DUALS_OPERATION_COUNT> order;
+    for (size_t i = 0; i < DUALS_OPERATION_COUNT; ++i)
+    {
+        order[i] = i;
+    }
+    for (size_t i = 1; i < DUALS_OPERATION_COUNT; ++i)
+    {
+        for (size_t j = i; j > 0 && counts.lanes[order[j]] > counts.lanes[order[j - 1]]; --j)
+        {
+            std::swap(order[j], order[j - 1]);
+        }
+    }
+
+    outs << std::left << std::setw(12) << "operation" << std::right << std::setw(16) << "calls" << std::setw(16) << "lanes" << '\n';
+    for (size_t index : order)
+    {
+        if (counts.calls[index] == 0)
+        {
+            continue;
+        }
+        outs << std::left << std::setw(12) << dualsOperationName(static_cast<DualsOperation>(index))
+             << std::right << std::setw(16) << counts.calls[index] << std::setw(16) << counts.lanes[index] << '\n';
+    }
+    outs << std::left << std::setw(12) << "total" << std::right << std::setw(16) << counts.totalCalls()
+         << std::setw(16) << counts.totalLanes() << '\n';
+}
+
+#endif
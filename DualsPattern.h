@@ -0,0 +1,219 @@
+#ifndef DUALS_PATTERN_H
+#define DUALS_PATTERN_H
+
+#include <array>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <ostream>
+#include <type_traits>
+#include "Duals.h"
+
+// Shadow of Duals<N, T> for finding which inputs an output depends on.
+// Instead of N derivative lanes it carries one bit per input, packed 64 to a
+// machine word: arithmetic ORs the operands' bits and elementary functions
+// pass them through, so a single evaluation of a user function templated on
+// its scalar type yields the Jacobian's sparsity pattern (see jacobianPattern
+// in Sparse.h). The value is computed as well, so comparisons, branches and
+// primalValue behave as they would at that point. The bits are structural:
+// x * 0 still depends on x, and select, min and max keep the bits of both
+// arguments, so the pattern holds whichever way they go.
+
+template<size_t NUMVARIABLES, typename T = double>
+class DualsPattern
+{
+    public:
+        static constexpr size_t WORDS = (NUMVARIABLES + 63) / 64;
+
+        // A constant: the value with no dependencies
+        DualsPattern(T val = T()) noexcept : value(val), mask({}) {}
+
+        T getValue() const noexcept { return value; }
+
+        void setValue(T val) noexcept { value = val; }
+
+        bool dependsOn(size_t index) const noexcept { return (mask[index / 64] >> (index % 64)) & 1; }
+
+        void setDependency(size_t index) noexcept { mask[index / 64] |= uint64_t(1) << (index % 64); }
+
+        // Number of inputs this value depends on
+        size_t dependencyCount() const noexcept
+        {
+            size_t count = 0;
+            for (uint64_t word : mask)
+            {
+                count += size_t(std::popcount(word));
+            }
+            return count;
+        }
+
+        const std::array<uint64_t, WORDS>& getMask() const noexcept { return mask; }
+
+        // value with the union of the bits of a and b
+        static DualsPattern combine(T val, const DualsPattern& a, const DualsPattern& b) noexcept
+        {
+            DualsPattern result(val);
+            for (size_t w = 0; w < WORDS; ++w)
+            {
+                result.mask[w] = a.mask[w] | b.mask[w];
+            }
+            return result;
+        }
+
+        // value with the bits of a
+        static DualsPattern passThrough(T val, const DualsPattern& a) noexcept
+        {
+            DualsPattern result(a);
+            result.value = val;
+            return result;
+        }
+
+        // Hidden friends, so plain scalars on either side convert implicitly
+        friend DualsPattern operator-(const DualsPattern& d) noexcept { return passThrough(-d.value, d); }
+        friend DualsPattern operator+(const DualsPattern& a, const DualsPattern& b) noexcept { return combine(a.value + b.value, a, b); }
+        friend DualsPattern operator-(const DualsPattern& a, const DualsPattern& b) noexcept { return combine(a.value - b.value, a, b); }
+        friend DualsPattern operator*(const DualsPattern& a, const DualsPattern& b) noexcept { return combine(a.value * b.value, a, b); }
+        friend DualsPattern operator/(const DualsPattern& a, const DualsPattern& b) noexcept { return combine(a.value / b.value, a, b); }
+
+        // Comparisons look at the values only
+        friend bool operator==(const DualsPattern& a, const DualsPattern& b) noexcept { return a.value == b.value; }
+        friend bool operator!=(const DualsPattern& a, const DualsPattern& b) noexcept { return a.value != b.value; }
+        friend bool operator<(const DualsPattern& a, const DualsPattern& b) noexcept { return a.value < b.value; }
+        friend bool operator>(const DualsPattern& a, const DualsPattern& b) noexcept { return a.value > b.value; }
+        friend bool operator<=(const DualsPattern& a, const DualsPattern& b) noexcept { return a.value <= b.value; }
+        friend bool operator>=(const DualsPattern& a, const DualsPattern& b) noexcept { return a.value >= b.value; }
+
+        friend std::ostream& operator<<(std::ostream& outs, const DualsPattern& d)
+        {
+            outs << d.value << " depends on {";
+            const char* separator = "";
+            for (size_t i = 0; i < NUMVARIABLES; ++i)
+            {
+                if (d.dependsOn(i))
+                {
+                    outs << separator << i;
+                    separator = ", ";
+                }
+            }
+            return outs << "}";
+        }
+
+    private:
+        T value;
+        std::array<uint64_t, WORDS> mask;
+};
+
+static_assert(std::is_trivially_copyable_v<DualsPattern<64, double>> && sizeof(DualsPattern<64, double>) == 2 * sizeof(uint64_t),
+              "DualsPattern must pack 64 inputs into one word next to its value");
+
+template<size_t VARIABLES, typename U>
+struct DualsScalar<DualsPattern<VARIABLES, U>>
+{
+    using type = U;
+};
+
+template<size_t VARIABLES, typename U>
+U primalValue(const DualsPattern<VARIABLES, U>& d)
+{
+    return d.getValue();
+}
+
+// Elementary functions keep the dependencies of their argument(s)
+template<size_t VARIABLES, typename U>
+DualsPattern<VARIABLES, U> sin(const DualsPattern<VARIABLES, U>& d) { return DualsPattern<VARIABLES, U>::passThrough(std::sin(d.getValue()), d); }
+
+template<size_t VARIABLES, typename U>
+DualsPattern<VARIABLES, U> cos(const DualsPattern<VARIABLES, U>& d) { return DualsPattern<VARIABLES, U>::passThrough(std::cos(d.getValue()), d); }
+
+template<size_t VARIABLES, typename U>
+DualsPattern<VARIABLES, U> tan(const DualsPattern<VARIABLES, U>& d) { return DualsPattern<VARIABLES, U>::passThrough(std::tan(d.getValue()), d); }
+
+template<size_t VARIABLES, typename U>
+DualsPattern<VARIABLES, U> arcsin(const DualsPattern<VARIABLES, U>& d) { return DualsPattern<VARIABLES, U>::passThrough(std::asin(d.getValue()), d); }
+
+template<size_t VARIABLES, typename U>
+DualsPattern<VARIABLES, U> arccos(const DualsPattern<VARIABLES, U>& d) { return DualsPattern<VARIABLES, U>::passThrough(std::acos(d.getValue()), d); }
+
+template<size_t VARIABLES, typename U>
+DualsPattern<VARIABLES, U> arctan(const DualsPattern<VARIABLES, U>& d) { return DualsPattern<VARIABLES, U>::passThrough(std::atan(d.getValue()), d); }
+
+template<size_t VARIABLES, typename U>
+DualsPattern<VARIABLES, U> pow(const DualsPattern<VARIABLES, U>& d, float p) { return DualsPattern<VARIABLES, U>::passThrough(std::pow(d.getValue(), U(p)), d); }
+
+template<size_t VARIABLES, typename U>
+DualsPattern<VARIABLES, U> exp(const DualsPattern<VARIABLES, U>& d) { return DualsPattern<VARIABLES, U>::passThrough(std::exp(d.getValue()), d); }
+
+template<size_t VARIABLES, typename U>
+DualsPattern<VARIABLES, U> log(const DualsPattern<VARIABLES, U>& d) { return DualsPattern<VARIABLES, U>::passThrough(std::log(d.getValue()), d); }
+
+template<size_t VARIABLES, typename U>
+DualsPattern<VARIABLES, U> abs(const DualsPattern<VARIABLES, U>& d) { return DualsPattern<VARIABLES, U>::passThrough(std::abs(d.getValue()), d); }
+
+template<size_t VARIABLES, typename U>
+DualsPattern<VARIABLES, U> sqrt(const DualsPattern<VARIABLES, U>& d) { return DualsPattern<VARIABLES, U>::passThrough(std::sqrt(d.getValue()), d); }
+
+template<size_t VARIABLES, typename U>
+DualsPattern<VARIABLES, U> sinh(const DualsPattern<VARIABLES, U>& d) { return DualsPattern<VARIABLES, U>::passThrough(std::sinh(d.getValue()), d); }
+
+template<size_t VARIABLES, typename U>
+DualsPattern<VARIABLES, U> cosh(const DualsPattern<VARIABLES, U>& d) { return DualsPattern<VARIABLES, U>::passThrough(std::cosh(d.getValue()), d); }
+
+template<size_t VARIABLES, typename U>
+DualsPattern<VARIABLES, U> tanh(const DualsPattern<VARIABLES, U>& d) { return DualsPattern<VARIABLES, U>::passThrough(std::tanh(d.getValue()), d); }
+
+template<size_t VARIABLES, typename U>
+DualsPattern<VARIABLES, U> log1p(const DualsPattern<VARIABLES, U>& d) { return DualsPattern<VARIABLES, U>::passThrough(std::log1p(d.getValue()), d); }
+
+template<size_t VARIABLES, typename U>
+DualsPattern<VARIABLES, U> expm1(const DualsPattern<VARIABLES, U>& d) { return DualsPattern<VARIABLES, U>::passThrough(std::expm1(d.getValue()), d); }
+
+template<size_t VARIABLES, typename U>
+DualsPattern<VARIABLES, U> cbrt(const DualsPattern<VARIABLES, U>& d) { return DualsPattern<VARIABLES, U>::passThrough(std::cbrt(d.getValue()), d); }
+
+template<size_t VARIABLES, typename U>
+DualsPattern<VARIABLES, U> erf(const DualsPattern<VARIABLES, U>& d) { return DualsPattern<VARIABLES, U>::passThrough(std::erf(d.getValue()), d); }
+
+template<size_t VARIABLES, typename U>
+DualsPattern<VARIABLES, U> atan2(const DualsPattern<VARIABLES, U>& y, const DualsPattern<VARIABLES, U>& x)
+{
+    return DualsPattern<VARIABLES, U>::combine(std::atan2(y.getValue(), x.getValue()), y, x);
+}
+
+template<size_t VARIABLES, typename U>
+DualsPattern<VARIABLES, U> hypot(const DualsPattern<VARIABLES, U>& x, const DualsPattern<VARIABLES, U>& y)
+{
+    return DualsPattern<VARIABLES, U>::combine(std::hypot(x.getValue(), y.getValue()), x, y);
+}
+
+template<size_t VARIABLES, typename U>
+DualsPattern<VARIABLES, U> pow(const DualsPattern<VARIABLES, U>& base, const DualsPattern<VARIABLES, U>& exponent)
+{
+    return DualsPattern<VARIABLES, U>::combine(std::pow(base.getValue(), exponent.getValue()), base, exponent);
+}
+
+template<size_t VARIABLES, typename U>
+DualsPattern<VARIABLES, U> fmod(const DualsPattern<VARIABLES, U>& a, const DualsPattern<VARIABLES, U>& b)
+{
+    return DualsPattern<VARIABLES, U>::combine(std::fmod(a.getValue(), b.getValue()), a, b);
+}
+
+// Either argument may be picked at another point, so both contribute their bits
+template<size_t VARIABLES, typename U>
+DualsPattern<VARIABLES, U> select(bool condition, const DualsPattern<VARIABLES, U>& a, const DualsPattern<VARIABLES, U>& b) noexcept
+{
+    return DualsPattern<VARIABLES, U>::combine(condition ? a.getValue() : b.getValue(), a, b);
+}
+
+template<size_t VARIABLES, typename U>
+DualsPattern<VARIABLES, U> min(const DualsPattern<VARIABLES, U>& a, const DualsPattern<VARIABLES, U>& b)
+{
+    return select(b.getValue() < a.getValue(), b, a);
+}
+
+template<size_t VARIABLES, typename U>
+DualsPattern<VARIABLES, U> max(const DualsPattern<VARIABLES, U>& a, const DualsPattern<VARIABLES, U>& b)
+{
+    return select(a.getValue() < b.getValue(), b, a);
+}
+
+#endif
@@ -0,0 +1,616 @@
+#ifndef EXPRESSION_H
+#define EXPRESSION_H
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "Duals.h"
+
+// Expression tracing for functions written generically over their scalar type.
+// Evaluating such a function once with Traced<T> records the expression DAG
+// in an ExpressionGraph instead of computing numbers:
+//
+//     ExpressionGraph<double> graph = traceFunction<3, double>(f);
+//     ExpressionProgram<double> program = graph.compile();
+//     program.evaluate(inputs, outputs, registers);   // inputs as T or Duals<N, T>
+//
+// While recording, identical subexpressions are shared (hash-consing, so
+// x * x written twice becomes one node), operations on constants are folded
+// under the same DualsDomain policy as Duals, and multiplications/divisions
+// by one are dropped. compile() removes nodes that no output depends on and
+// lays the rest out as a flat instruction list over a dense register file,
+// which evaluate() replays for any scalar type.
+// Control flow is not recorded: a traced function must not branch on values.
+
+enum class ExpressionOp : uint8_t
+{
+    Input,
+    Constant,
+    Add,
+    Subtract,
+    Multiply,
+    Divide,
+    Sin,
+    Cos,
+    Tan,
+    ArcSin,
+    ArcCos,
+    ArcTan,
+    Pow,      // exponent kept in the node's constant
+    Exp,
+    Log,
+    Abs,
+    Sqrt,
+    Negate
+};
+
+inline bool isBinary(ExpressionOp op)
+{
+    return op == ExpressionOp::Add || op == ExpressionOp::Subtract || op == ExpressionOp::Multiply || op == ExpressionOp::Divide;
+}
+
+template<typename T>
+struct ExpressionNode
+{
+    ExpressionOp op;
+    uint32_t left;   // first operand, or the input number for Input nodes
+    uint32_t right;  // second operand of binary operations
+    T constant;      // value of Constant nodes, exponent of Pow nodes
+};
+
+// Constants are told apart by their bit pattern, so -0.0 and 0.0 stay
+// distinct and a NaN constant still matches itself
+template<typename T>
+bool sameConstant(const T& a, const T& b)
+{
+    return std::memcmp(&a, &b, sizeof(T)) == 0;
+}
+
+template<typename T>
+size_t constantHash(const T& constant)
+{
+    unsigned char bytes[sizeof(T)];
+    std::memcpy(bytes, &constant, sizeof(T));
+    size_t hash = 0;
+    for (unsigned char byte : bytes)
+    {
+        hash = hash * 131 + byte;
+    }
+    return hash;
+}
+
+// Applies a single operation to values of type V (T or any Duals<N, T>)
+template<typename V, typename T>
+V applyExpressionOp(ExpressionOp op, const V& a, const V& b, const T& constant)
+{
+    if constexpr (std::is_arithmetic_v<V>)
+    {
+        switch (op)
+        {
+            case ExpressionOp::Add: return a + b;
+            case ExpressionOp::Subtract: return a - b;
+            case ExpressionOp::Multiply: return a * b;
+            case ExpressionOp::Divide: return a / b;
+            case ExpressionOp::Sin: return std::sin(a);
+            case ExpressionOp::Cos: return std::cos(a);
+            case ExpressionOp::Tan: return std::tan(a);
+            case ExpressionOp::ArcSin: return std::asin(a);
+            case ExpressionOp::ArcCos: return std::acos(a);
+            case ExpressionOp::ArcTan: return std::atan(a);
+            case ExpressionOp::Pow: return std::pow(a, static_cast<float>(constant));
+            case ExpressionOp::Exp: return std::exp(a);
+            case ExpressionOp::Log: return std::log(a);
+            case ExpressionOp::Abs: return std::abs(a);
+            case ExpressionOp::Sqrt: return std::sqrt(a);
+            case ExpressionOp::Negate: return -a;
+            default: break;
+        }
+    }
+    else
+    {
+        switch (op)
+        {
+            case ExpressionOp::Add: return a + b;
+            case ExpressionOp::Subtract: return a - b;
+            case ExpressionOp::Multiply: return a * b;
+            case ExpressionOp::Divide: return a / b;
+            case ExpressionOp::Sin: return sin(a);
+            case ExpressionOp::Cos: return cos(a);
+            case ExpressionOp::Tan: return tan(a);
+            case ExpressionOp::ArcSin: return arcsin(a);
+            case ExpressionOp::ArcCos: return arccos(a);
+            case ExpressionOp::ArcTan: return arctan(a);
+            case ExpressionOp::Pow: return pow(a, static_cast<float>(constant));
+            case ExpressionOp::Exp: return exp(a);
+            case ExpressionOp::Log: return log(a);
+            case ExpressionOp::Abs: return abs(a);
+            case ExpressionOp::Sqrt: return sqrt(a);
+            case ExpressionOp::Negate: return -a;
+            default: break;
+        }
+    }
+    throw std::logic_error("Expression operation has no value");
+}
+
+// Folds an operation on constants at trace time. It runs on a duals value so
+// the constant meets the same DualsDomain checks as the live function would:
+// under Throw, log of a non-positive constant throws instead of becoming NaN.
+template<typename T>
+T foldExpressionOp(ExpressionOp op, const T& a, const T& b, const T& constant)
+{
+    return applyExpressionOp(op, Duals<1, T>(a, T(0)), Duals<1, T>(b, T(0)), constant).getValue();
+}
+
+template<typename T>
+class ExpressionProgram;
+
+template<typename T>
+class Traced;
+
+template<typename T = double>
+class ExpressionGraph
+{
+    public:
+        // Adds a new independent input
+        Traced<T> input()
+        {
+            nodes.push_back({ExpressionOp::Input, static_cast<uint32_t>(inputs.size()), 0, T()});
+            inputs.push_back(static_cast<uint32_t>(nodes.size() - 1));
+            return Traced<T>(this, inputs.back());
+        }
+
+        // Marks a traced value as an output of the function
+        void output(const Traced<T>& value)
+        {
+            outputs.push_back(value.isConstant() ? constant(value.constantValue()) : value.nodeIndex());
+        }
+
+        // Records an operation, reusing an identical existing node and folding constants
+        uint32_t record(ExpressionOp op, uint32_t left, uint32_t right = 0, T constant = T())
+        {
+            const ExpressionNode<T>& a = nodes[left];
+            bool binary = isBinary(op);
+            if (!binary)
+            {
+                right = 0;
+            }
+
+            if (a.op == ExpressionOp::Constant && (!binary || nodes[right].op == ExpressionOp::Constant))
+            {
+                return this->constant(foldExpressionOp(op, a.constant, binary ? nodes[right].constant : T(), constant));
+            }
+            if (binary && nodes[right].op == ExpressionOp::Constant && nodes[right].constant == T(1)
+                && (op == ExpressionOp::Multiply || op == ExpressionOp::Divide))
+            {
+                return left;
+            }
+            if (op == ExpressionOp::Multiply && a.op == ExpressionOp::Constant && a.constant == T(1))
+            {
+                return right;
+            }
+
+            // Commutative operations share one canonical operand order
+            if ((op == ExpressionOp::Add || op == ExpressionOp::Multiply) && right < left)
+            {
+                std::swap(left, right);
+            }
+            return intern({op, left, right, constant});
+        }
+
+        // Records (or reuses) a constant node
+        uint32_t constant(T value)
+        {
+            return intern({ExpressionOp::Constant, 0, 0, value});
+        }
+
+        const std::vector<ExpressionNode<T>>& getNodes() const { return nodes; }
+
+        size_t inputCount() const { return inputs.size(); }
+
+        size_t outputCount() const { return outputs.size(); }
+
+        // Dead-code elimination and register layout
+        ExpressionProgram<T> compile() const;
+
+    private:
+        struct NodeHash
+        {
+            size_t operator()(const ExpressionNode<T>& node) const
+            {
+                size_t hash = constantHash(node.constant);
+                hash = hash * 31 + static_cast<size_t>(node.op);
+                hash = hash * 1000003 + node.left;
+                hash = hash * 1000003 + node.right;
+                return hash;
+            }
+        };
+
+        struct NodeEqual
+        {
+            bool operator()(const ExpressionNode<T>& a, const ExpressionNode<T>& b) const
+            {
+                return a.op == b.op && a.left == b.left && a.right == b.right
+                    && sameConstant(a.constant, b.constant);
+            }
+        };
+
+        uint32_t intern(const ExpressionNode<T>& node)
+        {
+            auto found = lookup.find(node);
+            if (found != lookup.end())
+            {
+                return found->second;
+            }
+            nodes.push_back(node);
+            uint32_t index = static_cast<uint32_t>(nodes.size() - 1);
+            lookup.emplace(node, index);
+            return index;
+        }
+
+        std::vector<ExpressionNode<T>> nodes;
+        std::vector<uint32_t> inputs;
+        std::vector<uint32_t> outputs;
+        std::unordered_map<ExpressionNode<T>, uint32_t, NodeHash, NodeEqual> lookup;
+};
+
+// Scalar used while tracing. It is either a node of a graph or a free
+// constant (e.g. T(2.0) in user code) that joins a graph when first combined
+// with a traced value.
+template<typename T = double>
+class Traced
+{
+    public:
+        Traced() : graph(nullptr), index(0), constant(T()) {}
+
+        Traced(T value) : graph(nullptr), index(0), constant(value) {}
+
+        Traced(ExpressionGraph<T>* owner, uint32_t node) : graph(owner), index(node), constant(T()) {}
+
+        bool isConstant() const { return graph == nullptr; }
+
+        T constantValue() const { return constant; }
+
+        uint32_t nodeIndex() const { return index; }
+
+        ExpressionGraph<T>* getGraph() const { return graph; }
+
+        // Node index of this value inside graph, recording it there if it is a free constant
+        uint32_t nodeIn(ExpressionGraph<T>& owner) const
+        {
+            return isConstant() ? owner.constant(constant) : index;
+        }
+
+    private:
+        ExpressionGraph<T>* graph;
+        uint32_t index;
+        T constant;
+};
+
+template<typename T>
+Traced<T> traceBinary(ExpressionOp op, const Traced<T>& lhs, const Traced<T>& rhs)
+{
+    if (lhs.isConstant() && rhs.isConstant())
+    {
+        return Traced<T>(foldExpressionOp(op, lhs.constantValue(), rhs.constantValue(), T()));
+    }
+    ExpressionGraph<T>& graph = *(lhs.isConstant() ? rhs.getGraph() : lhs.getGraph());
+    return Traced<T>(&graph, graph.record(op, lhs.nodeIn(graph), rhs.nodeIn(graph)));
+}
+
+template<typename T>
+Traced<T> traceUnary(ExpressionOp op, const Traced<T>& x, T constant = T())
+{
+    if (x.isConstant())
+    {
+        return Traced<T>(foldExpressionOp(op, x.constantValue(), T(), constant));
+    }
+    ExpressionGraph<T>& graph = *x.getGraph();
+    return Traced<T>(&graph, graph.record(op, x.nodeIndex(), 0, constant));
+}
+
+template<typename T>
+Traced<T> operator+(const Traced<T>& lhs, const Traced<T>& rhs) { return traceBinary(ExpressionOp::Add, lhs, rhs); }
+
+template<typename T>
+Traced<T> operator+(const Traced<T>& lhs, const T& rhs) { return traceBinary(ExpressionOp::Add, lhs, Traced<T>(rhs)); }
+
+template<typename T>
+Traced<T> operator+(const T& lhs, const Traced<T>& rhs) { return traceBinary(ExpressionOp::Add, Traced<T>(lhs), rhs); }
+
+// Any arithmetic scalar, e.g. an int literal; the exact T overloads above are preferred
+template<typename T, typename S, typename = std::enable_if_t<std::is_arithmetic_v<S>>>
+Traced<T> operator+(const Traced<T>& lhs, S rhs) { return traceBinary(ExpressionOp::Add, lhs, Traced<T>(T(rhs))); }
+
+template<typename T, typename S, typename = std::enable_if_t<std::is_arithmetic_v<S>>>
+Traced<T> operator+(S lhs, const Traced<T>& rhs) { return traceBinary(ExpressionOp::Add, Traced<T>(T(lhs)), rhs); }
+
+template<typename T>
+Traced<T> operator-(const Traced<T>& x) { return traceUnary(ExpressionOp::Negate, x); }
+
+template<typename T>
+Traced<T> operator-(const Traced<T>& lhs, const Traced<T>& rhs) { return traceBinary(ExpressionOp::Subtract, lhs, rhs); }
+
+template<typename T>
+Traced<T> operator-(const Traced<T>& lhs, const T& rhs) { return traceBinary(ExpressionOp::Subtract, lhs, Traced<T>(rhs)); }
+
+template<typename T>
+Traced<T> operator-(const T& lhs, const Traced<T>& rhs) { return traceBinary(ExpressionOp::Subtract, Traced<T>(lhs), rhs); }
+
+// Any arithmetic scalar, e.g. an int literal; the exact T overloads above are preferred
+template<typename T, typename S, typename = std::enable_if_t<std::is_arithmetic_v<S>>>
+Traced<T> operator-(const Traced<T>& lhs, S rhs) { return traceBinary(ExpressionOp::Subtract, lhs, Traced<T>(T(rhs))); }
+
+template<typename T, typename S, typename = std::enable_if_t<std::is_arithmetic_v<S>>>
+Traced<T> operator-(S lhs, const Traced<T>& rhs) { return traceBinary(ExpressionOp::Subtract, Traced<T>(T(lhs)), rhs); }
+
+template<typename T>
+Traced<T> operator*(const Traced<T>& lhs, const Traced<T>& rhs) { return traceBinary(ExpressionOp::Multiply, lhs, rhs); }
+
+template<typename T>
+Traced<T> operator*(const Traced<T>& lhs, const T& rhs) { return traceBinary(ExpressionOp::Multiply, lhs, Traced<T>(rhs)); }
+
+template<typename T>
+Traced<T> operator*(const T& lhs, const Traced<T>& rhs) { return traceBinary(ExpressionOp::Multiply, Traced<T>(lhs), rhs); }
+
+// Any arithmetic scalar, e.g. an int literal; the exact T overloads above are preferred
+template<typename T, typename S, typename = std::enable_if_t<std::is_arithmetic_v<S>>>
+Traced<T> operator*(const Traced<T>& lhs, S rhs) { return traceBinary(ExpressionOp::Multiply, lhs, Traced<T>(T(rhs))); }
+
+template<typename T, typename S, typename = std::enable_if_t<std::is_arithmetic_v<S>>>
+Traced<T> operator*(S lhs, const Traced<T>& rhs) { return traceBinary(ExpressionOp::Multiply, Traced<T>(T(lhs)), rhs); }
+
+template<typename T>
+Traced<T> operator/(const Traced<T>& lhs, const Traced<T>& rhs) { return traceBinary(ExpressionOp::Divide, lhs, rhs); }
+
+template<typename T>
+Traced<T> operator/(const Traced<T>& lhs, const T& rhs) { return traceBinary(ExpressionOp::Divide, lhs, Traced<T>(rhs)); }
+
+template<typename T>
+Traced<T> operator/(const T& lhs, const Traced<T>& rhs) { return traceBinary(ExpressionOp::Divide, Traced<T>(lhs), rhs); }
+
+// Any arithmetic scalar, e.g. an int literal; the exact T overloads above are preferred
+template<typename T, typename S, typename = std::enable_if_t<std::is_arithmetic_v<S>>>
+Traced<T> operator/(const Traced<T>& lhs, S rhs) { return traceBinary(ExpressionOp::Divide, lhs, Traced<T>(T(rhs))); }
+
+template<typename T, typename S, typename = std::enable_if_t<std::is_arithmetic_v<S>>>
+Traced<T> operator/(S lhs, const Traced<T>& rhs) { return traceBinary(ExpressionOp::Divide, Traced<T>(T(lhs)), rhs); }
+
+template<typename T>
+Traced<T> sin(const Traced<T>& x) { return traceUnary(ExpressionOp::Sin, x); }
+
+template<typename T>
+Traced<T> cos(const Traced<T>& x) { return traceUnary(ExpressionOp::Cos, x); }
+
+template<typename T>
+Traced<T> tan(const Traced<T>& x) { return traceUnary(ExpressionOp::Tan, x); }
+
+template<typename T>
+Traced<T> arcsin(const Traced<T>& x) { return traceUnary(ExpressionOp::ArcSin, x); }
+
+template<typename T>
+Traced<T> arccos(const Traced<T>& x) { return traceUnary(ExpressionOp::ArcCos, x); }
+
+template<typename T>
+Traced<T> arctan(const Traced<T>& x) { return traceUnary(ExpressionOp::ArcTan, x); }
+
+template<typename T>
+Traced<T> pow(const Traced<T>& x, float p) { return traceUnary(ExpressionOp::Pow, x, T(p)); }
+
+template<typename T>
+Traced<T> exp(const Traced<T>& x) { return traceUnary(ExpressionOp::Exp, x); }
+
+template<typename T>
+Traced<T> log(const Traced<T>& x) { return traceUnary(ExpressionOp::Log, x); }
+
+template<typename T>
+Traced<T> abs(const Traced<T>& x) { return traceUnary(ExpressionOp::Abs, x); }
+
+template<typename T>
+Traced<T> sqrt(const Traced<T>& x) { return traceUnary(ExpressionOp::Sqrt, x); }
+
+// One step of a compiled program: registers[target] = op(registers[left], registers[right])
+template<typename T>
+struct ExpressionInstruction
+{
+    ExpressionOp op;
+    uint32_t target;
+    uint32_t left;
+    uint32_t right;
+    T constant;
+};
+
+template<typename T = double>
+class ExpressionProgram
+{
+    public:
+        ExpressionProgram(std::vector<ExpressionInstruction<T>> code, size_t numRegisters, size_t numInputs,
+                          std::vector<uint32_t> outputRegisters)
+            : instructions(std::move(code)), registerCount(numRegisters), numberOfInputs(numInputs),
+              outputs(std::move(outputRegisters)) {}
+
+        // Replays the program. inputs and outputs are indexed like the traced
+        // function's inputs and outputs; registers is scratch space that is
+        // resized once and can be reused across calls to avoid allocation.
+        template<typename V>
+        void evaluate(const V* inputs, V* results, std::vector<V>& registers) const
+        {
+            if (registers.size() < registerCount)
+            {
+                registers.resize(registerCount);
+            }
+            for (const ExpressionInstruction<T>& instruction : instructions)
+            {
+                switch (instruction.op)
+                {
+                    case ExpressionOp::Input:
+                        registers[instruction.target] = inputs[instruction.left];
+                        break;
+                    case ExpressionOp::Constant:
+                        registers[instruction.target] = V(instruction.constant);
+                        break;
+                    default:
+                        registers[instruction.target] = applyExpressionOp(instruction.op, registers[instruction.left],
+                                                                          registers[instruction.right], instruction.constant);
+                        break;
+                }
+            }
+            for (size_t k = 0; k < outputs.size(); ++k)
+            {
+                results[k] = registers[outputs[k]];
+            }
+        }
+
+        template<typename V, size_t INPUTS, size_t OUTPUTS>
+        void evaluate(const std::array<V, INPUTS>& inputs, std::array<V, OUTPUTS>& results, std::vector<V>& registers) const
+        {
+            if (INPUTS != numberOfInputs || OUTPUTS != outputs.size())
+            {
+                throw std::invalid_argument("Input or output count does not match the traced function");
+            }
+            evaluate(inputs.data(), results.data(), registers);
+        }
+
+        const std::vector<ExpressionInstruction<T>>& getInstructions() const { return instructions; }
+
+        const std::vector<uint32_t>& getOutputs() const { return outputs; }
+
+        size_t getRegisterCount() const { return registerCount; }
+
+        size_t inputCount() const { return numberOfInputs; }
+
+        size_t outputCount() const { return outputs.size(); }
+
+        // Hash of the code, so programs traced from the same function match
+        size_t hash() const
+        {
+            size_t result = std::hash<size_t>()(numberOfInputs);
+            for (const ExpressionInstruction<T>& instruction : instructions)
+            {
+                result = result * 1000003 + constantHash(instruction.constant);
+                result = result * 31 + static_cast<size_t>(instruction.op);
+                result = result * 1000003 + instruction.left;
+                result = result * 1000003 + instruction.right;
+            }
+            for (uint32_t output : outputs)
+            {
+                result = result * 1000003 + output;
+            }
+            return result;
+        }
+
+        bool operator==(const ExpressionProgram& other) const
+        {
+            if (numberOfInputs != other.numberOfInputs || outputs != other.outputs
+                || instructions.size() != other.instructions.size())
+            {
+                return false;
+            }
+            for (size_t i = 0; i < instructions.size(); ++i)
+            {
+                const ExpressionInstruction<T>& a = instructions[i];
+                const ExpressionInstruction<T>& b = other.instructions[i];
+                if (a.op != b.op || a.target != b.target || a.left != b.left || a.right != b.right
+                    || !sameConstant(a.constant, b.constant))
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+    private:
+        std::vector<ExpressionInstruction<T>> instructions;
+        size_t registerCount;
+        size_t numberOfInputs;
+        std::vector<uint32_t> outputs;
+};
+
+template<typename T>
+ExpressionProgram<T> ExpressionGraph<T>::compile() const
+{
+    // Nodes are recorded in dependency order, so one backward sweep finds everything the outputs need
+    std::vector<bool> live(nodes.size(), false);
+    for (uint32_t output : outputs)
+    {
+        live[output] = true;
+    }
+    for (size_t i = nodes.size(); i-- > 0;)
+    {
+        if (!live[i] || nodes[i].op == ExpressionOp::Input || nodes[i].op == ExpressionOp::Constant)
+        {
+            continue;
+        }
+        live[nodes[i].left] = true;
+        if (isBinary(nodes[i].op))
+        {
+            live[nodes[i].right] = true;
+        }
+    }
+
+    std::vector<uint32_t> registerOf(nodes.size(), 0);
+    std::vector<ExpressionInstruction<T>> code;
+    uint32_t next = 0;
+    for (size_t i = 0; i < nodes.size(); ++i)
+    {
+        if (!live[i])
+        {
+            continue;
+        }
+        const ExpressionNode<T>& node = nodes[i];
+        registerOf[i] = next;
+        ExpressionInstruction<T> instruction = {node.op, next, 0, 0, node.constant};
+        if (node.op == ExpressionOp::Input)
+        {
+            instruction.left = node.left;
+        }
+        else if (node.op != ExpressionOp::Constant)
+        {
+            instruction.left = registerOf[node.left];
+            instruction.right = isBinary(node.op) ? registerOf[node.right] : 0;
+        }
+        code.push_back(instruction);
+        ++next;
+    }
+
+    std::vector<uint32_t> outputRegisters;
+    for (uint32_t output : outputs)
+    {
+        outputRegisters.push_back(registerOf[output]);
+    }
+    return ExpressionProgram<T>(std::move(code), next, inputs.size(), std::move(outputRegisters));
+}
+
+// Traces a function of INPUTS scalars written generically over its scalar
+// type. The function may return one value or a std::array of values.
+template<size_t INPUTS, typename T, typename Function>
+ExpressionGraph<T> traceFunction(const Function& f)
+{
+    ExpressionGraph<T> graph;
+    std::array<Traced<T>, INPUTS> inputs;
+    for (size_t i = 0; i < INPUTS; ++i)
+    {
+        inputs[i] = graph.input();
+    }
+
+    auto result = f(inputs);
+    if constexpr (std::is_same_v<decltype(result), Traced<T>>)
+    {
+        graph.output(result);
+    }
+    else
+    {
+        for (const Traced<T>& value : result)
+        {
+            graph.output(value);
+        }
+    }
+    return graph;
+}
+
+#endif
@@ -0,0 +1,42 @@
+#include <fstream>
+#include <iostream>
+#include "CodeGen.h"
+#include "KernelModels.h"
+
+using namespace std;
+
+// Traces the functions in KernelModels.h and writes their value and gradient
+// kernels as one header: GenerateKernels <output file>
+int main(int argc, char* argv[])
+{
+    if (argc != 2)
+    {
+        cerr << "usage: " << argv[0] << " <output header>\n";
+        return 1;
+    }
+
+    ofstream out(argv[1]);
+    if (!out)
+    {
+        cerr << "cannot write " << argv[1] << "\n";
+        return 1;
+    }
+
+    out << "// Generated by GenerateKernels from KernelModels.h; do not edit.\n"
+        << "#ifndef GENERATED_KERNELS_H\n"
+        << "#define GENERATED_KERNELS_H\n\n"
+        << "#include <cmath>\n"
+        << "#include <limits>\n"
+        << "#include <stdexcept>\n\n";
+    emitGradientKernel<3, double>(out, "separableSumKernel", SeparableSum());
+    out << "\n";
+    emitGradientKernel<3, double>(out, "coupledTermsKernel", CoupledTerms());
+    out << "\n";
+    emitGradientKernel<2, double>(out, "mixedFunctionsKernel", MixedFunctions());
+    out << "\n";
+    emitGradientKernel<2, double>(out, "negatedTermsKernel", NegatedTerms());
+    out << "\n";
+    emitGradientKernel<2, double>(out, "limitTermsKernel", LimitTerms());
+    out << "\n#endif\n";
+    return out ? 0 : 1;
+}
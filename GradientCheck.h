@@ -0,0 +1,329 @@
+#ifndef GRADIENT_CHECK_H
+#define GRADIENT_CHECK_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "Derivatives.h"
+#include "Parallel.h"
+
+// Randomized gradient checking: compares the Duals gradient of a function
+// with Richardson-extrapolated central differences at many seeded random
+// points and reports the largest and mean relative error:
+//
+//     GradientCheckResult r = checkGradient<3, double>("model", Model(), -2.0, 2.0);
+//     printGradientChecks(cout, checkDualsFunctions<4, float>());
+//
+// Points are drawn uniformly from [lower, upper]^N with a generator seeded
+// from options.seed and the sample number, so every run and every thread
+// count checks the same points and reports the same numbers. The finite
+// differences are taken in double at the point rounded to T. The error of a
+// sample is the largest over the inputs of |dual - numeric| / max(|numeric|,
+// options.floor). Samples where either side is not finite, or where the
+// Duals evaluation throws a domain error, are skipped and counted.
+// checkDualsFunctions runs the check over every operator and elementary
+// function of Duals.h, select, the padded DualsAligned lanes and second
+// derivatives through nested duals, so kernel rewrites can be validated for
+// any N and T in one call.
+
+struct GradientCheckOptions
+{
+    uint64_t seed = 0x5eed;
+    size_t samples = 1000;
+    size_t numThreads = hardwareThreads();
+    double step = 1e-2;             // first difference step, times max(1, |x_i|)
+    size_t extrapolations = 4;      // differences at step, step / 2, ..., combined by Richardson
+    double floor = 1.0;             // smallest denominator of the relative error
+};
+
+struct GradientCheckResult
+{
+    std::string name;
+    size_t samples = 0;             // points compared
+    size_t skipped = 0;             // points outside the domain: non-finite or throwing
+    double maxRelativeError = 0.0;
+    double meanRelativeError = 0.0;
+    std::vector<double> worstPoint; // where the largest error occurred
+};
+
+// Uniform double in [0, 1) from splitmix64, the same on every platform
+inline double gradientCheckUniform(uint64_t& state)
+{
+    uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    z ^= z >> 31;
+    return double(z >> 11) * 0x1.0p-53;
+}
+
+// d f / d x_i by central differences at step, step / 2, ... extrapolated
+// with Richardson's scheme, each level removing the next even power of the step
+template<size_t N, typename Function>
+double richardsonDerivative(const Function& f, const Vector<N, double>& x, size_t i, double step, size_t levels)
+{
+    constexpr size_t MAX_LEVELS = 8;
+    levels = std::clamp<size_t>(levels, 1, MAX_LEVELS);
+    double table[MAX_LEVELS][MAX_LEVELS];
+    double h = step * std::max(1.0, std::abs(x[i]));
+    for (size_t level = 0; level < levels; ++level, h *= 0.5)
+    {
+        Vector<N, double> forward = x;
+        Vector<N, double> backward = x;
+        forward[i] += h;
+        backward[i] -= h;
+        table[level][0] = (double(f(forward)) - double(f(backward))) / (forward[i] - backward[i]);
+        double power = 1.0;
+        for (size_t j = 1; j <= level; ++j)
+        {
+            power *= 4.0;
+            table[level][j] = table[level][j - 1] + (table[level][j - 1] - table[level - 1][j - 1]) / (power - 1.0);
+        }
+    }
+    return table[levels - 1][levels - 1];
+}
+
+// Checks the Duals<N, T> gradient of f over options.samples points of [lower, upper]^N
+template<size_t N, typename T, typename Function>
+GradientCheckResult checkGradient(const std::string& name, const Function& f, double lower, double upper,
+                                  const GradientCheckOptions& options = {})
+{
+    struct Partial
+    {
+        size_t samples = 0;
+        size_t skipped = 0;
+        double maxError = -1.0;
+        double sumError = 0.0;
+        Vector<N, double> worst = {};
+    };
+
+    // Fixed blocks combined in block order keep the mean reproducible for any numThreads
+    const size_t blockSize = 64;
+    std::vector<Partial> partials(blockCount(options.samples, blockSize));
+    parallelBlocks(options.samples, blockSize, options.numThreads, [&](size_t begin, size_t end, size_t block)
+    {
+        Partial& partial = partials[block];
+        for (size_t k = begin; k < end; ++k)
+        {
+            uint64_t state = options.seed ^ (0xd1b54a32d192ed03ULL * (k + 1));
+            Vector<N, T> x;
+            Vector<N, double> point;
+            for (size_t i = 0; i < N; ++i)
+            {
+                x[i] = T(lower + (upper - lower) * gradientCheckUniform(state));
+                point[i] = double(x[i]);
+            }
+
+            // Domain errors under DualsDomain::Throw count as skipped, like NaNs under the other policies
+            Vector<N, T> gradient;
+            T value;
+            try
+            {
+                value = valueAndGradient(f, x, gradient);
+            }
+            catch (const std::runtime_error&)
+            {
+                ++partial.skipped;
+                continue;
+            }
+            bool finite = std::isfinite(double(value));
+            double error = 0.0;
+            for (size_t i = 0; i < N && finite; ++i)
+            {
+                double numeric = richardsonDerivative(f, point, i, options.step, options.extrapolations);
+                finite = std::isfinite(numeric) && std::isfinite(double(gradient[i]));
+                error = std::max(error, std::abs(double(gradient[i]) - numeric) / std::max(std::abs(numeric), options.floor));
+            }
+            if (!finite)
+            {
+                ++partial.skipped;
+                continue;
+            }
+            ++partial.samples;
+            partial.sumError += error;
+            if (error > partial.maxError)
+            {
+                partial.maxError = error;
+                partial.worst = point;
+            }
+        }
+    });
+
+    GradientCheckResult result;
+    result.name = name;
+    double maxError = -1.0;
+    double sumError = 0.0;
+    for (const Partial& partial : partials)
+    {
+        result.samples += partial.samples;
+        result.skipped += partial.skipped;
+        sumError += partial.sumError;
+        if (partial.maxError > maxError)
+        {
+            maxError = partial.maxError;
+            result.worstPoint.assign(partial.worst.begin(), partial.worst.end());
+        }
+    }
+    result.maxRelativeError = std::max(maxError, 0.0);
+    result.meanRelativeError = result.samples == 0 ? 0.0 : sumError / double(result.samples);
+    return result;
+}
+
+// Convex combination of the inputs with weights rotated by offset, so that
+// every input reaches each operand and the operand stays in the sampled box
+template<size_t N, typename S>
+S gradientCheckMix(const std::array<S, N>& x, size_t offset)
+{
+    double total = double(N * (N + 1)) / 2.0;
+    S sum = S(0.0);
+    for (size_t i = 0; i < N; ++i)
+    {
+        sum = sum + x[i] * S(double(1 + (i + offset) % N) / total);
+    }
+    return sum;
+}
+
+// The same duals with their lanes in another Storage; plain scalars, as
+// seen by the finite differences, pass through
+template<typename Storage, typename S>
+S gradientCheckStorage(const S& x)
+{
+    return x;
+}
+
+template<typename Storage, size_t N, typename T, typename From>
+Duals<N, T, Storage> gradientCheckStorage(const Duals<N, T, From>& x)
+{
+    return Duals<N, T, Storage>(x.getValue(), x.getAllDerivatives());
+}
+
+// Every operator and elementary function of Duals<N, T>, each on a domain
+// where it is smooth; kinked functions (abs, min, max, fmod) are sampled on
+// one side of their kinks, since differences across a kink are meaningless
+template<size_t N, typename T>
+std::vector<GradientCheckResult> checkDualsFunctions(const GradientCheckOptions& options = {})
+{
+    using std::abs;
+    using std::atan2;
+    using std::cbrt;
+    using std::cos;
+    using std::cosh;
+    using std::erf;
+    using std::exp;
+    using std::expm1;
+    using std::fmod;
+    using std::hypot;
+    using std::log;
+    using std::log1p;
+    using std::max;
+    using std::min;
+    using std::pow;
+    using std::sin;
+    using std::sinh;
+    using std::sqrt;
+    using std::tan;
+    using std::tanh;
+
+    std::vector<GradientCheckResult> results;
+    auto check = [&](const std::string& name, double lower, double upper, const auto& f)
+    {
+        results.push_back(checkGradient<N, T>(name, f, lower, upper, options));
+    };
+    auto a = [](const auto& x) { return gradientCheckMix(x, 0); };
+    auto b = [](const auto& x) { return gradientCheckMix(x, 1); };
+
+    check("a + b", -3.0, 3.0, [&](const auto& x) { return a(x) + b(x); });
+    check("a - b", -3.0, 3.0, [&](const auto& x) { return a(x) - b(x); });
+    check("a * b", -3.0, 3.0, [&](const auto& x) { return a(x) * b(x); });
+    check("a / b", 0.5, 3.0, [&](const auto& x) { return a(x) / b(x); });
+    check("-a", -3.0, 3.0, [&](const auto& x) { return -a(x); });
+    check("a + s, s - a", -3.0, 3.0, [&](const auto& x) { return (a(x) + 1.5) * (2.5 - b(x)); });
+    check("a * s, s * a", -3.0, 3.0, [&](const auto& x) { return a(x) * 1.5 + 2.5 * b(x); });
+    check("a / s, s / a", 0.5, 3.0, [&](const auto& x) { return a(x) / 1.5 + 2.5 / b(x); });
+    check("sin", -3.0, 3.0, [&](const auto& x) { return sin(a(x)); });
+    check("cos", -3.0, 3.0, [&](const auto& x) { return cos(a(x)); });
+    check("tan", -1.2, 1.2, [&](const auto& x) { return tan(a(x)); });
+    check("arcsin", -0.9, 0.9, [&](const auto& x)
+    {
+        if constexpr (std::is_arithmetic_v<std::decay_t<decltype(a(x))>>) return std::asin(a(x)); else return arcsin(a(x));
+    });
+    check("arccos", -0.9, 0.9, [&](const auto& x)
+    {
+        if constexpr (std::is_arithmetic_v<std::decay_t<decltype(a(x))>>) return std::acos(a(x)); else return arccos(a(x));
+    });
+    check("arctan", -3.0, 3.0, [&](const auto& x)
+    {
+        if constexpr (std::is_arithmetic_v<std::decay_t<decltype(a(x))>>) return std::atan(a(x)); else return arctan(a(x));
+    });
+    check("pow(a, p)", 0.2, 3.0, [&](const auto& x) { return pow(a(x), 1.7f); });
+    check("exp", -3.0, 3.0, [&](const auto& x) { return exp(a(x)); });
+    check("log", 0.1, 5.0, [&](const auto& x) { return log(a(x)); });
+    check("abs (negative)", -3.0, -0.1, [&](const auto& x) { return abs(a(x)); });
+    check("abs (positive)", 0.1, 3.0, [&](const auto& x) { return abs(a(x)); });
+    check("sqrt", 0.1, 5.0, [&](const auto& x) { return sqrt(a(x)); });
+    check("sinh", -3.0, 3.0, [&](const auto& x) { return sinh(a(x)); });
+    check("cosh", -3.0, 3.0, [&](const auto& x) { return cosh(a(x)); });
+    check("tanh", -3.0, 3.0, [&](const auto& x) { return tanh(a(x)); });
+    check("log1p", -0.9, 3.0, [&](const auto& x) { return log1p(a(x)); });
+    check("expm1", -3.0, 3.0, [&](const auto& x) { return expm1(a(x)); });
+    check("cbrt", 0.1, 3.0, [&](const auto& x) { return cbrt(a(x)); });
+    check("erf", -3.0, 3.0, [&](const auto& x) { return erf(a(x)); });
+    check("atan2", 0.2, 3.0, [&](const auto& x) { return atan2(a(x), b(x)); });
+    check("hypot", 0.2, 3.0, [&](const auto& x) { return hypot(a(x), b(x)); });
+    check("pow(a, b)", 0.2, 3.0, [&](const auto& x) { return pow(a(x), b(x)); });
+    check("pow(-a, const)", 0.2, 3.0, [&](const auto& x)
+    {
+        using S = std::decay_t<decltype(a(x))>;
+        return pow(-a(x), S(3.0));
+    });
+    check("min", -3.0, 3.0, [&](const auto& x) { return min(a(x), b(x) + 7.0); });
+    check("max", -3.0, 3.0, [&](const auto& x) { return max(a(x), b(x) + 7.0); });
+    check("fmod", 1.0, 1.1, [&](const auto& x) { return fmod(3.5 * a(x), b(x)); });
+    check("select (taken)", -3.0, -0.1, [&](const auto& x)
+    {
+        return select(primalValue(a(x)) < 0.0, sin(a(x)) * b(x), exp(a(x)) - b(x));
+    });
+    check("select (other)", 0.1, 3.0, [&](const auto& x)
+    {
+        return select(primalValue(a(x)) < 0.0, sin(a(x)) * b(x), exp(a(x)) - b(x));
+    });
+    // Lanes padded to a multiple of 4 behind a 32 byte alignment, converted back for the comparison
+    check("aligned storage", 0.2, 3.0, [&](const auto& x)
+    {
+        auto u = gradientCheckStorage<DualsAligned<32, 4>>(a(x));
+        auto v = gradientCheckStorage<DualsAligned<32, 4>>(b(x));
+        return gradientCheckStorage<DualsPacked>(sin(u * v) / v + exp(u) * sqrt(v) + pow(u, v) + u / 1.5 - 2.5 / v);
+    });
+    // d/dt [sin(t) exp(t b)] at t = a, so the gradient checked is of a first derivative
+    check("nested duals", -2.0, 2.0, [&](const auto& x)
+    {
+        using S = std::decay_t<decltype(a(x))>;
+        Duals<1, S> t(a(x), S(1.0));
+        return (sin(t) * exp(t * b(x))).getDerivative();
+    });
+    check("composite", 0.2, 2.0, [&](const auto& x)
+    {
+        return sin(a(x) * b(x)) / (1.0 + exp(-a(x))) + sqrt(b(x)) * log(1.0 + a(x) * a(x));
+    });
+    return results;
+}
+
+// One line per function: samples, skipped, max and mean relative error
+inline void printGradientChecks(std::ostream& outs, const std::vector<GradientCheckResult>& results)
+{
+    outs << "  " << std::left << std::setw(16) << "function" << std::right << std::setw(9) << "samples" << std::setw(9)
+         << "skipped" << std::setw(13) << "max rel" << std::setw(13) << "mean rel" << "\n";
+    for (const GradientCheckResult& result : results)
+    {
+        outs << "  " << std::left << std::setw(16) << result.name << std::right << std::setw(9) << result.samples
+             << std::setw(9) << result.skipped << std::scientific << std::setprecision(3) << std::setw(13)
+             << result.maxRelativeError << std::setw(13) << result.meanRelativeError << std::defaultfloat << "\n";
+    }
+}
+
+#endif
@@ -0,0 +1,546 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+#include "Expression.h"
+
+#if defined(__x86_64__) && defined(__linux__)
+#define DUALS_JIT_NATIVE 1
+#include <sys/mman.h>
+#include <unistd.h>
+#else
+#define DUALS_JIT_NATIVE 0
+#endif
+
+// In-process compiler from a compiled expression program (see Expression.h)
+// to x86-64 machine code evaluating the value and all N derivative lanes of
+// every output, for models that are only known at run time:
+//
+//     std::shared_ptr<const JitProgram<3>> native = jitCompile<3>(program);
+//     native->evaluate(inputs, outputs, scratch);   // inputs as Duals<3, double>
+//
+// Each register is a block of value and lanes padded to an even number of
+// doubles, and every operation runs over the block two lanes at a time with
+// SSE2. Transcendental functions call back into small helpers that return
+// the value and the chain-rule factor. Compiled programs are cached by the
+// program's hash, so loading the same model again returns the same code.
+//
+// Only double is supported. On other targets, or if executable memory cannot
+// be mapped, JitProgram falls back to replaying the program with Duals. The
+// generated code does not update the DUALS_INSTRUMENT counters.
+
+constexpr bool jitNative() { return DUALS_JIT_NATIVE != 0; }
+
+// Value and derivative factor of the elementary functions, called from the
+// generated code as helper(a, constant, out) with out[0] = f(a), out[1] = f'(a)
+struct JitHelpers
+{
+    using Function = void (*)(double, double, double*);
+
+    // Set by a helper when Duals would have thrown; checked after each call
+    static const char*& domainError()
+    {
+        thread_local const char* message = nullptr;
+        return message;
+    }
+
+    static void sin(double a, double, double* out) { out[0] = std::sin(a); out[1] = std::cos(a); }
+    static void cos(double a, double, double* out) { out[0] = std::cos(a); out[1] = -std::sin(a); }
+    static void tan(double a, double, double* out) { out[0] = std::tan(a); out[1] = 1.0 / (std::cos(a) * std::cos(a)); }
+    static void arcsin(double a, double, double* out) { out[0] = std::asin(a); out[1] = 1.0 / std::sqrt(1.0 - a * a); }
+    static void arccos(double a, double, double* out) { out[0] = std::acos(a); out[1] = -1.0 / std::sqrt(1.0 - a * a); }
+    static void arctan(double a, double, double* out) { out[0] = std::atan(a); out[1] = 1.0 / (1.0 + a * a); }
+    static void exp(double a, double, double* out) { out[0] = std::exp(a); out[1] = out[0]; }
+    static void negate(double a, double, double* out) { out[0] = -a; out[1] = -1.0; }
+
+    static void pow(double a, double p, double* out)
+    {
+        float exponent = static_cast<float>(p);
+        out[0] = std::pow(a, exponent);
+        out[1] = double(exponent) * std::pow(a, exponent - 1.0f);
+    }
+
+    // The domain-checked functions follow the compiled-in DualsDomain policy
+    // like Duals does; under Throw the error is reported through domainError
+    static void log(double a, double, double* out)
+    {
+        if (dualsDomain == DualsDomain::Throw && a <= 0.0)
+        {
+            domainError() = "Log is undefined for values 0 or less";
+        }
+        out[0] = std::log(a);
+        out[1] = 1.0 / (a > 0.0 ? a : 1.0);
+        if (dualsDomain == DualsDomain::NaN)
+        {
+            out[0] += dualsDomainPoison<double>(a > 0.0);
+            out[1] += dualsDomainPoison<double>(a > 0.0);
+        }
+        else if (dualsDomain == DualsDomain::Subgradient)
+        {
+            out[1] = a > 0.0 ? out[1] : 0.0;
+        }
+    }
+
+    static void abs(double a, double, double* out)
+    {
+        if (dualsDomain == DualsDomain::Throw && a == 0.0)
+        {
+            domainError() = "Derivative for the absolute value function doesn't exist at 0.";
+        }
+        out[0] = std::abs(a);
+        out[1] = double(int(a > 0.0) - int(a < 0.0));
+        if (dualsDomain == DualsDomain::NaN)
+        {
+            out[1] += dualsDomainPoison<double>(a > 0.0 || a < 0.0);
+        }
+    }
+
+    static void sqrt(double a, double, double* out)
+    {
+        out[0] = std::sqrt(a);
+        out[1] = 0.5 / out[0];
+        if (dualsSqrtDomain == DualsDomain::Subgradient)
+        {
+            out[1] = a > 0.0 ? out[1] : 0.0;
+        }
+    }
+
+    static Function lookup(ExpressionOp op)
+    {
+        switch (op)
+        {
+            case ExpressionOp::Sin: return &JitHelpers::sin;
+            case ExpressionOp::Cos: return &JitHelpers::cos;
+            case ExpressionOp::Tan: return &JitHelpers::tan;
+            case ExpressionOp::ArcSin: return &JitHelpers::arcsin;
+            case ExpressionOp::ArcCos: return &JitHelpers::arccos;
+            case ExpressionOp::ArcTan: return &JitHelpers::arctan;
+            case ExpressionOp::Pow: return &JitHelpers::pow;
+            case ExpressionOp::Exp: return &JitHelpers::exp;
+            case ExpressionOp::Log: return &JitHelpers::log;
+            case ExpressionOp::Abs: return &JitHelpers::abs;
+            case ExpressionOp::Sqrt: return &JitHelpers::sqrt;
+            case ExpressionOp::Negate: return &JitHelpers::negate;
+            default: return nullptr;
+        }
+    }
+};
+
+// Minimal encoder for the handful of x86-64 instructions the JIT emits.
+// Memory operands are always [base + disp32]; only xmm0-xmm7 are used.
+class JitAssembler
+{
+    public:
+        enum Register : uint8_t { RAX = 0, RDX = 2, RBX = 3, RSI = 6, RDI = 7, R12 = 12, R13 = 13 };
+        enum Prefix : uint8_t { Packed = 0x66, Scalar = 0xF2 };
+        enum Opcode : uint8_t { Load = 0x10, Store = 0x11, Unpack = 0x14, Move = 0x28, Add = 0x58, Multiply = 0x59,
+                                Subtract = 0x5C, Divide = 0x5E, Xor = 0x57 };
+
+        // op xmm, [base + disp] (or the store form [base + disp], xmm)
+        void memory(Prefix prefix, Opcode opcode, int xmm, Register base, int32_t disp)
+        {
+            bytes({prefix});
+            if (base >= 8)
+            {
+                bytes({0x41});
+            }
+            bytes({0x0F, opcode, static_cast<uint8_t>(0x80 | (xmm << 3) | (base & 7))});
+            if ((base & 7) == 4)
+            {
+                bytes({0x24});
+            }
+            immediate(static_cast<uint32_t>(disp), 4);
+        }
+
+        // op dst, src
+        void registers(Prefix prefix, Opcode opcode, int dst, int src)
+        {
+            bytes({prefix, 0x0F, opcode, static_cast<uint8_t>(0xC0 | (dst << 3) | src)});
+        }
+
+        // xmm = {[base + disp], [base + disp]}
+        void broadcast(int xmm, Register base, int32_t disp)
+        {
+            memory(Scalar, Load, xmm, base, disp);
+            registers(Packed, Unpack, xmm, xmm);
+        }
+
+        // xmm = {value, 0} via rax
+        void constant(int xmm, double value)
+        {
+            uint64_t bits;
+            std::memcpy(&bits, &value, sizeof(bits));
+            bytes({0x48, 0xB8});
+            immediate(bits, 8);
+            bytes({0x66, 0x48, 0x0F, 0x6E, static_cast<uint8_t>(0xC0 | (xmm << 3))});
+        }
+
+        // rdi = r13 + disp; rax = target; call rax
+        void call(JitHelpers::Function target, int32_t argumentDisp)
+        {
+            bytes({0x49, 0x8D, 0xBD});
+            immediate(static_cast<uint32_t>(argumentDisp), 4);
+            uint64_t address;
+            std::memcpy(&address, &target, sizeof(address));
+            bytes({0x48, 0xB8});
+            immediate(address, 8);
+            bytes({0xFF, 0xD0});
+        }
+
+        // Saves rbx, r12 and r13 (leaving the stack 16-byte aligned for calls)
+        // and moves the three pointer arguments into them
+        void prologue()
+        {
+            bytes({0x53, 0x41, 0x54, 0x41, 0x55});
+            bytes({0x48, 0x89, 0xFB, 0x49, 0x89, 0xF4, 0x49, 0x89, 0xD5});
+        }
+
+        void epilogue()
+        {
+            bytes({0x41, 0x5D, 0x41, 0x5C, 0x5B, 0xC3});
+        }
+
+        const std::vector<uint8_t>& getCode() const { return code; }
+
+    private:
+        void bytes(std::initializer_list<uint8_t> values) { code.insert(code.end(), values); }
+
+        void immediate(uint64_t value, size_t size)
+        {
+            for (size_t i = 0; i < size; ++i)
+            {
+                code.push_back(static_cast<uint8_t>(value >> (8 * i)));
+            }
+        }
+
+        std::vector<uint8_t> code;
+};
+
+template<size_t N>
+class JitProgram
+{
+    public:
+        // Number of doubles per register block: value, N lanes, padding to even
+        static constexpr size_t STRIDE = (N + 2) & ~size_t(1);
+
+        explicit JitProgram(const ExpressionProgram<double>& compiled) : program(compiled)
+        {
+#if DUALS_JIT_NATIVE
+            JitAssembler assembler = assemble();
+            const std::vector<uint8_t>& code = assembler.getCode();
+            size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+            mappedSize = (code.size() + page - 1) / page * page;
+            void* memory = mmap(nullptr, mappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (memory == MAP_FAILED)
+            {
+                mappedSize = 0;
+                return;
+            }
+            std::memcpy(memory, code.data(), code.size());
+            if (mprotect(memory, mappedSize, PROT_READ | PROT_EXEC) != 0)
+            {
+                munmap(memory, mappedSize);
+                mappedSize = 0;
+                return;
+            }
+            codeSize = code.size();
+            mapped = memory;
+            entry = reinterpret_cast<Entry>(memory);
+#endif
+        }
+
+        ~JitProgram()
+        {
+#if DUALS_JIT_NATIVE
+            if (mapped != nullptr)
+            {
+                munmap(mapped, mappedSize);
+            }
+#endif
+        }
+
+        JitProgram(const JitProgram&) = delete;
+        JitProgram& operator=(const JitProgram&) = delete;
+
+        // Evaluates on packed blocks: each input and output is N + 1 doubles,
+        // the value followed by its lanes. scratch is resized once and can be
+        // reused across calls; throws like Duals for log and abs domain errors.
+        void evaluate(const double* inputs, double* results, std::vector<double>& scratch) const
+        {
+            if (entry == nullptr)
+            {
+                replay(inputs, results);
+                return;
+            }
+            if (scratch.size() < program.getRegisterCount() * STRIDE + 2)
+            {
+                scratch.resize(program.getRegisterCount() * STRIDE + 2);
+            }
+            const char*& error = JitHelpers::domainError();
+            error = nullptr;
+            entry(inputs, results, scratch.data());
+            if (error != nullptr)
+            {
+                throw std::runtime_error(error);
+            }
+        }
+
+        template<size_t INPUTS, size_t OUTPUTS>
+        void evaluate(const std::array<Duals<N, double>, INPUTS>& inputs, std::array<Duals<N, double>, OUTPUTS>& results,
+                      std::vector<double>& scratch) const
+        {
+            if (INPUTS != program.inputCount() || OUTPUTS != program.outputCount())
+            {
+                throw std::invalid_argument("Input or output count does not match the traced function");
+            }
+            std::array<double, INPUTS * (N + 1)> packedInputs;
+            std::array<double, OUTPUTS * (N + 1)> packedResults;
+            for (size_t k = 0; k < INPUTS; ++k)
+            {
+                packedInputs[k * (N + 1)] = inputs[k].getValue();
+                for (size_t i = 0; i < N; ++i)
+                {
+                    packedInputs[k * (N + 1) + 1 + i] = inputs[k].getDerivative(i);
+                }
+            }
+            evaluate(packedInputs.data(), packedResults.data(), scratch);
+            for (size_t k = 0; k < OUTPUTS; ++k)
+            {
+                results[k].setValue(packedResults[k * (N + 1)]);
+                for (size_t i = 0; i < N; ++i)
+                {
+                    results[k].setDerivative(i, packedResults[k * (N + 1) + 1 + i]);
+                }
+            }
+        }
+
+        // True if evaluate runs generated machine code rather than the replay fallback
+        bool isNative() const { return entry != nullptr; }
+
+        size_t getCodeSize() const { return codeSize; }
+
+        const ExpressionProgram<double>& getProgram() const { return program; }
+
+    private:
+        using Entry = void (*)(const double*, double*, double*);
+
+        void replay(const double* inputs, double* results) const
+        {
+            std::vector<Duals<N, double>> duals(program.inputCount());
+            std::vector<Duals<N, double>> outputs(program.outputCount());
+            std::vector<Duals<N, double>> registers;
+            for (size_t k = 0; k < duals.size(); ++k)
+            {
+                duals[k].setValue(inputs[k * (N + 1)]);
+                for (size_t i = 0; i < N; ++i)
+                {
+                    duals[k].setDerivative(i, inputs[k * (N + 1) + 1 + i]);
+                }
+            }
+            program.evaluate(duals.data(), outputs.data(), registers);
+            for (size_t k = 0; k < outputs.size(); ++k)
+            {
+                results[k * (N + 1)] = outputs[k].getValue();
+                for (size_t i = 0; i < N; ++i)
+                {
+                    results[k * (N + 1) + 1 + i] = outputs[k].getDerivative(i);
+                }
+            }
+        }
+
+#if DUALS_JIT_NATIVE
+        static int32_t blockOffset(size_t r) { return static_cast<int32_t>(r * STRIDE * sizeof(double)); }
+
+        // Copies N + 1 doubles between a packed argument and a register block
+        static void copy(JitAssembler& assembler, JitAssembler::Register fromBase, int32_t from,
+                         JitAssembler::Register toBase, int32_t to)
+        {
+            size_t p = 0;
+            for (; 2 * p + 1 < N + 1; ++p)
+            {
+                assembler.memory(JitAssembler::Packed, JitAssembler::Load, 0, fromBase, from + int32_t(16 * p));
+                assembler.memory(JitAssembler::Packed, JitAssembler::Store, 0, toBase, to + int32_t(16 * p));
+            }
+            if ((N + 1) % 2 == 1)
+            {
+                assembler.memory(JitAssembler::Scalar, JitAssembler::Load, 0, fromBase, from + int32_t(16 * p));
+                assembler.memory(JitAssembler::Scalar, JitAssembler::Store, 0, toBase, to + int32_t(16 * p));
+            }
+        }
+
+        JitAssembler assemble() const
+        {
+            using A = JitAssembler;
+            const A::Register regs = A::R13;
+            const int32_t slot = blockOffset(program.getRegisterCount());
+            A assembler;
+            assembler.prologue();
+
+            for (const ExpressionInstruction<double>& instruction : program.getInstructions())
+            {
+                int32_t r = blockOffset(instruction.target);
+                int32_t a = blockOffset(instruction.left);
+                int32_t b = blockOffset(instruction.right);
+                switch (instruction.op)
+                {
+                    case ExpressionOp::Input:
+                        copy(assembler, A::RBX, int32_t(instruction.left * (N + 1) * sizeof(double)), regs, r);
+                        if ((N + 1) % 2 == 1)
+                        {
+                            assembler.registers(A::Packed, A::Xor, 1, 1);
+                            assembler.memory(A::Scalar, A::Store, 1, regs, r + int32_t(N + 1) * 8);
+                        }
+                        break;
+                    case ExpressionOp::Constant:
+                        assembler.registers(A::Packed, A::Xor, 1, 1);
+                        for (size_t p = 0; p < STRIDE / 2; ++p)
+                        {
+                            assembler.memory(A::Packed, A::Store, 1, regs, r + int32_t(16 * p));
+                        }
+                        assembler.constant(0, instruction.constant);
+                        assembler.memory(A::Scalar, A::Store, 0, regs, r);
+                        break;
+                    case ExpressionOp::Add:
+                    case ExpressionOp::Subtract:
+                        for (size_t p = 0; p < STRIDE / 2; ++p)
+                        {
+                            assembler.memory(A::Packed, A::Load, 0, regs, a + int32_t(16 * p));
+                            assembler.memory(A::Packed, A::Load, 1, regs, b + int32_t(16 * p));
+                            assembler.registers(A::Packed, instruction.op == ExpressionOp::Add ? A::Add : A::Subtract, 0, 1);
+                            assembler.memory(A::Packed, A::Store, 0, regs, r + int32_t(16 * p));
+                        }
+                        break;
+                    case ExpressionOp::Multiply:
+                        // lanes: a * db + da * b, then the value slot is overwritten with a * b
+                        assembler.broadcast(7, regs, a);
+                        assembler.broadcast(6, regs, b);
+                        for (size_t p = 0; p < STRIDE / 2; ++p)
+                        {
+                            assembler.memory(A::Packed, A::Load, 0, regs, b + int32_t(16 * p));
+                            assembler.registers(A::Packed, A::Multiply, 0, 7);
+                            assembler.memory(A::Packed, A::Load, 1, regs, a + int32_t(16 * p));
+                            assembler.registers(A::Packed, A::Multiply, 1, 6);
+                            assembler.registers(A::Packed, A::Add, 0, 1);
+                            assembler.memory(A::Packed, A::Store, 0, regs, r + int32_t(16 * p));
+                        }
+                        assembler.registers(A::Scalar, A::Multiply, 7, 6);
+                        assembler.memory(A::Scalar, A::Store, 7, regs, r);
+                        break;
+                    case ExpressionOp::Divide:
+                        // lanes: (da * b - db * a) / (b * b), then the value slot is overwritten with a / b
+                        assembler.broadcast(7, regs, a);
+                        assembler.broadcast(6, regs, b);
+                        assembler.registers(A::Packed, A::Move, 5, 6);
+                        assembler.registers(A::Packed, A::Multiply, 5, 6);
+                        for (size_t p = 0; p < STRIDE / 2; ++p)
+                        {
+                            assembler.memory(A::Packed, A::Load, 0, regs, a + int32_t(16 * p));
+                            assembler.registers(A::Packed, A::Multiply, 0, 6);
+                            assembler.memory(A::Packed, A::Load, 1, regs, b + int32_t(16 * p));
+                            assembler.registers(A::Packed, A::Multiply, 1, 7);
+                            assembler.registers(A::Packed, A::Subtract, 0, 1);
+                            assembler.registers(A::Packed, A::Divide, 0, 5);
+                            assembler.memory(A::Packed, A::Store, 0, regs, r + int32_t(16 * p));
+                        }
+                        assembler.registers(A::Scalar, A::Divide, 7, 6);
+                        assembler.memory(A::Scalar, A::Store, 7, regs, r);
+                        break;
+                    default:
+                        // helper(a, constant, slot) writes the value and factor; lanes are da * factor
+                        assembler.memory(A::Scalar, A::Load, 0, regs, a);
+                        assembler.constant(1, instruction.constant);
+                        assembler.call(JitHelpers::lookup(instruction.op), slot);
+                        assembler.broadcast(6, regs, slot + 8);
+                        for (size_t p = 0; p < STRIDE / 2; ++p)
+                        {
+                            assembler.memory(A::Packed, A::Load, 0, regs, a + int32_t(16 * p));
+                            assembler.registers(A::Packed, A::Multiply, 0, 6);
+                            assembler.memory(A::Packed, A::Store, 0, regs, r + int32_t(16 * p));
+                        }
+                        assembler.memory(A::Scalar, A::Load, 0, regs, slot);
+                        assembler.memory(A::Scalar, A::Store, 0, regs, r);
+                        break;
+                }
+            }
+
+            const std::vector<uint32_t>& outputs = program.getOutputs();
+            for (size_t k = 0; k < outputs.size(); ++k)
+            {
+                copy(assembler, regs, blockOffset(outputs[k]), A::R12, int32_t(k * (N + 1) * sizeof(double)));
+            }
+            assembler.epilogue();
+            return assembler;
+        }
+#endif
+
+        ExpressionProgram<double> program;
+        Entry entry = nullptr;
+        void* mapped = nullptr;
+        size_t mappedSize = 0;
+        size_t codeSize = 0;
+};
+
+// Process-wide cache of compiled programs keyed by the program hash
+template<size_t N>
+class JitCache
+{
+    public:
+        static JitCache& instance()
+        {
+            static JitCache cache;
+            return cache;
+        }
+
+        std::shared_ptr<const JitProgram<N>> compile(const ExpressionProgram<double>& program)
+        {
+            size_t key = program.hash();
+            std::lock_guard<std::mutex> lock(mutex);
+            std::vector<std::shared_ptr<const JitProgram<N>>>& bucket = entries[key];
+            for (const std::shared_ptr<const JitProgram<N>>& entry : bucket)
+            {
+                if (entry->getProgram() == program)
+                {
+                    ++hits;
+                    return entry;
+                }
+            }
+            ++misses;
+            bucket.push_back(std::make_shared<const JitProgram<N>>(program));
+            return bucket.back();
+        }
+
+        size_t getHits() const { std::lock_guard<std::mutex> lock(mutex); return hits; }
+
+        size_t getMisses() const { std::lock_guard<std::mutex> lock(mutex); return misses; }
+
+        void clear()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            entries.clear();
+            hits = 0;
+            misses = 0;
+        }
+
+    private:
+        mutable std::mutex mutex;
+        std::unordered_map<size_t, std::vector<std::shared_ptr<const JitProgram<N>>>> entries;
+        size_t hits = 0;
+        size_t misses = 0;
+};
+
+// Compiles a program for N derivative lanes, or returns the cached code for an identical one
+template<size_t N>
+std::shared_ptr<const JitProgram<N>> jitCompile(const ExpressionProgram<double>& program)
+{
+    return JitCache<N>::instance().compile(program);
+}
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef KERNEL_MODELS_H
+#define KERNEL_MODELS_H
+
+#include <array>
+#include <limits>
+#include "Duals.h"
+
+// Functions that GenerateKernels traces into GeneratedKernels.h. They are
+// written generically over the scalar type so the tests can check each
+// generated kernel against the same function evaluated with live Duals.
+
+// Each input appears in one term only, so most derivative lanes are zero
+struct SeparableSum
+{
+    template <typename S>
+    S operator()(const std::array<S, 3>& v) const
+    {
+        return v[0] * v[0] + S(3.0) * sin(v[1]) + exp(v[2]) / S(2.0);
+    }
+};
+
+// Two outputs sharing x*x + y*y
+struct CoupledTerms
+{
+    template <typename S>
+    std::array<S, 2> operator()(const std::array<S, 3>& v) const
+    {
+        S radius = sqrt(v[0] * v[0] + v[1] * v[1]);
+        return {v[0] * v[1] / (S(1.0) + v[2] * v[2]), radius * log(v[2] + S(2.0))};
+    }
+};
+
+// The remaining elementary functions
+struct MixedFunctions
+{
+    template <typename S>
+    S operator()(const std::array<S, 2>& v) const
+    {
+        return pow(v[0], 3.0f) - arctan(v[1]) + abs(v[0] - v[1]) + tan(v[0] / S(4.0))
+             + arcsin(v[1] / S(4.0)) * arccos(v[0] / S(5.0)) - cos(v[0] * v[1]);
+    }
+};
+
+// Unary minus and int literals, as generic code written for Duals uses them
+struct NegatedTerms
+{
+    template <typename S>
+    S operator()(const std::array<S, 2>& v) const
+    {
+        return -v[0] * v[1] + 2 * v[0] - 3 / (v[1] + 4) + -exp(-v[1]);
+    }
+};
+
+// An infinite constant, which has no C++ literal, next to the domain-checked functions
+struct LimitTerms
+{
+    template <typename S>
+    S operator()(const std::array<S, 2>& v) const
+    {
+        const double infinity = std::numeric_limits<double>::infinity();
+        return exp(v[0] + S(-infinity)) + abs(v[0] * v[1]) + log(v[1] * v[1] + S(1.0)) + sqrt(v[0] * v[0] + S(2.0));
+    }
+};
+
+#endif
@@ -0,0 +1,253 @@
+#ifndef LEAST_SQUARES_H
+#define LEAST_SQUARES_H
+
+#include <vector>
+#include "Derivatives.h"
+#include "Parallel.h"
+
+// Levenberg-Marquardt for fitting N parameters to a (possibly huge) set of
+// data points. The residual is written generically over its scalar type:
+//
+//     struct Model
+//     {
+//         template <typename S>
+//         S operator()(const std::array<S, N>& params, const Sample& sample) const { ... }
+//     };
+//
+// Each residual is evaluated with Duals<N, T> to get its row of the Jacobian,
+// which is folded straight into J^T J and J^T r, so J itself is never stored.
+
+template<typename T = double>
+struct LeastSquaresOptions
+{
+    size_t maxIterations = 100;
+    T gradientTolerance = T(1e-10);  // stop once max |J^T r| drops below this
+    T stepTolerance = T(1e-12);      // stop once the step is this small relative to the parameters
+    T initialDamping = T(1e-3);      // starting lambda, relative to the largest diagonal of J^T J
+    size_t numThreads = hardwareThreads();
+    size_t blockSize = 4096;         // residuals per partial sum; fixes the reduction order
+};
+
+template<typename T = double>
+struct LeastSquaresResult
+{
+    T cost = T();                    // 0.5 * sum of squared residuals
+    T gradientNorm = T();            // max |J^T r| at the solution
+    size_t iterations = 0;
+    bool converged = false;
+};
+
+// Partial sums of the normal equations over one block of residuals.
+// Only the lower triangle of jtj is accumulated.
+template<size_t N, typename T>
+struct NormalEquations
+{
+    Matrix<N, T> jtj;
+    Vector<N, T> jtr;
+    T cost;
+
+    void clear()
+    {
+        for (auto& row : jtj)
+        {
+            row.fill(T(0));
+        }
+        jtr.fill(T(0));
+        cost = T(0);
+    }
+
+    void add(const NormalEquations& other)
+    {
+        for (size_t i = 0; i < N; ++i)
+        {
+            for (size_t j = 0; j <= i; ++j)
+            {
+                jtj[i][j] += other.jtj[i][j];
+            }
+            jtr[i] += other.jtr[i];
+        }
+        cost += other.cost;
+    }
+};
+
+// Builds J^T J, J^T r and the cost at params. Residuals are split into fixed
+// blocks, each block is summed into its own partial by whichever thread takes
+// it, and the partials are combined in a fixed pairwise order, so the result
+// does not depend on the thread count.
+template<size_t N, typename T, typename Residual, typename Sample>
+void assembleNormalEquations(const Residual& residual, const std::vector<Sample>& data, const Vector<N, T>& params,
+                             const LeastSquaresOptions<T>& options, std::vector<NormalEquations<N, T>>& partials)
+{
+    const std::array<Duals<N, T>, N> seeded = seedGradient(params);
+    size_t numBlocks = blockCount(data.size(), options.blockSize);
+
+    parallelBlocks(data.size(), options.blockSize, options.numThreads, [&](size_t begin, size_t end, size_t block)
+    {
+        NormalEquations<N, T> local;
+        local.clear();
+        for (size_t k = begin; k < end; ++k)
+        {
+            Duals<N, T> r = residual(seeded, data[k]);
+            const auto& row = r.getAllDerivatives();
+            for (size_t i = 0; i < N; ++i)
+            {
+                for (size_t j = 0; j <= i; ++j)
+                {
+                    local.jtj[i][j] += row[i] * row[j];
+                }
+                local.jtr[i] += row[i] * r.getValue();
+            }
+            local.cost += r.getValue() * r.getValue();
+        }
+        partials[block] = local;
+    });
+
+    pairwiseReduce(partials, numBlocks, [](NormalEquations<N, T>& into, const NormalEquations<N, T>& from)
+    {
+        into.add(from);
+    });
+
+    NormalEquations<N, T>& total = partials[0];
+    if (numBlocks == 0)
+    {
+        total.clear();
+    }
+    for (size_t i = 0; i < N; ++i)
+    {
+        for (size_t j = i + 1; j < N; ++j)
+        {
+            total.jtj[i][j] = total.jtj[j][i];
+        }
+    }
+    total.cost *= T(0.5);
+}
+
+// Cost only (no derivatives) at params, reduced in the same deterministic order
+template<size_t N, typename T, typename Residual, typename Sample>
+T leastSquaresCost(const Residual& residual, const std::vector<Sample>& data, const Vector<N, T>& params,
+                   const LeastSquaresOptions<T>& options, std::vector<T>& partials)
+{
+    size_t numBlocks = blockCount(data.size(), options.blockSize);
+
+    parallelBlocks(data.size(), options.blockSize, options.numThreads, [&](size_t begin, size_t end, size_t block)
+    {
+        T local = T(0);
+        for (size_t k = begin; k < end; ++k)
+        {
+            T r = residual(params, data[k]);
+            local += r * r;
+        }
+        partials[block] = local;
+    });
+
+    pairwiseReduce(partials, numBlocks, [](T& into, const T& from) { into += from; });
+    return numBlocks == 0 ? T(0) : T(0.5) * partials[0];
+}
+
+template<size_t N, typename T, typename Residual, typename Sample>
+LeastSquaresResult<T> levenbergMarquardt(const Residual& residual, const std::vector<Sample>& data, Vector<N, T>& params,
+                                         const LeastSquaresOptions<T>& options = {})
+{
+    LeastSquaresResult<T> result;
+
+    // All per-block buffers are sized once up front
+    size_t numBlocks = std::max<size_t>(1, blockCount(data.size(), options.blockSize));
+    std::vector<NormalEquations<N, T>> partials(numBlocks);
+    std::vector<T> costPartials(numBlocks);
+
+    Matrix<N, T> factor;
+    Vector<N, T> step;
+    Vector<N, T> trial;
+    Vector<N, T> scale;
+
+    assembleNormalEquations(residual, data, params, options, partials);
+    NormalEquations<N, T> normal = partials[0];
+
+    T largestDiagonal = T(0);
+    for (size_t i = 0; i < N; ++i)
+    {
+        largestDiagonal = std::max(largestDiagonal, normal.jtj[i][i]);
+    }
+    T damping = options.initialDamping * (largestDiagonal > T(0) ? largestDiagonal : T(1));
+    T growth = T(2);
+
+    auto gradientNorm = [](const Vector<N, T>& g)
+    {
+        T largest = T(0);
+        for (const T& value : g)
+        {
+            largest = std::max(largest, std::abs(value));
+        }
+        return largest;
+    };
+
+    for (; result.iterations < options.maxIterations; ++result.iterations)
+    {
+        if (gradientNorm(normal.jtr) < options.gradientTolerance)
+        {
+            result.converged = true;
+            break;
+        }
+
+        // Solve (J^T J + lambda * D) step = -J^T r with Marquardt's diagonal scaling
+        for (size_t i = 0; i < N; ++i)
+        {
+            scale[i] = std::max(normal.jtj[i][i], T(1e-12) * (largestDiagonal > T(0) ? largestDiagonal : T(1)));
+        }
+        factor = normal.jtj;
+        for (size_t i = 0; i < N; ++i)
+        {
+            factor[i][i] += damping * scale[i];
+            step[i] = -normal.jtr[i];
+        }
+        if (!choleskyFactor(factor))
+        {
+            damping *= growth;
+            growth *= T(2);
+            continue;
+        }
+        choleskySolve(factor, step);
+
+        if (norm(step) <= options.stepTolerance * (norm(params) + options.stepTolerance))
+        {
+            result.converged = true;
+            break;
+        }
+
+        for (size_t i = 0; i < N; ++i)
+        {
+            trial[i] = params[i] + step[i];
+        }
+        T trialCost = leastSquaresCost(residual, data, trial, options, costPartials);
+
+        // Gain ratio between the actual and the predicted decrease of the cost
+        T predicted = T(0);
+        for (size_t i = 0; i < N; ++i)
+        {
+            predicted += step[i] * (damping * scale[i] * step[i] - normal.jtr[i]);
+        }
+        predicted *= T(0.5);
+        T gain = (normal.cost - trialCost) / predicted;
+
+        if (predicted > T(0) && gain > T(0))
+        {
+            params = trial;
+            assembleNormalEquations(residual, data, params, options, partials);
+            normal = partials[0];
+            T shrink = T(2) * gain - T(1);
+            damping *= std::max(T(1) / T(3), T(1) - shrink * shrink * shrink);
+            growth = T(2);
+        }
+        else
+        {
+            damping *= growth;
+            growth *= T(2);
+        }
+    }
+
+    result.cost = normal.cost;
+    result.gradientNorm = gradientNorm(normal.jtr);
+    return result;
+}
+
+#endif
@@ -0,0 +1,176 @@
+#ifndef LINEAR_ALGEBRA_H
+#define LINEAR_ALGEBRA_H
+
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <utility>
+
+// Small fixed-size dense linear algebra used by the solvers built on Duals.
+// Everything works on std::array so nothing here ever touches the heap.
+
+template<size_t N, typename T = double>
+using Vector = std::array<T, N>;
+
+// Row-major square matrix
+template<size_t N, typename T = double>
+using Matrix = std::array<std::array<T, N>, N>;
+
+// Row-major ROWS x COLUMNS matrix
+template<size_t ROWS, size_t COLUMNS, typename T = double>
+using RectMatrix = std::array<std::array<T, COLUMNS>, ROWS>;
+
+template<size_t N, typename T>
+T dot(const Vector<N, T>& a, const Vector<N, T>& b)
+{
+    T sum = T(0);
+    for (size_t i = 0; i < N; ++i)
+    {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+template<size_t N, typename T>
+T norm(const Vector<N, T>& a)
+{
+    return std::sqrt(dot(a, a));
+}
+
+// Factors a symmetric positive definite matrix in place as L * L^T.
+// Only the lower triangle (including the diagonal) is read and overwritten.
+// Returns false if the matrix is not positive definite.
+template<size_t N, typename T>
+bool choleskyFactor(Matrix<N, T>& a)
+{
+    for (size_t j = 0; j < N; ++j)
+    {
+        T diagonal = a[j][j];
+        for (size_t k = 0; k < j; ++k)
+        {
+            diagonal -= a[j][k] * a[j][k];
+        }
+        if (!(diagonal > T(0)))
+        {
+            return false;
+        }
+        diagonal = std::sqrt(diagonal);
+        a[j][j] = diagonal;
+
+        for (size_t i = j + 1; i < N; ++i)
+        {
+            T sum = a[i][j];
+            for (size_t k = 0; k < j; ++k)
+            {
+                sum -= a[i][k] * a[j][k];
+            }
+            a[i][j] = sum / diagonal;
+        }
+    }
+    return true;
+}
+
+// Solves (L * L^T) x = b in place, where l holds the output of choleskyFactor
+template<size_t N, typename T>
+void choleskySolve(const Matrix<N, T>& l, Vector<N, T>& b)
+{
+    // Forward substitution with L
+    for (size_t i = 0; i < N; ++i)
+    {
+        T sum = b[i];
+        for (size_t k = 0; k < i; ++k)
+        {
+            sum -= l[i][k] * b[k];
+        }
+        b[i] = sum / l[i][i];
+    }
+
+    // Back substitution with L^T
+    for (size_t i = N; i-- > 0;)
+    {
+        T sum = b[i];
+        for (size_t k = i + 1; k < N; ++k)
+        {
+            sum -= l[k][i] * b[k];
+        }
+        b[i] = sum / l[i][i];
+    }
+}
+
+// Factors a general square matrix in place as P * A = L * U with partial
+// pivoting. L (unit diagonal, not stored) and U share the storage of a.
+// Returns false if the matrix is singular to working precision.
+template<size_t N, typename T>
+bool luFactor(Matrix<N, T>& a, std::array<size_t, N>& pivots)
+{
+    for (size_t k = 0; k < N; ++k)
+    {
+        size_t pivot = k;
+        T largest = std::abs(a[k][k]);
+        for (size_t i = k + 1; i < N; ++i)
+        {
+            if (std::abs(a[i][k]) > largest)
+            {
+                largest = std::abs(a[i][k]);
+                pivot = i;
+            }
+        }
+        pivots[k] = pivot;
+        if (!(largest > T(0)))
+        {
+            return false;
+        }
+        if (pivot != k)
+        {
+            std::swap(a[k], a[pivot]);
+        }
+
+        for (size_t i = k + 1; i < N; ++i)
+        {
+            a[i][k] /= a[k][k];
+            T multiplier = a[i][k];
+            for (size_t j = k + 1; j < N; ++j)
+            {
+                a[i][j] -= multiplier * a[k][j];
+            }
+        }
+    }
+    return true;
+}
+
+// Solves A x = b in place, where lu and pivots hold the output of luFactor
+template<size_t N, typename T>
+void luSolve(const Matrix<N, T>& lu, const std::array<size_t, N>& pivots, Vector<N, T>& b)
+{
+    for (size_t k = 0; k < N; ++k)
+    {
+        if (pivots[k] != k)
+        {
+            std::swap(b[k], b[pivots[k]]);
+        }
+    }
+
+    // Forward substitution with the unit lower triangle
+    for (size_t i = 0; i < N; ++i)
+    {
+        T sum = b[i];
+        for (size_t k = 0; k < i; ++k)
+        {
+            sum -= lu[i][k] * b[k];
+        }
+        b[i] = sum;
+    }
+
+    // Back substitution with U
+    for (size_t i = N; i-- > 0;)
+    {
+        T sum = b[i];
+        for (size_t k = i + 1; k < N; ++k)
+        {
+            sum -= lu[i][k] * b[k];
+        }
+        b[i] = sum / lu[i][i];
+    }
+}
+
+#endif
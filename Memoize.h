@@ -0,0 +1,216 @@
+#ifndef MEMOIZE_H
+#define MEMOIZE_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <list>
+#include <mutex>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include "Duals.h"
+
+// Memoizing wrapper for expensive functions written generically over their
+// scalar type (see Derivatives.h). Calls with std::array<S, K> arguments are
+// cached, keyed by the exact bits of every value and derivative lane, so the
+// same point with different seed directions is a different entry and a hit
+// returns a bitwise copy of the result that was computed. Calls with any
+// other scalar type go straight to the function.
+//
+//     auto cached = memoize<2, Duals<2, double>>(Rosenbrock(), 1024);
+//     lbfgs(cached, x);   // value + gradient passes are served from the cache
+//
+// The table is split into STRIPES independently locked shards, each with its
+// own LRU list, so concurrent callers only contend when they hash to the same
+// shard. The function itself runs outside the lock; two threads missing on
+// the same key may both evaluate it, and the first result stored wins.
+
+// Number of scalars in a (possibly nested) dual, and its flattening
+template<typename S>
+struct MemoKey
+{
+    static constexpr size_t size = 1;
+    using Scalar = S;
+
+    static void write(const S& value, Scalar* out) { *out = value; }
+};
+
+template<size_t N, typename U, typename Storage>
+struct MemoKey<Duals<N, U, Storage>>
+{
+    static constexpr size_t size = (N + 1) * MemoKey<U>::size;
+    using Scalar = typename MemoKey<U>::Scalar;
+
+    static void write(const Duals<N, U, Storage>& value, Scalar* out)
+    {
+        MemoKey<U>::write(value.getValue(), out);
+        for (size_t i = 0; i < N; ++i)
+        {
+            MemoKey<U>::write(value.getDerivative(i), out + (i + 1) * MemoKey<U>::size);
+        }
+    }
+};
+
+struct MemoStats
+{
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t evictions = 0;
+    size_t size = 0;
+};
+
+template<size_t K, typename S, typename Function, size_t STRIPES = 16>
+class Memoized
+{
+    public:
+        using Argument = std::array<S, K>;
+        using Result = std::decay_t<decltype(std::declval<const Function&>()(std::declval<const Argument&>()))>;
+
+        // capacity is the total number of results kept, spread over the stripes
+        explicit Memoized(Function function, size_t capacity = 4096)
+            : f(std::move(function)), stripeCapacity(std::max<size_t>(1, (capacity + STRIPES - 1) / STRIPES)) {}
+
+        template<typename U>
+        auto operator()(const std::array<U, K>& x) const
+        {
+            if constexpr (std::is_same_v<U, S>)
+            {
+                return lookup(x);
+            }
+            else
+            {
+                return f(x);
+            }
+        }
+
+        MemoStats getStats() const
+        {
+            MemoStats stats;
+            stats.hits = hits.load(std::memory_order_relaxed);
+            stats.misses = misses.load(std::memory_order_relaxed);
+            stats.evictions = evictions.load(std::memory_order_relaxed);
+            for (const Stripe& stripe : stripes)
+            {
+                std::lock_guard<std::mutex> lock(stripe.mutex);
+                stats.size += stripe.index.size();
+            }
+            return stats;
+        }
+
+        void clear()
+        {
+            for (Stripe& stripe : stripes)
+            {
+                std::lock_guard<std::mutex> lock(stripe.mutex);
+                stripe.index.clear();
+                stripe.order.clear();
+            }
+            hits = 0;
+            misses = 0;
+            evictions = 0;
+        }
+
+    private:
+        using Scalar = typename MemoKey<S>::Scalar;
+        static constexpr size_t KEY_SIZE = K * MemoKey<S>::size;
+
+        struct Key
+        {
+            std::array<Scalar, KEY_SIZE> scalars;
+            size_t hash;
+
+            // Bitwise, so -0.0 and 0.0 differ and a NaN matches itself
+            bool operator==(const Key& other) const
+            {
+                return std::memcmp(scalars.data(), other.scalars.data(), sizeof(scalars)) == 0;
+            }
+        };
+
+        struct KeyHash
+        {
+            size_t operator()(const Key& key) const { return key.hash; }
+        };
+
+        using Entry = std::pair<Key, Result>;
+
+        // Most recently used entries at the front of order
+        struct Stripe
+        {
+            mutable std::mutex mutex;
+            std::list<Entry> order;
+            std::unordered_map<Key, typename std::list<Entry>::iterator, KeyHash> index;
+        };
+
+        static Key makeKey(const Argument& x)
+        {
+            Key key;
+            for (size_t k = 0; k < K; ++k)
+            {
+                MemoKey<S>::write(x[k], key.scalars.data() + k * MemoKey<S>::size);
+            }
+
+            // FNV-1a over the bytes of the key
+            const unsigned char* bytes = reinterpret_cast<const unsigned char*>(key.scalars.data());
+            uint64_t hash = 14695981039346656037ull;
+            for (size_t i = 0; i < sizeof(key.scalars); ++i)
+            {
+                hash = (hash ^ bytes[i]) * 1099511628211ull;
+            }
+            key.hash = static_cast<size_t>(hash);
+            return key;
+        }
+
+        Result lookup(const Argument& x) const
+        {
+            Key key = makeKey(x);
+            Stripe& stripe = stripes[(key.hash >> 7) % STRIPES];
+            {
+                std::lock_guard<std::mutex> lock(stripe.mutex);
+                auto found = stripe.index.find(key);
+                if (found != stripe.index.end())
+                {
+                    stripe.order.splice(stripe.order.begin(), stripe.order, found->second);
+                    hits.fetch_add(1, std::memory_order_relaxed);
+                    return found->second->second;
+                }
+            }
+
+            misses.fetch_add(1, std::memory_order_relaxed);
+            Result result = f(x);
+
+            std::lock_guard<std::mutex> lock(stripe.mutex);
+            auto found = stripe.index.find(key);
+            if (found != stripe.index.end())
+            {
+                return found->second->second;
+            }
+            stripe.order.emplace_front(key, result);
+            stripe.index.emplace(key, stripe.order.begin());
+            if (stripe.index.size() > stripeCapacity)
+            {
+                stripe.index.erase(stripe.order.back().first);
+                stripe.order.pop_back();
+                evictions.fetch_add(1, std::memory_order_relaxed);
+            }
+            return result;
+        }
+
+        Function f;
+        size_t stripeCapacity;
+        mutable std::array<Stripe, STRIPES> stripes;
+        mutable std::atomic<size_t> hits{0};
+        mutable std::atomic<size_t> misses{0};
+        mutable std::atomic<size_t> evictions{0};
+};
+
+// Wraps f so that calls with std::array<S, K> arguments are cached
+template<size_t K, typename S, size_t STRIPES = 16, typename Function>
+Memoized<K, S, Function, STRIPES> memoize(Function f, size_t capacity = 4096)
+{
+    return Memoized<K, S, Function, STRIPES>(std::move(f), capacity);
+}
+
+#endif
@@ -0,0 +1,528 @@
+#ifndef NUMA_H
+#define NUMA_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Derivatives.h"
+#include "Parallel.h"
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// NUMA-aware batch value + gradient evaluation for multi-socket machines:
+//
+//     NumaBatch<8, double> batch(count);                      // first-touched by the owning workers
+//     batch.fill([&](size_t i, Vector<8, double>& x) { x = load(i); });
+//     batch.evaluate(ExtendedRosenbrock<8>());
+//     double fi = batch.value(i);
+//
+// The points are cut into blocks and the blocks into one contiguous range per
+// NUMA node, sized by the number of workers on that node. Every worker is
+// pinned to a CPU of its node and takes blocks from its node's range first,
+// so the pages of a block are first touched (and so placed) by a thread on
+// the node that later evaluates it. The workers are started and pinned once
+// per batch and sleep between calls, so repeated fill and evaluate calls pay
+// no thread creation. fill runs on the owners only; evaluate lets a worker
+// whose node has run dry steal blocks from the other nodes.
+// The topology comes from /sys/devices/system/node on Linux, limited to the
+// CPUs this process may run on. Elsewhere, or on a single-node box,
+// NumaTopology::simulated splits the CPUs into pretend nodes, which keeps
+// the partitioning and pinning testable though all memory is local anyway.
+
+struct NumaNode
+{
+    size_t id = 0;
+    std::vector<size_t> cpus;
+};
+
+class NumaTopology
+{
+    public:
+        // Nodes as the kernel reports them, or one node of every allowed CPU
+        static NumaTopology detect()
+        {
+            std::vector<size_t> allowed = allowedCpus();
+            NumaTopology topology;
+#if defined(__linux__)
+            std::error_code error;
+            std::filesystem::directory_iterator entries("/sys/devices/system/node", error);
+            for (; !error && entries != std::filesystem::directory_iterator(); entries.increment(error))
+            {
+                std::string name = entries->path().filename().string();
+                if (name.size() <= 4 || name.compare(0, 4, "node") != 0 ||
+                    name.find_first_not_of("0123456789", 4) != std::string::npos)
+                {
+                    continue;
+                }
+                std::ifstream file(entries->path() / "cpulist");
+                std::string list;
+                std::getline(file, list);
+                NumaNode node;
+                node.id = std::stoul(name.substr(4));
+                for (size_t cpu : parseCpuList(list))
+                {
+                    if (std::binary_search(allowed.begin(), allowed.end(), cpu))
+                    {
+                        node.cpus.push_back(cpu);
+                    }
+                }
+                if (!node.cpus.empty())
+                {
+                    topology.nodes.push_back(node);
+                }
+            }
+            std::sort(topology.nodes.begin(), topology.nodes.end(),
+                      [](const NumaNode& a, const NumaNode& b) { return a.id < b.id; });
+#endif
+            if (topology.nodes.empty())
+            {
+                topology.nodes.push_back(NumaNode{0, allowed});
+            }
+            return topology;
+        }
+
+        // Detected once per process
+        static const NumaTopology& system()
+        {
+            static const NumaTopology topology = detect();
+            return topology;
+        }
+
+        // The allowed CPUs split into numNodes contiguous pretend nodes; with
+        // fewer CPUs than nodes a CPU is shared by several nodes
+        static NumaTopology simulated(size_t numNodes)
+        {
+            std::vector<size_t> allowed = allowedCpus();
+            numNodes = std::max<size_t>(numNodes, 1);
+            NumaTopology topology;
+            topology.isSimulatedTopology = true;
+            for (size_t n = 0; n < numNodes; ++n)
+            {
+                NumaNode node;
+                node.id = n;
+                size_t begin = n * allowed.size() / numNodes;
+                size_t end = (n + 1) * allowed.size() / numNodes;
+                if (begin == end)
+                {
+                    node.cpus.push_back(allowed[n % allowed.size()]);
+                }
+                node.cpus.insert(node.cpus.end(), allowed.begin() + begin, allowed.begin() + end);
+                topology.nodes.push_back(node);
+            }
+            return topology;
+        }
+
+        // Parses the kernel's CPU list format, e.g. "0-3,8,10-11"
+        static std::vector<size_t> parseCpuList(const std::string& list)
+        {
+            std::vector<size_t> cpus;
+            std::stringstream ranges(list);
+            std::string range;
+            while (std::getline(ranges, range, ','))
+            {
+                if (range.find_first_of("0123456789") == std::string::npos)
+                {
+                    continue;
+                }
+                size_t dash = range.find('-');
+                size_t first = std::stoul(range.substr(0, dash));
+                size_t last = dash == std::string::npos ? first : std::stoul(range.substr(dash + 1));
+                for (size_t cpu = first; cpu <= last; ++cpu)
+                {
+                    cpus.push_back(cpu);
+                }
+            }
+            std::sort(cpus.begin(), cpus.end());
+            cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+            return cpus;
+        }
+
+        // CPUs the calling thread may run on, in increasing order
+        static std::vector<size_t> allowedCpus()
+        {
+            std::vector<size_t> cpus;
+#if defined(__linux__)
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            if (sched_getaffinity(0, sizeof(set), &set) == 0)
+            {
+                for (size_t cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+                {
+                    if (CPU_ISSET(cpu, &set))
+                    {
+                        cpus.push_back(cpu);
+                    }
+                }
+            }
+#endif
+            if (cpus.empty())
+            {
+                for (size_t cpu = 0; cpu < hardwareThreads(); ++cpu)
+                {
+                    cpus.push_back(cpu);
+                }
+            }
+            return cpus;
+        }
+
+        const std::vector<NumaNode>& getNodes() const { return nodes; }
+
+        size_t nodeCount() const { return nodes.size(); }
+
+        bool isSimulated() const { return isSimulatedTopology; }
+
+    private:
+        std::vector<NumaNode> nodes;
+        bool isSimulatedTopology = false;
+};
+
+// Restricts the calling thread to one CPU; false where that is unsupported or refused
+inline bool pinCurrentThread(size_t cpu)
+{
+#if defined(__linux__)
+    if (cpu >= CPU_SETSIZE)
+    {
+        return false;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    (void)cpu;
+    return false;
+#endif
+}
+
+struct NumaOptions
+{
+    bool numaAware = true;          // false: one shared queue, no pinning, buffers touched by the caller
+    bool pinThreads = true;
+    size_t numThreads = hardwareThreads();
+    size_t blockSize = 4096;        // points per work item
+    NumaTopology topology = NumaTopology::system();
+};
+
+// Points and their values and gradients, laid out and evaluated node by node
+template<size_t K, typename T>
+class NumaBatch
+{
+    public:
+        NumaBatch(size_t count, const NumaOptions& batchOptions = {})
+            : numPoints(count), options(batchOptions)
+        {
+            options.blockSize = std::max<size_t>(options.blockSize, 1);
+            options.numThreads = std::max<size_t>(options.numThreads, 1);
+            place();
+
+            // new T[] leaves trivial scalars untouched, so no page is placed yet
+            inputs.reset(new T[numPoints * K]);
+            outputs.reset(new T[numPoints * (K + 1)]);
+            start();
+            if (!options.numaAware)
+            {
+                std::fill_n(inputs.get(), numPoints * K, T(0));
+                std::fill_n(outputs.get(), numPoints * (K + 1), T(0));
+                return;
+            }
+            run(false, [this](size_t begin, size_t end)
+            {
+                std::fill(inputs.get() + begin * K, inputs.get() + end * K, T(0));
+                std::fill(outputs.get() + begin * (K + 1), outputs.get() + end * (K + 1), T(0));
+            });
+        }
+
+        // The workers are idle between calls, so this only wakes and joins them
+        ~NumaBatch()
+        {
+            stop();
+        }
+
+        NumaBatch(const NumaBatch&) = delete;
+        NumaBatch& operator=(const NumaBatch&) = delete;
+
+        // Calls generate(i, x) for every point on the worker that owns it
+        template<typename Generate>
+        void fill(const Generate& generate)
+        {
+            run(false, [&](size_t begin, size_t end)
+            {
+                for (size_t i = begin; i < end; ++i)
+                {
+                    Vector<K, T> x;
+                    std::copy_n(inputs.get() + i * K, K, x.begin());
+                    generate(i, x);
+                    setPoint(i, x);
+                }
+            });
+        }
+
+        // Value and gradient of f at every point
+        template<typename Function>
+        void evaluate(const Function& f)
+        {
+            run(true, [&](size_t begin, size_t end)
+            {
+                for (size_t i = begin; i < end; ++i)
+                {
+                    Vector<K, T> gradient;
+                    T* out = outputs.get() + i * (K + 1);
+                    out[0] = valueAndGradient(f, point(i), gradient);
+                    std::copy(gradient.begin(), gradient.end(), out + 1);
+                }
+            });
+        }
+
+        size_t size() const { return numPoints; }
+
+        Vector<K, T> point(size_t i) const
+        {
+            Vector<K, T> x;
+            std::copy_n(inputs.get() + i * K, K, x.begin());
+            return x;
+        }
+
+        void setPoint(size_t i, const Vector<K, T>& x)
+        {
+            std::copy(x.begin(), x.end(), inputs.get() + i * K);
+        }
+
+        T value(size_t i) const { return outputs[i * (K + 1)]; }
+
+        Vector<K, T> gradient(size_t i) const
+        {
+            Vector<K, T> result;
+            std::copy_n(outputs.get() + i * (K + 1) + 1, K, result.begin());
+            return result;
+        }
+
+        // Node index (into the topology's nodes) whose workers own point i
+        size_t ownerNode(size_t i) const
+        {
+            size_t block = i / options.blockSize;
+            size_t range = std::upper_bound(rangeBegin.begin(), rangeBegin.end(), block) - rangeBegin.begin() - 1;
+            return rangeNode[range];
+        }
+
+        // Workers that could not be pinned to their CPU
+        size_t getUnpinnedWorkers() const { return unpinned; }
+
+    private:
+        struct Worker
+        {
+            size_t range = 0;
+            size_t cpu = 0;
+        };
+
+        // Spreads the workers over the nodes round robin, one CPU after the
+        // other, and gives each node with workers a share of the blocks
+        void place()
+        {
+            const std::vector<NumaNode>& nodes = options.topology.getNodes();
+            size_t numBlocks = blockCount(numPoints, options.blockSize);
+            if (!options.numaAware || nodes.empty())
+            {
+                workers.assign(options.numThreads, Worker());
+                rangeBegin = {0, numBlocks};
+                rangeNode = {0};
+                return;
+            }
+
+            std::vector<size_t> perNode(nodes.size(), 0);
+            for (size_t t = 0; t < options.numThreads; ++t)
+            {
+                size_t node = t % nodes.size();
+                size_t slot = t / nodes.size();
+                workers.push_back(Worker{node, nodes[node].cpus[slot % nodes[node].cpus.size()]});
+                ++perNode[node];
+            }
+
+            // Ranges are numbered in node order, skipping nodes without workers
+            std::vector<size_t> rangeOfNode(nodes.size(), 0);
+            size_t assigned = 0;
+            rangeBegin.push_back(0);
+            for (size_t node = 0; node < nodes.size(); ++node)
+            {
+                if (perNode[node] == 0)
+                {
+                    continue;
+                }
+                rangeOfNode[node] = rangeNode.size();
+                rangeNode.push_back(node);
+                assigned += perNode[node];
+                rangeBegin.push_back(numBlocks * assigned / options.numThreads);
+            }
+            for (Worker& worker : workers)
+            {
+                worker.range = rangeOfNode[worker.range];
+            }
+        }
+
+        // Starts the workers, each pinned once to its CPU; they then sleep
+        // until run hands them a round of blocks
+        void start()
+        {
+            next.reset(new std::atomic<size_t>[rangeNode.size()]);
+            threads.reserve(workers.size());
+            try
+            {
+                for (size_t w = 0; w < workers.size(); ++w)
+                {
+                    threads.emplace_back([this, w]() { work(workers[w]); });
+                }
+            }
+            catch (...)
+            {
+                stop();
+                throw;
+            }
+        }
+
+        void stop()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            wake.notify_all();
+            for (std::thread& thread : threads)
+            {
+                thread.join();
+            }
+            threads.clear();
+        }
+
+        void work(const Worker& worker)
+        {
+            // The caller does not take part, so its own affinity is left alone
+            if (options.numaAware && options.pinThreads && !pinCurrentThread(worker.cpu))
+            {
+                ++failedPins;
+            }
+            size_t seen = 0;
+            for (;;)
+            {
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    wake.wait(lock, [&]() { return stopping || round != seen; });
+                    if (stopping)
+                    {
+                        return;
+                    }
+                    seen = round;
+                }
+                drain(worker);
+                std::lock_guard<std::mutex> lock(mutex);
+                if (--busy == 0)
+                {
+                    finished.notify_one();
+                }
+            }
+        }
+
+        // One worker's share of the current round: its own range first and,
+        // if the round steals, then the others
+        void drain(const Worker& worker)
+        {
+            size_t numRanges = rangeNode.size();
+            try
+            {
+                for (size_t offset = 0; offset < (roundSteals ? numRanges : 1); ++offset)
+                {
+                    size_t r = (worker.range + offset) % numRanges;
+                    for (size_t block = next[r]++; block < rangeBegin[r + 1]; block = next[r]++)
+                    {
+                        size_t begin = block * options.blockSize;
+                        roundBody(roundContext, begin, std::min(begin + options.blockSize, numPoints));
+                    }
+                }
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!failure)
+                {
+                    failure = std::current_exception();
+                }
+                for (size_t r = 0; r < numRanges; ++r)
+                {
+                    next[r] = rangeBegin[r + 1];
+                }
+            }
+        }
+
+        // Runs body(begin, end) over every block on the workers and waits for
+        // them; the first exception thrown by body is rethrown here
+        template<typename Body>
+        void run(bool steal, const Body& body)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                for (size_t r = 0; r < rangeNode.size(); ++r)
+                {
+                    next[r].store(rangeBegin[r], std::memory_order_relaxed);
+                }
+                roundSteals = steal;
+                roundContext = &body;
+                roundBody = [](const void* context, size_t begin, size_t end)
+                {
+                    (*static_cast<const Body*>(context))(begin, end);
+                };
+                failure = nullptr;
+                busy = threads.size();
+                ++round;
+            }
+            wake.notify_all();
+
+            std::exception_ptr thrown;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                finished.wait(lock, [this]() { return busy == 0; });
+                std::swap(thrown, failure);
+            }
+            unpinned = failedPins;
+            if (thrown)
+            {
+                std::rethrow_exception(thrown);
+            }
+        }
+
+        size_t numPoints;
+        NumaOptions options;
+        std::vector<Worker> workers;
+        std::vector<size_t> rangeBegin;     // first block of each range, plus the end
+        std::vector<size_t> rangeNode;      // node of each range
+        std::unique_ptr<T[]> inputs;
+        std::unique_ptr<T[]> outputs;
+        size_t unpinned = 0;
+
+        // The persistent workers and the round they are working on
+        std::vector<std::thread> threads;
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::condition_variable finished;
+        size_t round = 0;
+        size_t busy = 0;                    // workers still in the current round
+        bool stopping = false;
+        bool roundSteals = false;
+        const void* roundContext = nullptr;
+        void (*roundBody)(const void*, size_t, size_t) = nullptr;
+        std::unique_ptr<std::atomic<size_t>[]> next;    // next block of each range
+        std::exception_ptr failure;
+        std::atomic<size_t> failedPins{0};
+};
+
+#endif
@@ -0,0 +1,237 @@
+#ifndef ODE_H
+#define ODE_H
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <stdexcept>
+#include "Duals.h"
+
+// Explicit integrators for y' = f(t, y) templated on the state scalar S.
+// The right-hand side writes its result in place:
+//
+//     template <typename S>
+//     struct Logistic
+//     {
+//         S rate;
+//         void operator()(double t, const std::array<S, 1>& y, std::array<S, 1>& dydt) const
+//         {
+//             dydt[0] = rate * y[0] * (S(1.0) - y[0]);
+//         }
+//     };
+//
+// Integrating with S = double gives the solution; with S = Duals<P, double>
+// and parameters seeded as duals, the derivative lanes of the state carry the
+// forward sensitivities dy/dtheta. Stage buffers live inside the integrator
+// objects, so stepping never allocates or copies whole state vectors.
+
+template<size_t N, typename S>
+class RungeKutta4
+{
+    public:
+        using State = std::array<S, N>;
+        using Time = typename DualsScalar<S>::type;
+
+        // Advances y from t to t + h in place
+        template<typename System>
+        void step(const System& f, Time t, Time h, State& y)
+        {
+            const Time half = h / Time(2);
+            const Time sixth = h / Time(6);
+
+            f(t, y, k1);
+            for (size_t i = 0; i < N; ++i)
+            {
+                stage[i] = y[i] + half * k1[i];
+            }
+            f(t + h / Time(2), stage, k2);
+            for (size_t i = 0; i < N; ++i)
+            {
+                stage[i] = y[i] + half * k2[i];
+            }
+            f(t + h / Time(2), stage, k3);
+            for (size_t i = 0; i < N; ++i)
+            {
+                stage[i] = y[i] + h * k3[i];
+            }
+            f(t + h, stage, k4);
+            for (size_t i = 0; i < N; ++i)
+            {
+                y[i] = y[i] + sixth * (k1[i] + Time(2) * (k2[i] + k3[i]) + k4[i]);
+            }
+        }
+
+        // Integrates from t0 to t1 in a fixed number of equal steps
+        template<typename System>
+        void integrate(const System& f, Time t0, Time t1, size_t steps, State& y)
+        {
+            Time h = (t1 - t0) / Time(steps);
+            for (size_t n = 0; n < steps; ++n)
+            {
+                step(f, t0 + Time(n) * h, h, y);
+            }
+        }
+
+    private:
+        State k1;
+        State k2;
+        State k3;
+        State k4;
+        State stage;
+};
+
+template<typename T = double>
+struct AdaptiveOptions
+{
+    T relativeTolerance = T(1e-8);
+    T absoluteTolerance = T(1e-10);
+    T initialStep = T(0);   // 0 starts at a thousandth of the interval
+    T minStep = T(1e-14);
+    T maxStep = T(0);       // 0 means the whole interval
+    size_t maxSteps = 100000;
+};
+
+struct AdaptiveStats
+{
+    size_t accepted = 0;
+    size_t rejected = 0;
+    size_t evaluations = 0;
+};
+
+// Dormand-Prince 5(4) with first-same-as-last stages and standard step size
+// control. The error estimate only looks at the primal values, so adding
+// sensitivity lanes does not change the step sequence.
+template<size_t N, typename S>
+class DormandPrince
+{
+    public:
+        using State = std::array<S, N>;
+        using Time = typename DualsScalar<S>::type;
+
+        // Integrates y in place from t0 to t1. Accepted steps flip between two
+        // state buffers and the first-same-as-last slope is renamed rather
+        // than copied, so y itself is only written once at the end (or with
+        // the last accepted state if the integration throws).
+        template<typename System>
+        AdaptiveStats integrate(const System& f, Time t0, Time t1, State& y, const AdaptiveOptions<Time>& options = {})
+        {
+            AdaptiveStats stats;
+            Time span = t1 - t0;
+            Time direction = span < Time(0) ? Time(-1) : Time(1);
+            Time maxStep = options.maxStep > Time(0) ? options.maxStep : std::abs(span);
+            Time h = options.initialStep > Time(0) ? options.initialStep : std::min(maxStep, Time(1e-3) * std::abs(span));
+            Time t = t0;
+
+            size_t current = 0;
+            states[current] = y;
+            try
+            {
+                f(t, states[current], slope(0));
+                ++stats.evaluations;
+
+                while (direction * (t1 - t) > Time(0))
+                {
+                    if (stats.accepted + stats.rejected >= options.maxSteps)
+                    {
+                        throw std::runtime_error("Dormand-Prince exceeded the maximum number of steps");
+                    }
+                    h = std::min(h, direction * (t1 - t));
+                    Time error = attempt(f, t, direction * h, states[current], states[1 - current], options);
+                    stats.evaluations += 6;
+
+                    bool accepted = error <= Time(1);
+                    if (accepted)
+                    {
+                        t = direction * (t1 - t) - h <= Time(0) ? t1 : t + direction * h;
+                        current = 1 - current;
+                        std::swap(slots[0], slots[6]);
+                        ++stats.accepted;
+                    }
+                    else
+                    {
+                        ++stats.rejected;
+                    }
+
+                    // Classic controller with safety factor and bounded growth; a NaN
+                    // error shrinks the step and a rejected step never grows it
+                    Time factor = error > Time(0) ? Time(0.9) * std::pow(error, Time(-0.2))
+                                                  : (error == Time(0) ? Time(5) : Time(0.2));
+                    factor = std::clamp(factor, Time(0.2), accepted ? Time(5) : Time(1));
+                    h = std::min(maxStep, h * factor);
+                    if (h < options.minStep)
+                    {
+                        throw std::runtime_error("Dormand-Prince step size underflow");
+                    }
+                }
+            }
+            catch (...)
+            {
+                y = states[current];
+                throw;
+            }
+            y = states[current];
+            return stats;
+        }
+
+    private:
+        // Slope of stage s; the slots are permuted instead of copying slopes
+        State& slope(size_t s) { return k[slots[s]]; }
+
+        // Takes one trial step of size h from (t, y) into next and returns the
+        // scaled error norm; slope(0) must hold f(t, y) on entry.
+        template<typename System>
+        Time attempt(const System& f, Time t, Time h, const State& y, State& next, const AdaptiveOptions<Time>& options)
+        {
+            static constexpr Time c[7] = {0, Time(1) / 5, Time(3) / 10, Time(4) / 5, Time(8) / 9, 1, 1};
+            static constexpr Time a[7][6] = {
+                {0, 0, 0, 0, 0, 0},
+                {Time(1) / 5, 0, 0, 0, 0, 0},
+                {Time(3) / 40, Time(9) / 40, 0, 0, 0, 0},
+                {Time(44) / 45, Time(-56) / 15, Time(32) / 9, 0, 0, 0},
+                {Time(19372) / 6561, Time(-25360) / 2187, Time(64448) / 6561, Time(-212) / 729, 0, 0},
+                {Time(9017) / 3168, Time(-355) / 33, Time(46732) / 5247, Time(49) / 176, Time(-5103) / 18656, 0},
+                {Time(35) / 384, 0, Time(500) / 1113, Time(125) / 192, Time(-2187) / 6784, Time(11) / 84}};
+            // Difference between the fifth and fourth order weights
+            static constexpr Time e[7] = {Time(71) / 57600, 0, Time(-71) / 16695, Time(71) / 1920,
+                                          Time(-17253) / 339200, Time(22) / 525, Time(-1) / 40};
+
+            for (size_t s = 1; s < 7; ++s)
+            {
+                for (size_t i = 0; i < N; ++i)
+                {
+                    S sum = y[i];
+                    for (size_t j = 0; j < s; ++j)
+                    {
+                        if (a[s][j] != Time(0))
+                        {
+                            sum = sum + (h * a[s][j]) * slope(j)[i];
+                        }
+                    }
+                    (s == 6 ? next : stage)[i] = sum;
+                }
+                f(t + c[s] * h, s == 6 ? next : stage, slope(s));
+            }
+
+            Time error = Time(0);
+            for (size_t i = 0; i < N; ++i)
+            {
+                Time estimate = Time(0);
+                for (size_t j = 0; j < 7; ++j)
+                {
+                    estimate += e[j] * primalValue(slope(j)[i]);
+                }
+                Time scale = options.absoluteTolerance
+                           + options.relativeTolerance * std::max(std::abs(primalValue(y[i])), std::abs(primalValue(next[i])));
+                Time ratio = h * estimate / scale;
+                error += ratio * ratio;
+            }
+            return std::sqrt(error / Time(N));
+        }
+
+        std::array<State, 7> k;
+        std::array<size_t, 7> slots = {0, 1, 2, 3, 4, 5, 6};
+        std::array<State, 2> states;
+        State stage;
+};
+
+#endif
@@ -0,0 +1,273 @@
+#ifndef OPTIMIZE_H
+#define OPTIMIZE_H
+
+#include <algorithm>
+#include "Derivatives.h"
+
+// Unconstrained minimizers for functions written generically over their scalar
+// type (see Derivatives.h). Value and gradient come from a single Duals
+// evaluation, Hessians from nested duals. All working storage is std::array
+// sized at compile time, so the iteration loops never allocate.
+
+template<typename T = double>
+struct OptimizerOptions
+{
+    size_t maxIterations = 1000;
+    T gradientTolerance = T(1e-8);   // converged once ||gradient|| drops below this
+    T initialStep = T(1);            // first step tried by the line search
+    T sufficientDecrease = T(1e-4);  // Armijo constant
+    T backtrackFactor = T(0.5);      // step shrink factor while backtracking
+    size_t maxLineSearchSteps = 60;
+};
+
+template<typename T = double>
+struct OptimizerResult
+{
+    T value = T();
+    T gradientNorm = T();
+    size_t iterations = 0;
+    size_t evaluations = 0;
+    bool converged = false;
+};
+
+// Backtracking line search along direction enforcing the Armijo condition.
+// Every trial is a value + gradient evaluation, so on success x, value and
+// gradient already describe the accepted point and no re-evaluation is needed.
+// step is updated to the accepted step length.
+template<size_t N, typename T, typename Function>
+bool lineSearch(const Function& f, Vector<N, T>& x, T& value, Vector<N, T>& gradient,
+                const Vector<N, T>& direction, T& step, const OptimizerOptions<T>& options,
+                size_t& evaluations)
+{
+    T slope = dot(gradient, direction);
+    if (!(slope < T(0)))
+    {
+        return false;
+    }
+
+    Vector<N, T> trial;
+    Vector<N, T> trialGradient;
+    for (size_t k = 0; k < options.maxLineSearchSteps; ++k)
+    {
+        for (size_t i = 0; i < N; ++i)
+        {
+            trial[i] = x[i] + step * direction[i];
+        }
+        T trialValue = valueAndGradient(f, trial, trialGradient);
+        ++evaluations;
+
+        if (trialValue <= value + options.sufficientDecrease * step * slope)
+        {
+            x = trial;
+            value = trialValue;
+            gradient = trialGradient;
+            return true;
+        }
+        step *= options.backtrackFactor;
+    }
+    return false;
+}
+
+// Steepest descent with backtracking line search
+template<size_t N, typename T, typename Function>
+OptimizerResult<T> gradientDescent(const Function& f, Vector<N, T>& x, const OptimizerOptions<T>& options = {})
+{
+    OptimizerResult<T> result;
+    Vector<N, T> gradient;
+    Vector<N, T> direction;
+    T value = valueAndGradient(f, x, gradient);
+    result.evaluations = 1;
+    T step = options.initialStep;
+
+    for (; result.iterations < options.maxIterations; ++result.iterations)
+    {
+        if (norm(gradient) < options.gradientTolerance)
+        {
+            result.converged = true;
+            break;
+        }
+        for (size_t i = 0; i < N; ++i)
+        {
+            direction[i] = -gradient[i];
+        }
+
+        // Start from a little more than the last accepted step
+        step = std::min(options.initialStep, step * T(2));
+        if (!lineSearch(f, x, value, gradient, direction, step, options, result.evaluations))
+        {
+            break;
+        }
+    }
+
+    result.value = value;
+    result.gradientNorm = norm(gradient);
+    result.converged = result.converged || result.gradientNorm < options.gradientTolerance;
+    return result;
+}
+
+// Limited-memory BFGS keeping the last HISTORY correction pairs in ring buffers
+template<size_t HISTORY = 8, size_t N, typename T, typename Function>
+OptimizerResult<T> lbfgs(const Function& f, Vector<N, T>& x, const OptimizerOptions<T>& options = {})
+{
+    static_assert(HISTORY > 0, "L-BFGS needs at least one correction pair");
+
+    OptimizerResult<T> result;
+    std::array<Vector<N, T>, HISTORY> s;  // position differences
+    std::array<Vector<N, T>, HISTORY> y;  // gradient differences
+    std::array<T, HISTORY> rho;
+    std::array<T, HISTORY> alpha;
+    size_t stored = 0;
+    size_t newest = 0;
+
+    Vector<N, T> gradient;
+    Vector<N, T> direction;
+    Vector<N, T> previousX;
+    Vector<N, T> previousGradient;
+    T value = valueAndGradient(f, x, gradient);
+    result.evaluations = 1;
+
+    for (; result.iterations < options.maxIterations; ++result.iterations)
+    {
+        if (norm(gradient) < options.gradientTolerance)
+        {
+            result.converged = true;
+            break;
+        }
+
+        // Two-loop recursion: direction = -H * gradient
+        direction = gradient;
+        for (size_t k = 0; k < stored; ++k)
+        {
+            size_t j = (newest + HISTORY - k) % HISTORY;
+            alpha[j] = rho[j] * dot(s[j], direction);
+            for (size_t i = 0; i < N; ++i)
+            {
+                direction[i] -= alpha[j] * y[j][i];
+            }
+        }
+        if (stored > 0)
+        {
+            T gamma = dot(s[newest], y[newest]) / dot(y[newest], y[newest]);
+            for (size_t i = 0; i < N; ++i)
+            {
+                direction[i] *= gamma;
+            }
+        }
+        for (size_t k = stored; k-- > 0;)
+        {
+            size_t j = (newest + HISTORY - k) % HISTORY;
+            T beta = rho[j] * dot(y[j], direction);
+            for (size_t i = 0; i < N; ++i)
+            {
+                direction[i] += s[j][i] * (alpha[j] - beta);
+            }
+        }
+        for (size_t i = 0; i < N; ++i)
+        {
+            direction[i] = -direction[i];
+        }
+
+        // Fall back to steepest descent if the curvature history went bad
+        if (!(dot(direction, gradient) < T(0)))
+        {
+            stored = 0;
+            for (size_t i = 0; i < N; ++i)
+            {
+                direction[i] = -gradient[i];
+            }
+        }
+
+        previousX = x;
+        previousGradient = gradient;
+        T step = options.initialStep;
+        if (stored == 0)
+        {
+            // Without curvature information scale the first step to unit length
+            step = std::min(options.initialStep, T(1) / norm(gradient));
+        }
+        if (!lineSearch(f, x, value, gradient, direction, step, options, result.evaluations))
+        {
+            break;
+        }
+
+        // Store the new correction pair, skipping it if curvature is not positive
+        for (size_t i = 0; i < N; ++i)
+        {
+            previousX[i] = x[i] - previousX[i];
+            previousGradient[i] = gradient[i] - previousGradient[i];
+        }
+        T curvature = dot(previousX, previousGradient);
+        if (curvature > T(0))
+        {
+            newest = stored == 0 ? newest : (newest + 1) % HISTORY;
+            s[newest] = previousX;
+            y[newest] = previousGradient;
+            rho[newest] = T(1) / curvature;
+            stored = std::min(stored + 1, HISTORY);
+        }
+    }
+
+    result.value = value;
+    result.gradientNorm = norm(gradient);
+    result.converged = result.converged || result.gradientNorm < options.gradientTolerance;
+    return result;
+}
+
+// Newton's method with the Hessian from nested duals. Indefinite Hessians are
+// shifted by a growing multiple of the identity until Cholesky succeeds; if it
+// never does (e.g. NaNs in the Hessian) the step falls back to steepest descent.
+template<size_t N, typename T, typename Function>
+OptimizerResult<T> newton(const Function& f, Vector<N, T>& x, const OptimizerOptions<T>& options = {})
+{
+    OptimizerResult<T> result;
+    Vector<N, T> gradient = {};
+    Vector<N, T> direction;
+    Matrix<N, T> hessian;
+    Matrix<N, T> factor;
+    T value = T();
+
+    for (; result.iterations < options.maxIterations; ++result.iterations)
+    {
+        value = valueGradientAndHessian(f, x, gradient, hessian);
+        ++result.evaluations;
+        if (norm(gradient) < options.gradientTolerance)
+        {
+            result.converged = true;
+            break;
+        }
+
+        for (size_t i = 0; i < N; ++i)
+        {
+            direction[i] = -gradient[i];
+        }
+
+        T shift = T(0);
+        for (size_t attempt = 0; attempt < 64; ++attempt)
+        {
+            factor = hessian;
+            for (size_t i = 0; i < N; ++i)
+            {
+                factor[i][i] += shift;
+            }
+            if (choleskyFactor(factor))
+            {
+                choleskySolve(factor, direction);
+                break;
+            }
+            shift = shift == T(0) ? T(1e-6) * (T(1) + norm(gradient)) : shift * T(10);
+        }
+
+        T step = options.initialStep;
+        if (!lineSearch(f, x, value, gradient, direction, step, options, result.evaluations))
+        {
+            break;
+        }
+    }
+
+    result.value = value;
+    result.gradientNorm = norm(gradient);
+    result.converged = result.converged || result.gradientNorm < options.gradientTolerance;
+    return result;
+}
+
+#endif
@@ -0,0 +1,190 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Number of threads to use when the caller does not say otherwise
+inline size_t hardwareThreads()
+{
+    size_t count = std::thread::hardware_concurrency();
+    return count == 0 ? 1 : count;
+}
+
+// Splits [0, count) into fixed-size blocks and calls body(begin, end, block)
+// for each of them from up to numThreads threads. The block boundaries depend
+// only on count and blockSize, never on the number of threads, so per-block
+// partial results combined in block order are reproducible bit for bit.
+// The first exception thrown by body is rethrown on the calling thread.
+template<typename Body>
+void parallelBlocks(size_t count, size_t blockSize, size_t numThreads, Body&& body)
+{
+    blockSize = std::max<size_t>(blockSize, 1);
+    size_t numBlocks = (count + blockSize - 1) / blockSize;
+    numThreads = std::max<size_t>(1, std::min(numThreads, numBlocks));
+
+    std::atomic<size_t> nextBlock(0);
+    std::exception_ptr failure;
+    std::mutex failureMutex;
+
+    auto worker = [&]()
+    {
+        try
+        {
+            for (size_t block = nextBlock++; block < numBlocks; block = nextBlock++)
+            {
+                size_t begin = block * blockSize;
+                body(begin, std::min(begin + blockSize, count), block);
+            }
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(failureMutex);
+            if (!failure)
+            {
+                failure = std::current_exception();
+            }
+            nextBlock = numBlocks;
+        }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(numThreads - 1);
+    for (size_t t = 1; t < numThreads; ++t)
+    {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+
+    if (failure)
+    {
+        std::rethrow_exception(failure);
+    }
+}
+
+// Number of blocks parallelBlocks will use for count items
+inline size_t blockCount(size_t count, size_t blockSize)
+{
+    blockSize = std::max<size_t>(blockSize, 1);
+    return (count + blockSize - 1) / blockSize;
+}
+
+// Combines partials[0..count) pairwise in a fixed tree order, leaving the
+// total in partials[0]. combine(into, from) must add from into into.
+template<typename Partial, typename Combine>
+void pairwiseReduce(std::vector<Partial>& partials, size_t count, Combine&& combine)
+{
+    for (size_t stride = 1; stride < count; stride *= 2)
+    {
+        for (size_t i = 0; i + stride < count; i += 2 * stride)
+        {
+            combine(partials[i], partials[i + stride]);
+        }
+    }
+}
+
+
+// Bounded multi-producer multi-consumer queue without locks (Vyukov's ring
+// of sequence-numbered cells). tryPush and tryPop never block; they return
+// false when the queue is full or empty and leave waiting to the caller.
+// The capacity is rounded up to a power of two.
+template<typename T>
+class BoundedQueue
+{
+    public:
+        explicit BoundedQueue(size_t capacity)
+        {
+            size_t size = 2;
+            while (size < capacity)
+            {
+                size *= 2;
+            }
+            cells = std::make_unique<Cell[]>(size);
+            mask = size - 1;
+            for (size_t i = 0; i < size; ++i)
+            {
+                cells[i].sequence.store(i, std::memory_order_relaxed);
+            }
+        }
+
+        bool tryPush(const T& value)
+        {
+            size_t position = tail.load(std::memory_order_relaxed);
+            for (;;)
+            {
+                Cell& cell = cells[position & mask];
+                std::ptrdiff_t difference = std::ptrdiff_t(cell.sequence.load(std::memory_order_acquire) - position);
+                if (difference == 0)
+                {
+                    if (tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                    {
+                        cell.value = value;
+                        cell.sequence.store(position + 1, std::memory_order_release);
+                        return true;
+                    }
+                }
+                else if (difference < 0)
+                {
+                    return false;
+                }
+                else
+                {
+                    position = tail.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        bool tryPop(T& value)
+        {
+            size_t position = head.load(std::memory_order_relaxed);
+            for (;;)
+            {
+                Cell& cell = cells[position & mask];
+                std::ptrdiff_t difference = std::ptrdiff_t(cell.sequence.load(std::memory_order_acquire) - (position + 1));
+                if (difference == 0)
+                {
+                    if (head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                    {
+                        value = std::move(cell.value);
+                        cell.sequence.store(position + mask + 1, std::memory_order_release);
+                        return true;
+                    }
+                }
+                else if (difference < 0)
+                {
+                    return false;
+                }
+                else
+                {
+                    position = head.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        size_t capacity() const { return mask + 1; }
+
+    private:
+        struct Cell
+        {
+            std::atomic<size_t> sequence;
+            T value;
+        };
+
+        std::unique_ptr<Cell[]> cells;
+        size_t mask = 0;
+        // Producers and consumers each get their own cache line
+        alignas(64) std::atomic<size_t> tail{0};
+        alignas(64) std::atomic<size_t> head{0};
+};
+
+#endif
@@ -0,0 +1,283 @@
+#ifndef REDUCTION_H
+#define REDUCTION_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+#include "Duals.h"
+#include "Parallel.h"
+
+// Accumulating Duals-valued contributions from many threads into one
+// gradient array of `size` entries:
+//
+//     auto contribute = [&](size_t k, auto& sink) { sink.add(edge[k].a, term(k)); sink.add(edge[k].b, -term(k)); };
+//     std::vector<Duals<4, double>> total = reduceGradient<4, double>(edges.size(), nodes, contribute);
+//
+// contribute(k, sink) is called once for every item k in [0, count) and adds
+// into the sink with sink.add(index, value). How the sums are formed is
+// chosen with ReductionOptions::mode:
+//
+//   Deterministic  items are cut into fixed blocks, each summed into its own
+//                  dense partial, and the partials are combined pairwise in
+//                  block order. The block boundaries depend only on count and
+//                  blockSize, so the result is bitwise reproducible for any
+//                  numThreads (including 1), as long as contribute itself is.
+//   ThreadLocal    each thread sums into one dense buffer of its own and the
+//                  buffers are added at the end. Fewer partials than
+//                  Deterministic, but which items share a buffer depends on
+//                  scheduling, so the last bits can change from run to run.
+//   Atomic         every contribution is added straight into one shared array
+//                  with a compare-and-swap per scalar; no buffers at all,
+//                  which suits sparse updates to a large gradient. The order
+//                  of the additions, and so the rounding, is not fixed.
+//
+// Thread safety: a Duals is a plain value with no shared state, so distinct
+// objects may be used from different threads freely and one object may be
+// read concurrently; concurrent writes to the same object (or gradient
+// entry) need one of the accumulators below.
+
+enum class ReductionMode
+{
+    Deterministic,
+    ThreadLocal,
+    Atomic
+};
+
+struct ReductionOptions
+{
+    ReductionMode mode = ReductionMode::Deterministic;
+    size_t numThreads = hardwareThreads();
+    size_t blockSize = 1024;        // items per partial; fixes the deterministic order
+    size_t blocksPerWave = 64;      // dense partials alive at once in Deterministic mode
+};
+
+// Dense gradient that one thread adds into
+template<size_t N, typename T>
+class DenseGradientSink
+{
+    public:
+        explicit DenseGradientSink(std::vector<Duals<N, T>>& gradient) : entries(gradient) {}
+
+        void add(size_t index, const Duals<N, T>& value)
+        {
+            entries[index] = entries[index] + value;
+        }
+
+    private:
+        std::vector<Duals<N, T>>& entries;
+};
+
+// One dense buffer per thread that touches the accumulator, created on that
+// thread's first call to local(); combine() adds the buffers together
+template<size_t N, typename T>
+class ThreadLocalAccumulator
+{
+    public:
+        explicit ThreadLocalAccumulator(size_t entries) : size(entries), id(nextId()) {}
+
+        // The calling thread's buffer; only that thread may write to it
+        std::vector<Duals<N, T>>& local()
+        {
+            thread_local uint64_t cachedId = 0;
+            thread_local std::vector<Duals<N, T>>* cachedBuffer = nullptr;
+            if (cachedId != id)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                std::unique_ptr<std::vector<Duals<N, T>>>& buffer = buffers[std::this_thread::get_id()];
+                if (!buffer)
+                {
+                    buffer = std::make_unique<std::vector<Duals<N, T>>>(size);
+                    order.push_back(buffer.get());
+                }
+                cachedId = id;
+                cachedBuffer = buffer.get();
+            }
+            return *cachedBuffer;
+        }
+
+        void add(size_t index, const Duals<N, T>& value)
+        {
+            std::vector<Duals<N, T>>& buffer = local();
+            buffer[index] = buffer[index] + value;
+        }
+
+        // Sum of all buffers; call once the writing threads are done
+        std::vector<Duals<N, T>> combine() const
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            std::vector<Duals<N, T>> total(size);
+            for (const std::vector<Duals<N, T>>* buffer : order)
+            {
+                for (size_t i = 0; i < size; ++i)
+                {
+                    total[i] = total[i] + (*buffer)[i];
+                }
+            }
+            return total;
+        }
+
+        size_t getBufferCount() const
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            return order.size();
+        }
+
+    private:
+        // Ids are never reused, so a thread's cached buffer cannot outlive its owner unnoticed
+        static uint64_t nextId()
+        {
+            static std::atomic<uint64_t> counter(0);
+            return ++counter;
+        }
+
+        size_t size;
+        uint64_t id;
+        mutable std::mutex mutex;
+        std::unordered_map<std::thread::id, std::unique_ptr<std::vector<Duals<N, T>>>> buffers;
+        std::vector<const std::vector<Duals<N, T>>*> order;
+};
+
+// Shared gradient array updated with lock-free atomic adds, one
+// compare-and-swap loop per touched scalar. Zero derivative lanes are skipped,
+// so sparse seeds cost only the lanes they actually carry.
+template<size_t N, typename T>
+class AtomicAccumulator
+{
+    static_assert(std::is_floating_point_v<T>, "AtomicAccumulator needs a plain floating point scalar");
+
+    public:
+        explicit AtomicAccumulator(size_t entries)
+            : size(entries), scalars(std::make_unique<std::atomic<T>[]>(entries * (N + 1)))
+        {
+            for (size_t i = 0; i < size * (N + 1); ++i)
+            {
+                scalars[i].store(T(0), std::memory_order_relaxed);
+            }
+        }
+
+        void add(size_t index, const Duals<N, T>& value)
+        {
+            std::atomic<T>* entry = &scalars[index * (N + 1)];
+            addScalar(entry[0], value.getValue());
+            for (size_t i = 0; i < N; ++i)
+            {
+                T lane = value.getDerivative(i);
+                if (lane != T(0))
+                {
+                    addScalar(entry[i + 1], lane);
+                }
+            }
+        }
+
+        Duals<N, T> get(size_t index) const
+        {
+            const std::atomic<T>* entry = &scalars[index * (N + 1)];
+            Duals<N, T> result(dualsUninitialized);
+            result.setValue(entry[0].load(std::memory_order_relaxed));
+            for (size_t i = 0; i < N; ++i)
+            {
+                result.setDerivative(i, entry[i + 1].load(std::memory_order_relaxed));
+            }
+            return result;
+        }
+
+        std::vector<Duals<N, T>> values() const
+        {
+            std::vector<Duals<N, T>> result(size);
+            for (size_t i = 0; i < size; ++i)
+            {
+                result[i] = get(i);
+            }
+            return result;
+        }
+
+    private:
+        static void addScalar(std::atomic<T>& target, T amount)
+        {
+            T current = target.load(std::memory_order_relaxed);
+            while (!target.compare_exchange_weak(current, current + amount, std::memory_order_relaxed))
+            {
+            }
+        }
+
+        size_t size;
+        std::unique_ptr<std::atomic<T>[]> scalars;
+};
+
+// Sums contribute(k, sink) over k in [0, count) into a gradient of size
+// entries, using the mode in options (see the top of this file)
+template<size_t N, typename T, typename Contribute>
+std::vector<Duals<N, T>> reduceGradient(size_t count, size_t size, const Contribute& contribute,
+                                        const ReductionOptions& options = {})
+{
+    if (options.mode == ReductionMode::ThreadLocal)
+    {
+        ThreadLocalAccumulator<N, T> accumulator(size);
+        parallelBlocks(count, options.blockSize, options.numThreads, [&](size_t begin, size_t end, size_t)
+        {
+            DenseGradientSink<N, T> sink(accumulator.local());
+            for (size_t k = begin; k < end; ++k)
+            {
+                contribute(k, sink);
+            }
+        });
+        return accumulator.combine();
+    }
+
+    if (options.mode == ReductionMode::Atomic)
+    {
+        AtomicAccumulator<N, T> accumulator(size);
+        parallelBlocks(count, options.blockSize, options.numThreads, [&](size_t begin, size_t end, size_t)
+        {
+            for (size_t k = begin; k < end; ++k)
+            {
+                contribute(k, accumulator);
+            }
+        });
+        return accumulator.values();
+    }
+
+    // Deterministic: waves of blocksPerWave blocks bound the memory; each wave
+    // is reduced pairwise and the wave totals are added in wave order
+    size_t blockSize = std::max<size_t>(options.blockSize, 1);
+    size_t waveItems = blockSize * std::max<size_t>(options.blocksPerWave, 1);
+    std::vector<Duals<N, T>> total(size);
+    std::vector<std::vector<Duals<N, T>>> partials;
+    for (size_t waveBegin = 0; waveBegin < count; waveBegin += waveItems)
+    {
+        size_t waveCount = std::min(waveItems, count - waveBegin);
+        size_t numBlocks = blockCount(waveCount, blockSize);
+        partials.resize(std::max(partials.size(), numBlocks));
+        parallelBlocks(waveCount, blockSize, options.numThreads, [&](size_t begin, size_t end, size_t block)
+        {
+            std::vector<Duals<N, T>>& partial = partials[block];
+            partial.assign(size, Duals<N, T>());
+            DenseGradientSink<N, T> sink(partial);
+            for (size_t k = begin; k < end; ++k)
+            {
+                contribute(waveBegin + k, sink);
+            }
+        });
+
+        pairwiseReduce(partials, numBlocks, [size](std::vector<Duals<N, T>>& into, const std::vector<Duals<N, T>>& from)
+        {
+            for (size_t i = 0; i < size; ++i)
+            {
+                into[i] = into[i] + from[i];
+            }
+        });
+        for (size_t i = 0; i < size; ++i)
+        {
+            total[i] = total[i] + partials[0][i];
+        }
+    }
+    return total;
+}
+
+#endif
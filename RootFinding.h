@@ -0,0 +1,226 @@
+#ifndef ROOT_FINDING_H
+#define ROOT_FINDING_H
+
+#include <stdexcept>
+#include <type_traits>
+#include "Derivatives.h"
+
+// Newton-Raphson for square systems f(x) = 0 where f is written generically
+// over its scalar type, taking const std::array<S, N>& and returning
+// std::array<S, N>. The Jacobian comes from Duals (see valueAndJacobian).
+
+template<typename T = double>
+struct RootOptions
+{
+    size_t maxIterations = 50;
+    T residualTolerance = T(1e-12);  // converged once max |f(x)| drops below this
+    T stepTolerance = T(1e-14);      // converged once the step is this small relative to x
+    T reuseRatio = T(0.5);           // keep the LU factors while each step shrinks |f| at least this much
+};
+
+template<typename T = double>
+struct RootResult
+{
+    T residualNorm = T();
+    size_t iterations = 0;
+    size_t jacobianEvaluations = 0;
+    size_t functionEvaluations = 0;  // plain evaluations of f, besides the Jacobian passes
+    bool converged = false;
+};
+
+template<size_t N, typename T>
+T maxNorm(const Vector<N, T>& v)
+{
+    T largest = T(0);
+    for (const T& value : v)
+    {
+        largest = std::max(largest, std::abs(value));
+    }
+    return largest;
+}
+
+// Solves f(x) = 0 starting from x. The Jacobian is only re-evaluated and
+// re-factored when the previous step failed to reduce the residual by
+// reuseRatio; otherwise the old LU factors are reused (a chord step), which
+// costs one plain evaluation of f instead of a Duals pass plus a factorization.
+// The first Jacobian pass also yields f at the start, and a refresh keeps the
+// residual already known at x, so f is never evaluated twice at one point.
+template<size_t CHUNK = 0, size_t N, typename T, typename Function>
+RootResult<T> newtonSolve(const Function& f, Vector<N, T>& x, const RootOptions<T>& options = {})
+{
+    RootResult<T> result;
+    Vector<N, T> residual;
+    Vector<N, T> step;
+    Matrix<N, T> lu;
+    std::array<size_t, N> pivots;
+    valueAndJacobian<CHUNK>(f, x, residual, lu);
+    ++result.jacobianEvaluations;
+    bool factor = true;     // lu holds a Jacobian that is not factored yet
+    bool refresh = false;
+
+    for (; result.iterations < options.maxIterations; ++result.iterations)
+    {
+        T residualNorm = maxNorm(residual);
+        if (residualNorm < options.residualTolerance)
+        {
+            result.converged = true;
+            break;
+        }
+
+        if (refresh)
+        {
+            // The residual at x is already known; only the Jacobian is new
+            Vector<N, T> sameResidual;
+            valueAndJacobian<CHUNK>(f, x, sameResidual, lu);
+            ++result.jacobianEvaluations;
+            factor = true;
+        }
+        if (factor)
+        {
+            if (!luFactor(lu, pivots))
+            {
+                break;
+            }
+            factor = false;
+        }
+
+        for (size_t i = 0; i < N; ++i)
+        {
+            step[i] = -residual[i];
+        }
+        luSolve(lu, pivots, step);
+        for (size_t i = 0; i < N; ++i)
+        {
+            x[i] += step[i];
+        }
+
+        residual = f(x);
+        ++result.functionEvaluations;
+        refresh = !(maxNorm(residual) <= options.reuseRatio * residualNorm);
+
+        if (maxNorm(step) <= options.stepTolerance * (maxNorm(x) + options.stepTolerance))
+        {
+            result.converged = true;
+            ++result.iterations;
+            break;
+        }
+    }
+
+    result.residualNorm = maxNorm(residual);
+    result.converged = result.converged || result.residualNorm < options.residualTolerance;
+    return result;
+}
+
+// Implicit function theorem for a root x(p) of f(x, p) = 0, where f takes
+// (const std::array<S, N>& x, const std::array<S, P>& p) and returns
+// std::array<S, N>. Given a converged root, writes dx/dp = -(df/dx)^-1 df/dp
+// without differentiating through the iterations that found it.
+// Returns false if df/dx is singular at the root.
+template<size_t N, size_t P, typename T, typename Function>
+bool implicitDerivative(const Function& f, const Vector<N, T>& x, const Vector<P, T>& p, RectMatrix<N, P, T>& dxdp)
+{
+    Vector<N, T> value;
+    Matrix<N, T> lu;
+    RectMatrix<N, P, T> dfdp;
+    std::array<size_t, N> pivots;
+
+    // df/dx with p held constant
+    auto inX = [&](const auto& xs)
+    {
+        using S = typename std::decay_t<decltype(xs)>::value_type;
+        std::array<S, P> constants;
+        for (size_t k = 0; k < P; ++k)
+        {
+            constants[k] = S(p[k]);
+        }
+        return f(xs, constants);
+    };
+    valueAndJacobian(inX, x, value, lu);
+
+    // df/dp with x held constant
+    auto inP = [&](const auto& ps)
+    {
+        using S = typename std::decay_t<decltype(ps)>::value_type;
+        std::array<S, N> constants;
+        for (size_t i = 0; i < N; ++i)
+        {
+            constants[i] = S(x[i]);
+        }
+        return f(constants, ps);
+    };
+    valueAndJacobian(inP, p, value, dfdp);
+
+    if (!luFactor(lu, pivots))
+    {
+        return false;
+    }
+
+    Vector<N, T> column;
+    for (size_t k = 0; k < P; ++k)
+    {
+        for (size_t i = 0; i < N; ++i)
+        {
+            column[i] = -dfdp[i][k];
+        }
+        luSolve(lu, pivots, column);
+        for (size_t i = 0; i < N; ++i)
+        {
+            dxdp[i][k] = column[i];
+        }
+    }
+    return true;
+}
+
+// Solves f(x, p) = 0 for x when the parameters are themselves duals, and
+// returns x as duals carrying dx/dp times the derivative lanes of p. The
+// iteration runs on plain values; derivatives come from implicitDerivative.
+template<size_t CHUNK = 0, size_t N, size_t P, size_t LANES, typename T, typename Function>
+std::array<Duals<LANES, T>, N> solveImplicit(const Function& f, Vector<N, T>& x, const std::array<Duals<LANES, T>, P>& p,
+                                             const RootOptions<T>& options = {})
+{
+    Vector<P, T> values;
+    for (size_t k = 0; k < P; ++k)
+    {
+        values[k] = p[k].getValue();
+    }
+
+    auto atValues = [&](const auto& xs)
+    {
+        using S = typename std::decay_t<decltype(xs)>::value_type;
+        std::array<S, P> constants;
+        for (size_t k = 0; k < P; ++k)
+        {
+            constants[k] = S(values[k]);
+        }
+        return f(xs, constants);
+    };
+    RootResult<T> result = newtonSolve<CHUNK>(atValues, x, options);
+    if (!result.converged)
+    {
+        throw std::runtime_error("Newton iteration did not converge");
+    }
+
+    RectMatrix<N, P, T> dxdp;
+    if (!implicitDerivative(f, x, values, dxdp))
+    {
+        throw std::runtime_error("Jacobian is singular at the root");
+    }
+
+    std::array<Duals<LANES, T>, N> root;
+    for (size_t i = 0; i < N; ++i)
+    {
+        root[i].setValue(x[i]);
+        for (size_t lane = 0; lane < LANES; ++lane)
+        {
+            T sum = T(0);
+            for (size_t k = 0; k < P; ++k)
+            {
+                sum += dxdp[i][k] * p[k].getDerivative(lane);
+            }
+            root[i].setDerivative(lane, sum);
+        }
+    }
+    return root;
+}
+
+#endif
@@ -0,0 +1,304 @@
+#ifndef SPARSE_H
+#define SPARSE_H
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include "Duals.h"
+#include "DualsPattern.h"
+#include "LinearAlgebra.h"
+
+// Sparse Jacobians by column coloring (Curtis-Powell-Reid compression):
+//
+//     SparsityPattern pattern = SparsityPattern::fromEntries(M, N, entries);   // (row, column) pairs
+//     SparsityPattern pattern = jacobianPattern(residual, x);                  // or detected from f
+//     ColumnColoring coloring = colorColumns(pattern);
+//     CsrMatrix<double> jacobian = sparseJacobian<8>(residual, x, pattern, coloring, value);
+//
+// Two columns that share no row can be seeded in the same Duals lane: every
+// output row then sees at most one of them, so its derivative in that lane is
+// that column's entry alone. colorColumns gives every column a color such
+// that columns sharing a row differ (a distance-2 coloring of the bipartite
+// row/column graph), and sparseJacobian seeds one lane per color. A banded
+// or finite-element Jacobian with N columns needs only as many colors as the
+// widest row has entries, so the forward passes drop from N / LANES to
+// colors / LANES. The pattern must cover every entry that can be nonzero;
+// an entry missing from it corrupts the entries that share its color.
+
+// Which entries of a rows x cols matrix may be nonzero, row by row (CSR
+// without values); the columns of a row are sorted
+struct SparsityPattern
+{
+    size_t rows = 0;
+    size_t cols = 0;
+    std::vector<size_t> rowStart = {0};     // rows + 1 offsets into columns
+    std::vector<size_t> columns;
+
+    // Builds the pattern from (row, column) pairs in any order, duplicates allowed
+    static SparsityPattern fromEntries(size_t rows, size_t cols, std::vector<std::pair<size_t, size_t>> entries)
+    {
+        std::sort(entries.begin(), entries.end());
+        entries.erase(std::unique(entries.begin(), entries.end()), entries.end());
+
+        SparsityPattern pattern;
+        pattern.rows = rows;
+        pattern.cols = cols;
+        pattern.rowStart.assign(rows + 1, 0);
+        for (const std::pair<size_t, size_t>& entry : entries)
+        {
+            if (entry.first >= rows || entry.second >= cols)
+            {
+                throw std::runtime_error("Sparsity pattern entry lies outside the matrix");
+            }
+            ++pattern.rowStart[entry.first + 1];
+            pattern.columns.push_back(entry.second);
+        }
+        for (size_t row = 0; row < rows; ++row)
+        {
+            pattern.rowStart[row + 1] += pattern.rowStart[row];
+        }
+        return pattern;
+    }
+
+    size_t nonZeros() const { return columns.size(); }
+
+    bool contains(size_t row, size_t column) const
+    {
+        return std::binary_search(columns.begin() + rowStart[row], columns.begin() + rowStart[row + 1], column);
+    }
+};
+
+// Compressed sparse row matrix
+template<typename T>
+struct CsrMatrix
+{
+    size_t rows = 0;
+    size_t cols = 0;
+    std::vector<size_t> rowStart = {0};     // rows + 1 offsets into columns and values
+    std::vector<size_t> columns;
+    std::vector<T> values;
+
+    // Entry at (row, column), zero where the pattern has none
+    T at(size_t row, size_t column) const
+    {
+        auto first = columns.begin() + rowStart[row];
+        auto last = columns.begin() + rowStart[row + 1];
+        auto found = std::lower_bound(first, last, column);
+        return found != last && *found == column ? values[found - columns.begin()] : T(0);
+    }
+};
+
+// Compressed sparse column matrix
+template<typename T>
+struct CscMatrix
+{
+    size_t rows = 0;
+    size_t cols = 0;
+    std::vector<size_t> colStart = {0};     // cols + 1 offsets into rowIndices and values
+    std::vector<size_t> rowIndices;
+    std::vector<T> values;
+};
+
+// The same entries stored column by column, rows sorted within each column
+template<typename T>
+CscMatrix<T> toCsc(const CsrMatrix<T>& csr)
+{
+    CscMatrix<T> csc;
+    csc.rows = csr.rows;
+    csc.cols = csr.cols;
+    csc.colStart.assign(csr.cols + 1, 0);
+    csc.rowIndices.resize(csr.columns.size());
+    csc.values.resize(csr.values.size());
+    for (size_t column : csr.columns)
+    {
+        ++csc.colStart[column + 1];
+    }
+    for (size_t column = 0; column < csr.cols; ++column)
+    {
+        csc.colStart[column + 1] += csc.colStart[column];
+    }
+    std::vector<size_t> next(csc.colStart.begin(), csc.colStart.end() - 1);
+    for (size_t row = 0; row < csr.rows; ++row)
+    {
+        for (size_t k = csr.rowStart[row]; k < csr.rowStart[row + 1]; ++k)
+        {
+            size_t slot = next[csr.columns[k]]++;
+            csc.rowIndices[slot] = row;
+            csc.values[slot] = csr.values[k];
+        }
+    }
+    return csc;
+}
+
+struct ColumnColoring
+{
+    size_t colors = 0;
+    std::vector<size_t> color;      // color of every column, in [0, colors)
+};
+
+// Greedy distance-2 column coloring: columns are visited by decreasing number
+// of entries (largest first) and each takes the smallest color not used by a
+// column it shares a row with. Needs at least as many colors as the widest row.
+inline ColumnColoring colorColumns(const SparsityPattern& pattern)
+{
+    // Rows of every column, i.e. the pattern transposed
+    std::vector<size_t> colStart(pattern.cols + 1, 0);
+    for (size_t column : pattern.columns)
+    {
+        ++colStart[column + 1];
+    }
+    for (size_t column = 0; column < pattern.cols; ++column)
+    {
+        colStart[column + 1] += colStart[column];
+    }
+    std::vector<size_t> rowsOfColumn(pattern.columns.size());
+    std::vector<size_t> next(colStart.begin(), colStart.end() - 1);
+    for (size_t row = 0; row < pattern.rows; ++row)
+    {
+        for (size_t k = pattern.rowStart[row]; k < pattern.rowStart[row + 1]; ++k)
+        {
+            rowsOfColumn[next[pattern.columns[k]]++] = row;
+        }
+    }
+
+    std::vector<size_t> order(pattern.cols);
+    for (size_t column = 0; column < pattern.cols; ++column)
+    {
+        order[column] = column;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b)
+    {
+        return colStart[a + 1] - colStart[a] > colStart[b + 1] - colStart[b];
+    });
+
+    const size_t uncolored = pattern.cols;
+    ColumnColoring coloring;
+    coloring.color.assign(pattern.cols, uncolored);
+    // forbidden[c] == column marks color c as taken by a neighbour of column
+    std::vector<size_t> forbidden(pattern.cols + 1, uncolored);
+    for (size_t column : order)
+    {
+        for (size_t k = colStart[column]; k < colStart[column + 1]; ++k)
+        {
+            size_t row = rowsOfColumn[k];
+            for (size_t m = pattern.rowStart[row]; m < pattern.rowStart[row + 1]; ++m)
+            {
+                size_t neighbour = coloring.color[pattern.columns[m]];
+                if (neighbour != uncolored)
+                {
+                    forbidden[neighbour] = column;
+                }
+            }
+        }
+        size_t color = 0;
+        while (forbidden[color] == column)
+        {
+            ++color;
+        }
+        coloring.color[column] = color;
+        coloring.colors = std::max(coloring.colors, color + 1);
+    }
+    return coloring;
+}
+
+// Evaluates a vector function f: R^N -> R^M and its Jacobian on the given
+// pattern, writing f(x) to value. Each forward pass seeds LANES colors with
+// Duals<LANES, T>, so the Jacobian takes ceil(coloring.colors / LANES) passes.
+template<size_t LANES, size_t N, size_t M, typename T, typename Function>
+CsrMatrix<T> sparseJacobian(const Function& f, const Vector<N, T>& x, const SparsityPattern& pattern,
+                            const ColumnColoring& coloring, Vector<M, T>& value)
+{
+    static_assert(LANES > 0, "Sparse Jacobians need at least one lane");
+    if (pattern.rows != M || pattern.cols != N || coloring.color.size() != N)
+    {
+        throw std::runtime_error("Sparsity pattern does not match the function's dimensions");
+    }
+
+    CsrMatrix<T> jacobian;
+    jacobian.rows = M;
+    jacobian.cols = N;
+    jacobian.rowStart = pattern.rowStart;
+    jacobian.columns = pattern.columns;
+    jacobian.values.assign(pattern.nonZeros(), T(0));
+
+    std::array<Duals<LANES, T>, N> seeded;
+    for (size_t first = 0; first < std::max<size_t>(coloring.colors, 1); first += LANES)
+    {
+        for (size_t i = 0; i < N; ++i)
+        {
+            size_t color = coloring.color[i];
+            seeded[i] = Duals<LANES, T>(x[i]);
+            if (color >= first && color < first + LANES)
+            {
+                seeded[i].setDerivative(color - first, T(1));
+            }
+        }
+
+        std::array<Duals<LANES, T>, M> y = f(seeded);
+        for (size_t row = 0; row < M; ++row)
+        {
+            value[row] = y[row].getValue();
+            for (size_t k = pattern.rowStart[row]; k < pattern.rowStart[row + 1]; ++k)
+            {
+                size_t color = coloring.color[pattern.columns[k]];
+                if (color >= first && color < first + LANES)
+                {
+                    jacobian.values[k] = y[row].getDerivative(color - first);
+                }
+            }
+        }
+    }
+    return jacobian;
+}
+
+// The same, coloring the pattern first
+template<size_t LANES, size_t N, size_t M, typename T, typename Function>
+CsrMatrix<T> sparseJacobian(const Function& f, const Vector<N, T>& x, const SparsityPattern& pattern, Vector<M, T>& value)
+{
+    return sparseJacobian<LANES>(f, x, pattern, colorColumns(pattern), value);
+}
+
+// Which outputs of f: R^N -> R^M depend on which inputs, from one evaluation
+// with DualsPattern. Branches are taken as at x, so code that switches
+// between formulas on the inputs should be traced at a representative point
+// or written with select, which keeps both sides.
+template<size_t N, typename T, typename Function>
+SparsityPattern jacobianPattern(const Function& f, const Vector<N, T>& x)
+{
+    std::array<DualsPattern<N, T>, N> seeded;
+    for (size_t i = 0; i < N; ++i)
+    {
+        seeded[i] = DualsPattern<N, T>(x[i]);
+        seeded[i].setDependency(i);
+    }
+
+    auto y = f(seeded);
+    SparsityPattern pattern;
+    pattern.rows = y.size();
+    pattern.cols = N;
+    for (const DualsPattern<N, T>& row : y)
+    {
+        for (size_t w = 0; w < DualsPattern<N, T>::WORDS; ++w)
+        {
+            // Visit only the set bits of each word
+            for (uint64_t bits = row.getMask()[w]; bits != 0; bits &= bits - 1)
+            {
+                pattern.columns.push_back(w * 64 + size_t(std::countr_zero(bits)));
+            }
+        }
+        pattern.rowStart.push_back(pattern.columns.size());
+    }
+    return pattern;
+}
+
+// The same, detecting the pattern at x first
+template<size_t LANES, size_t N, size_t M, typename T, typename Function>
+CsrMatrix<T> sparseJacobian(const Function& f, const Vector<N, T>& x, Vector<M, T>& value)
+{
+    return sparseJacobian<LANES>(f, x, jacobianPattern(f, x), value);
+}
+
+#endif
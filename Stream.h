@@ -0,0 +1,314 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <fstream>
+#include <istream>
+#include <limits>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Derivatives.h"
+#include "Parallel.h"
+
+// Streaming value + gradient evaluation over datasets too large to load:
+//
+//     StreamStats stats = streamGradients<2, double>(Rosenbrock(), "points.bin", "gradients.bin");
+//
+// The input is a flat binary file of native T, K per point; for every point
+// the output gets f(x) followed by its K gradient entries, in input order.
+// A reader thread fills chunks with buffered reads, worker threads evaluate
+// them with Duals<K, T>, and the calling thread writes them out. The stages
+// pass chunks through lock-free bounded queues, and a fixed set of chunks
+// is recycled from the writer back to the reader, so I/O and compute overlap
+// and memory stays at chunksInFlight chunks however large the input is.
+// A stage that finds its queue empty or full sleeps on the queue's change
+// counter (std::atomic::wait) instead of spinning, so workers waiting on a
+// slow reader leave the cores to it.
+// The first exception from any stage (including f) stops the pipeline and is
+// rethrown on the calling thread; output already written is left in place.
+
+struct StreamOptions
+{
+    size_t chunkPoints = 16384;          // points per chunk
+    size_t numThreads = hardwareThreads();
+    size_t chunksInFlight = 0;           // chunks allocated in total; 0 picks 2 per thread plus 2
+};
+
+struct StreamStats
+{
+    size_t points = 0;
+    size_t chunks = 0;
+};
+
+template<size_t K, typename T, typename Function>
+class GradientStream
+{
+    public:
+        GradientStream(const Function& function, std::istream& in, std::ostream& out, const StreamOptions& streamOptions)
+            : f(function), input(in), output(out), options(streamOptions)
+        {
+            options.chunkPoints = std::max<size_t>(options.chunkPoints, 1);
+            options.numThreads = std::max<size_t>(options.numThreads, 1);
+            if (options.chunksInFlight == 0)
+            {
+                options.chunksInFlight = 2 * options.numThreads + 2;
+            }
+        }
+
+        StreamStats run()
+        {
+            std::vector<Chunk> chunks(options.chunksInFlight);
+            BoundedQueue<Chunk*> idle(chunks.size());
+            BoundedQueue<Chunk*> work(chunks.size() + options.numThreads);
+            BoundedQueue<Chunk*> done(chunks.size());
+            for (Chunk& chunk : chunks)
+            {
+                chunk.inputs.resize(options.chunkPoints * K);
+                chunk.outputs.resize(options.chunkPoints * (K + 1));
+                idle.tryPush(&chunk);
+            }
+            // Indexed by chunk number modulo the number of chunks, which
+            // cannot collide since that many chunks exist in total
+            std::vector<Chunk*> pending(chunks.size(), nullptr);
+
+            std::vector<std::thread> threads;
+            threads.emplace_back([&]() { guard([&]() { read(idle, work); }); });
+            for (size_t t = 0; t < options.numThreads; ++t)
+            {
+                threads.emplace_back([&]() { guard([&]() { evaluate(work, done); }); });
+            }
+            guard([&]() { write(idle, done, pending); });
+            for (std::thread& thread : threads)
+            {
+                thread.join();
+            }
+
+            if (failure)
+            {
+                std::rethrow_exception(failure);
+            }
+            return stats;
+        }
+
+    private:
+        struct Chunk
+        {
+            size_t index = 0;
+            size_t points = 0;
+            std::vector<T> inputs;
+            std::vector<T> outputs;
+        };
+
+        // Runs a stage, recording its exception and stopping the others
+        template<typename Stage>
+        void guard(const Stage& stage)
+        {
+            try
+            {
+                stage();
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(failureMutex);
+                if (!failure)
+                {
+                    failure = std::current_exception();
+                }
+                failed = true;
+                idleChanged.notify();
+                workChanged.notify();
+                doneChanged.notify();
+            }
+        }
+
+        // Bumped after every push or pop on one queue, so stages blocked on
+        // that queue wake and try again
+        struct Signal
+        {
+            std::atomic<uint32_t> changes{0};
+
+            void notify()
+            {
+                changes.fetch_add(1, std::memory_order_release);
+                changes.notify_all();
+            }
+        };
+
+        // Waits for a queue operation, giving up once another stage has failed.
+        // The counter is read before each attempt, so a change made after a
+        // failed attempt always ends the wait.
+        template<typename Operation>
+        bool retry(Signal& signal, const Operation& operation)
+        {
+            for (;;)
+            {
+                uint32_t seen = signal.changes.load(std::memory_order_acquire);
+                if (operation())
+                {
+                    signal.notify();
+                    return true;
+                }
+                if (failed.load(std::memory_order_relaxed))
+                {
+                    return false;
+                }
+                signal.changes.wait(seen, std::memory_order_acquire);
+            }
+        }
+
+        void read(BoundedQueue<Chunk*>& idle, BoundedQueue<Chunk*>& work)
+        {
+            size_t count = 0;
+            for (;;)
+            {
+                Chunk* chunk = nullptr;
+                if (!retry(idleChanged, [&]() { return idle.tryPop(chunk); }))
+                {
+                    return;
+                }
+                input.read(reinterpret_cast<char*>(chunk->inputs.data()), std::streamsize(chunk->inputs.size() * sizeof(T)));
+                size_t bytes = size_t(input.gcount());
+                if (bytes % (K * sizeof(T)) != 0)
+                {
+                    throw std::runtime_error("Stream input is not a whole number of points");
+                }
+                if (bytes == 0)
+                {
+                    break;
+                }
+                chunk->index = count++;
+                chunk->points = bytes / (K * sizeof(T));
+                if (!retry(workChanged, [&]() { return work.tryPush(chunk); }))
+                {
+                    return;
+                }
+                if (!input)
+                {
+                    break;
+                }
+            }
+            if (input.bad())
+            {
+                throw std::runtime_error("Failed reading stream input");
+            }
+
+            totalChunks.store(count, std::memory_order_release);
+            doneChanged.notify();
+            for (size_t t = 0; t < options.numThreads; ++t)
+            {
+                Chunk* stop = nullptr;
+                if (!retry(workChanged, [&]() { return work.tryPush(stop); }))
+                {
+                    return;
+                }
+            }
+        }
+
+        void evaluate(BoundedQueue<Chunk*>& work, BoundedQueue<Chunk*>& done)
+        {
+            for (;;)
+            {
+                Chunk* chunk = nullptr;
+                if (!retry(workChanged, [&]() { return work.tryPop(chunk); }) || chunk == nullptr)
+                {
+                    return;
+                }
+                for (size_t p = 0; p < chunk->points && !failed.load(std::memory_order_relaxed); ++p)
+                {
+                    Vector<K, T> x;
+                    std::copy_n(chunk->inputs.data() + p * K, K, x.begin());
+                    Vector<K, T> gradient;
+                    T* out = chunk->outputs.data() + p * (K + 1);
+                    out[0] = valueAndGradient(f, x, gradient);
+                    std::copy(gradient.begin(), gradient.end(), out + 1);
+                }
+                if (!retry(doneChanged, [&]() { return done.tryPush(chunk); }))
+                {
+                    return;
+                }
+            }
+        }
+
+        void write(BoundedQueue<Chunk*>& idle, BoundedQueue<Chunk*>& done, std::vector<Chunk*>& pending)
+        {
+            size_t next = 0;
+            while (next < totalChunks.load(std::memory_order_acquire) && !failed.load(std::memory_order_relaxed))
+            {
+                Chunk* chunk = nullptr;
+                if (!retry(doneChanged, [&]() { return done.tryPop(chunk) || next >= totalChunks.load(std::memory_order_acquire); }))
+                {
+                    return;
+                }
+                if (chunk == nullptr)
+                {
+                    break;
+                }
+                pending[chunk->index % pending.size()] = chunk;
+
+                // Write out every chunk that is now next in input order
+                while (Chunk* ready = pending[next % pending.size()])
+                {
+                    pending[next % pending.size()] = nullptr;
+                    output.write(reinterpret_cast<const char*>(ready->outputs.data()),
+                                 std::streamsize(ready->points * (K + 1) * sizeof(T)));
+                    if (!output)
+                    {
+                        throw std::runtime_error("Failed writing stream output");
+                    }
+                    stats.points += ready->points;
+                    ++stats.chunks;
+                    ++next;
+                    idle.tryPush(ready);
+                    idleChanged.notify();
+                }
+            }
+        }
+
+        const Function& f;
+        std::istream& input;
+        std::ostream& output;
+        StreamOptions options;
+        StreamStats stats;
+        std::atomic<size_t> totalChunks{std::numeric_limits<size_t>::max()};
+        std::atomic<bool> failed{false};
+        Signal idleChanged;
+        Signal workChanged;
+        Signal doneChanged;
+        std::exception_ptr failure;
+        std::mutex failureMutex;
+};
+
+// Reads K values of T per point from input and writes f(x) and its gradient
+// for each point to output, in input order
+template<size_t K, typename T, typename Function>
+StreamStats streamGradients(const Function& f, std::istream& input, std::ostream& output, const StreamOptions& options = {})
+{
+    return GradientStream<K, T, Function>(f, input, output, options).run();
+}
+
+// The same over binary files
+template<size_t K, typename T, typename Function>
+StreamStats streamGradients(const Function& f, const std::string& inputPath, const std::string& outputPath,
+                            const StreamOptions& options = {})
+{
+    std::ifstream input(inputPath, std::ios::binary);
+    if (!input)
+    {
+        throw std::runtime_error("Cannot open stream input " + inputPath);
+    }
+    std::ofstream output(outputPath, std::ios::binary | std::ios::trunc);
+    if (!output)
+    {
+        throw std::runtime_error("Cannot open stream output " + outputPath);
+    }
+    return streamGradients<K, T>(f, input, output, options);
+}
+
+#endif
@@ -0,0 +1,91 @@
+// Operation counting, built in its own program so TestDuals exercises the
+// default uninstrumented operators
+#define DUALS_INSTRUMENT
+
+#include "Duals.h"
+#include <cassert>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+using namespace std;
+
+void testOperationCounters()
+{
+    resetDualsCounters();
+
+    Duals<3, double> x(0.5, {1.0, 0.0, 0.0});
+    Duals<3, double> y(2.0, {0.0, 1.0, 0.0});
+    Duals<3, double> z = sin(x * y) + x / y;
+    (void)z;
+
+    // Counts from another thread show up once it has finished
+    std::thread worker([]()
+    {
+        Duals<2, float> a(1.0f, {1.0f, 0.0f});
+        Duals<2, float> b = exp(a) * a;
+        (void)b;
+    });
+    worker.join();
+
+    DualsCounts counts = dualsCounters();
+    assert(counts[DualsOperation::Multiply] == 2);
+    assert(counts[DualsOperation::Divide] == 1);
+    assert(counts[DualsOperation::Add] == 1);
+    assert(counts[DualsOperation::Sin] == 1);
+    assert(counts[DualsOperation::Exp] == 1);
+    assert(counts.lanesFor(DualsOperation::Multiply) == 3 + 2);
+    assert(counts.totalCalls() == 6);
+
+    std::stringstream report;
+    reportDualsCounters(report, counts);
+    assert(report.str().find("multiply") != std::string::npos);
+
+    resetDualsCounters();
+    assert(dualsCounters().totalCalls() == 0);
+
+    cout << "Operation counter tests passed!" << endl;
+}
+
+void testCountersInNoexceptOperators()
+{
+    // A thread's first count registers its counters, which must not throw
+    // inside the noexcept operators
+    static_assert(noexcept(DualsThreadCounters::local()));
+    static_assert(noexcept(DUALS_COUNT(Add, 1)));
+    static_assert(noexcept(Duals<2, double>() + Duals<2, double>()));
+
+    // Many short-lived threads register and retire while the main thread counts
+    resetDualsCounters();
+    std::thread workers[8];
+    for (std::thread& worker : workers)
+    {
+        worker = std::thread([]()
+        {
+            Duals<2, double> a(1.0, {1.0, 0.0});
+            for (int i = 0; i < 100; ++i)
+            {
+                a = a + a;
+            }
+        });
+    }
+    Duals<2, double> b(2.0, {0.0, 1.0});
+    b = b * b;
+    for (std::thread& worker : workers)
+    {
+        worker.join();
+    }
+    DualsCounts counts = dualsCounters();
+    assert(counts[DualsOperation::Add] == 8 * 100);
+    assert(counts[DualsOperation::Multiply] == 1);
+
+    cout << "Noexcept counter registration tests passed!" << endl;
+}
+
+int main()
+{
+    testOperationCounters();
+    testCountersInNoexceptOperators();
+    return 0;
+}
@@ -1,6 +1,26 @@
 #include "Duals.h"
+#include "Optimize.h"
+#include "LeastSquares.h"
+#include "RootFinding.h"
+#include "Ode.h"
+#include "Expression.h"
+#include "CodeGen.h"
+#include "KernelModels.h"
+#include "GeneratedKernels.h"
+#include "Jit.h"
+#include "Memoize.h"
+#include "Checkpoint.h"
+#include "Reduction.h"
+#include "Stream.h"
+#include "Async.h"
+#include "Numa.h"
+#include "Sparse.h"
+#include "GradientCheck.h"
 #include <cassert>
+#include <chrono>
+#include <cstring>
 #include <sstream>
+#include <thread>
 
 using namespace std;
 
@@ -158,7 +178,7 @@ void testSingleVariableArithmeticOperators()
         assert(fabs(result.getValue() - (5.0 - 3.0)) < EPSILON);
 
         // Check derivative
-        assert(fabs(result.getDerivative() - 4.0) < EPSILON);
+        assert(fabs(result.getDerivative() - (-4.0)) < EPSILON);
     }
 
     // Test multiplication operator with a primitive type on the left
@@ -171,7 +191,7 @@ void testSingleVariableArithmeticOperators()
         assert(fabs(result.getValue() - (2.0 * 3.0)) < EPSILON);
 
         // Check derivative
-        assert(fabs(result.getDerivative() - 4.0) < EPSILON);
+        assert(fabs(result.getDerivative() - 2.0 * 4.0) < EPSILON);
     }
 
     // Test division operator with a primitive type on the left
@@ -184,7 +204,7 @@ void testSingleVariableArithmeticOperators()
         assert(fabs(result.getValue() - (5.0 / 3.0)) < EPSILON);
 
         // Check derivative
-        assert(fabs(result.getDerivative() - 4.0) < EPSILON);
+        assert(fabs(result.getDerivative() - (-5.0 * 4.0 / (3.0 * 3.0))) < EPSILON);
     }
 
     // Test addition operator with a primitive type on the right
@@ -223,7 +243,7 @@ void testSingleVariableArithmeticOperators()
         assert(fabs(result.getValue() - (3.0 * 2.0)) < EPSILON);
 
         // Check derivative
-        assert(fabs(result.getDerivative() - 4.0) < EPSILON);
+        assert(fabs(result.getDerivative() - 4.0 * 2.0) < EPSILON);
     }
 
     // Test division operator with a primitive type on the right
@@ -236,7 +256,7 @@ void testSingleVariableArithmeticOperators()
         assert(fabs(result.getValue() - (3.0 / 5.0)) < EPSILON);
 
         // Check derivative
-        assert(fabs(result.getDerivative() - 4.0) < EPSILON);
+        assert(fabs(result.getDerivative() - 4.0 / 5.0) < EPSILON);
     }
 
     cout << "All single-variable arithmetic operator tests passed!" << endl;
@@ -333,9 +353,9 @@ void testMultiVariableArithmeticOperators()
         assert(fabs(result.getValue() - (5.0 - 5.0)) < EPSILON);
 
         // Check derivative
-        assert(fabs(result.getDerivative(0) - 7.0) < EPSILON);
-        assert(fabs(result.getDerivative(1) - 2.0) < EPSILON);
-        assert(fabs(result.getDerivative(2) - 6.0) < EPSILON);
+        assert(fabs(result.getDerivative(0) - (-7.0)) < EPSILON);
+        assert(fabs(result.getDerivative(1) - (-2.0)) < EPSILON);
+        assert(fabs(result.getDerivative(2) - (-6.0)) < EPSILON);
     }
 
     // Test multiplication operator with a primitive type on the left
@@ -348,9 +368,9 @@ void testMultiVariableArithmeticOperators()
         assert(fabs(result.getValue() - (2.0 * 5.0)) < EPSILON);
 
         // Check derivative
-        assert(fabs(result.getDerivative(0) - 7.0) < EPSILON);
-        assert(fabs(result.getDerivative(1) - 2.0) < EPSILON);
-        assert(fabs(result.getDerivative(2) - 6.0) < EPSILON);
+        assert(fabs(result.getDerivative(0) - 2.0 * 7.0) < EPSILON);
+        assert(fabs(result.getDerivative(1) - 2.0 * 2.0) < EPSILON);
+        assert(fabs(result.getDerivative(2) - 2.0 * 6.0) < EPSILON);
     }
 
     // Test division operator with a primitive type on the left
@@ -363,9 +383,9 @@ void testMultiVariableArithmeticOperators()
         assert(fabs(result.getValue() - (2.0 / 5.0)) < EPSILON);
 
         // Check derivative
-        assert(fabs(result.getDerivative(0) - 7.0) < EPSILON);
-        assert(fabs(result.getDerivative(1) - 2.0) < EPSILON);
-        assert(fabs(result.getDerivative(2) - 6.0) < EPSILON);
+        assert(fabs(result.getDerivative(0) - (-2.0 * 7.0 / 25.0)) < EPSILON);
+        assert(fabs(result.getDerivative(1) - (-2.0 * 2.0 / 25.0)) < EPSILON);
+        assert(fabs(result.getDerivative(2) - (-2.0 * 6.0 / 25.0)) < EPSILON);
     }
 
     // Test addition operator with a primitive type on the right
@@ -408,9 +428,9 @@ void testMultiVariableArithmeticOperators()
         assert(fabs(result.getValue() - (5.0 * 2.0)) < EPSILON);
 
         // Check derivative
-        assert(fabs(result.getDerivative(0) - 7.0) < EPSILON);
-        assert(fabs(result.getDerivative(1) - 2.0) < EPSILON);
-        assert(fabs(result.getDerivative(2) - 6.0) < EPSILON);
+        assert(fabs(result.getDerivative(0) - 7.0 * 2.0) < EPSILON);
+        assert(fabs(result.getDerivative(1) - 2.0 * 2.0) < EPSILON);
+        assert(fabs(result.getDerivative(2) - 6.0 * 2.0) < EPSILON);
     }
 
     // Test division operator with a primitive type on the right
@@ -423,9 +443,9 @@ void testMultiVariableArithmeticOperators()
         assert(fabs(result.getValue() - (5.0 / 2.0)) < EPSILON);
 
         // Check derivative
-        assert(fabs(result.getDerivative(0) - 7.0) < EPSILON);
-        assert(fabs(result.getDerivative(1) - 2.0) < EPSILON);
-        assert(fabs(result.getDerivative(2) - 6.0) < EPSILON);
+        assert(fabs(result.getDerivative(0) - 7.0 / 2.0) < EPSILON);
+        assert(fabs(result.getDerivative(1) - 2.0 / 2.0) < EPSILON);
+        assert(fabs(result.getDerivative(2) - 6.0 / 2.0) < EPSILON);
     }
 
     cout << "All multi-variable arithmetic operator tests passed!" << endl;
@@ -857,6 +877,1816 @@ void testOutputOperatorMultivariable()
     cout << "Output Operator for multiple variables passed!" << endl;
 }
 
+struct Rosenbrock
+{
+    template <typename S>
+    S operator()(const std::array<S, 2>& x) const
+    {
+        S a = S(1.0) - x[0];
+        S b = x[1] - x[0] * x[0];
+        return a * a + S(100.0) * b * b;
+    }
+};
+
+void testGradientAndHessian()
+{
+    Rosenbrock f;
+    Vector<2, double> x = {-1.2, 1.0};
+
+    // Gradient from a single Duals evaluation
+    Vector<2, double> gradient;
+    double value = valueAndGradient(f, x, gradient);
+    assert(fabs(value - 24.2) < EPSILON);
+    assert(fabs(gradient[0] - (-2.0 * (1.0 - x[0]) - 400.0 * x[0] * (x[1] - x[0] * x[0]))) < EPSILON);
+    assert(fabs(gradient[1] - 200.0 * (x[1] - x[0] * x[0])) < EPSILON);
+
+    // Hessian from nested duals
+    Matrix<2, double> hessian;
+    Vector<2, double> gradientNested;
+    double valueNested = valueGradientAndHessian(f, x, gradientNested, hessian);
+    assert(fabs(valueNested - value) < EPSILON);
+    assert(fabs(gradientNested[0] - gradient[0]) < EPSILON);
+    assert(fabs(gradientNested[1] - gradient[1]) < EPSILON);
+    assert(fabs(hessian[0][0] - (2.0 - 400.0 * (x[1] - 3.0 * x[0] * x[0]))) < EPSILON);
+    assert(fabs(hessian[0][1] - (-400.0 * x[0])) < EPSILON);
+    assert(fabs(hessian[1][0] - (-400.0 * x[0])) < EPSILON);
+    assert(fabs(hessian[1][1] - 200.0) < EPSILON);
+
+    // Elementary functions nest as well: d2/dx2 sin(x) = -sin(x)
+    auto g = [](const auto& v) { return sin(v[0]) * exp(v[1]); };
+    Vector<2, double> point = {0.5, 0.25};
+    valueGradientAndHessian(g, point, gradientNested, hessian);
+    assert(fabs(hessian[0][0] + sin(0.5) * exp(0.25)) < EPSILON);
+    assert(fabs(hessian[0][1] - cos(0.5) * exp(0.25)) < EPSILON);
+    assert(fabs(hessian[1][1] - sin(0.5) * exp(0.25)) < EPSILON);
+
+    cout << "Gradient and Hessian drivers passed!" << endl;
+}
+
+void testOptimizers()
+{
+    Rosenbrock f;
+    OptimizerOptions<double> options;
+    options.gradientTolerance = 1e-6;
+
+    {
+        Vector<2, double> x = {-1.2, 1.0};
+        options.maxIterations = 50000;
+        OptimizerResult<double> result = gradientDescent(f, x, options);
+        assert(result.converged);
+        assert(fabs(x[0] - 1.0) < 1e-3 && fabs(x[1] - 1.0) < 1e-3);
+    }
+
+    {
+        Vector<2, double> x = {-1.2, 1.0};
+        options.maxIterations = 200;
+        OptimizerResult<double> result = lbfgs(f, x, options);
+        assert(result.converged);
+        assert(fabs(x[0] - 1.0) < 1e-5 && fabs(x[1] - 1.0) < 1e-5);
+    }
+
+    {
+        Vector<2, double> x = {-1.2, 1.0};
+        options.maxIterations = 100;
+        OptimizerResult<double> result = newton(f, x, options);
+        assert(result.converged);
+        assert(fabs(x[0] - 1.0) < 1e-6 && fabs(x[1] - 1.0) < 1e-6);
+        assert(result.value < 1e-12);
+    }
+
+    cout << "Optimizer tests passed!" << endl;
+}
+
+struct DecayModel
+{
+    // residual of y = a * exp(-b * t) + c at one (t, y) sample
+    template <typename S>
+    S operator()(const std::array<S, 3>& p, const std::array<double, 2>& sample) const
+    {
+        return p[0] * exp(S(-sample[0]) * p[1]) + p[2] - S(sample[1]);
+    }
+};
+
+void testLevenbergMarquardt()
+{
+    // Noise-free samples of 2.5 * exp(-1.3 t) + 0.7 with a deterministic wiggle
+    std::vector<std::array<double, 2>> data;
+    for (size_t k = 0; k < 5000; ++k)
+    {
+        double t = 0.001 * double(k);
+        data.push_back({t, 2.5 * std::exp(-1.3 * t) + 0.7 + 1e-3 * std::sin(37.0 * t)});
+    }
+
+    LeastSquaresOptions<double> options;
+    options.blockSize = 256;
+
+    options.numThreads = 1;
+    Vector<3, double> serial = {1.0, 1.0, 0.0};
+    LeastSquaresResult<double> result = levenbergMarquardt(DecayModel(), data, serial, options);
+    assert(result.converged);
+    assert(fabs(serial[0] - 2.5) < 1e-2);
+    assert(fabs(serial[1] - 1.3) < 1e-2);
+    assert(fabs(serial[2] - 0.7) < 1e-2);
+
+    // The reduction order is fixed by the block size, so any thread count gives the same bits
+    options.numThreads = 3;
+    Vector<3, double> threaded = {1.0, 1.0, 0.0};
+    LeastSquaresResult<double> threadedResult = levenbergMarquardt(DecayModel(), data, threaded, options);
+    assert(threadedResult.iterations == result.iterations);
+    assert(threaded == serial);
+    assert(threadedResult.cost == result.cost);
+
+    cout << "Levenberg-Marquardt tests passed!" << endl;
+}
+
+void testNewtonSolve()
+{
+    // Circle of radius 2 intersected with the line y = x
+    auto f = [](const auto& v)
+    {
+        using S = typename std::decay_t<decltype(v)>::value_type;
+        return std::array<S, 2>{v[0] * v[0] + v[1] * v[1] - S(4.0), v[0] - v[1]};
+    };
+
+    {
+        Vector<2, double> x = {1.0, 0.5};
+        RootResult<double> result = newtonSolve(f, x);
+        assert(result.converged);
+        assert(fabs(x[0] - sqrt(2.0)) < 1e-10 && fabs(x[1] - sqrt(2.0)) < 1e-10);
+        assert(result.jacobianEvaluations <= result.iterations);
+    }
+
+    // One plain evaluation per step and none at the start or on a refresh
+    {
+        size_t plainCalls = 0;
+        auto counted = [&](const auto& v)
+        {
+            using S = typename std::decay_t<decltype(v)>::value_type;
+            if constexpr (std::is_same_v<S, double>)
+            {
+                ++plainCalls;
+            }
+            return f(v);
+        };
+        Vector<2, double> x = {3.0, -1.0};
+        RootResult<double> result = newtonSolve(counted, x);
+        assert(result.converged && result.jacobianEvaluations > 1);
+        assert(plainCalls == result.functionEvaluations && plainCalls == result.iterations);
+    }
+
+    // One input direction per forward pass gives the same root
+    {
+        Vector<2, double> x = {1.0, 0.5};
+        RootResult<double> result = newtonSolve<1>(f, x);
+        assert(result.converged);
+        assert(fabs(x[0] - sqrt(2.0)) < 1e-10 && fabs(x[1] - sqrt(2.0)) < 1e-10);
+    }
+
+    // Chunked Jacobian matches the full one
+    {
+        auto g = [](const auto& v)
+        {
+            using S = typename std::decay_t<decltype(v)>::value_type;
+            return std::array<S, 3>{v[0] * v[1], sin(v[2]) + v[0], v[1] / v[2]};
+        };
+        Vector<3, double> x = {0.3, -1.1, 2.0};
+        Vector<3, double> value;
+        Matrix<3, double> full;
+        Matrix<3, double> chunked;
+        valueAndJacobian(g, x, value, full);
+        valueAndJacobian<2>(g, x, value, chunked);
+        assert(full == chunked);
+        assert(fabs(full[0][1] - 0.3) < EPSILON);
+        assert(fabs(full[1][2] - cos(2.0)) < EPSILON);
+        assert(fabs(full[2][2] + (-1.1) / 4.0) < EPSILON);
+    }
+
+    cout << "Newton solver tests passed!" << endl;
+}
+
+void testImplicitDifferentiation()
+{
+    // x^3 + a x - b = 0 has dx/da = -x / (3x^2 + a) and dx/db = 1 / (3x^2 + a)
+    auto f = [](const auto& x, const auto& p)
+    {
+        using S = typename std::decay_t<decltype(x)>::value_type;
+        return std::array<S, 1>{x[0] * x[0] * x[0] + p[0] * x[0] - p[1]};
+    };
+
+    Vector<1, double> x = {1.0};
+    Vector<2, double> p = {2.0, 5.0};
+    RootResult<double> result = newtonSolve([&](const auto& v)
+    {
+        using S = typename std::decay_t<decltype(v)>::value_type;
+        return f(v, std::array<S, 2>{S(p[0]), S(p[1])});
+    }, x);
+    assert(result.converged);
+
+    RectMatrix<1, 2, double> dxdp;
+    assert(implicitDerivative(f, x, p, dxdp));
+    double denominator = 3.0 * x[0] * x[0] + p[0];
+    assert(fabs(dxdp[0][0] + x[0] / denominator) < 1e-10);
+    assert(fabs(dxdp[0][1] - 1.0 / denominator) < 1e-10);
+
+    // Parameters given as duals carry their derivatives through the root
+    std::array<Duals<2, double>, 2> dualParams = {Duals<2, double>(2.0, {1.0, 0.0}), Duals<2, double>(5.0, {0.0, 1.0})};
+    Vector<1, double> start = {1.0};
+    std::array<Duals<2, double>, 1> root = solveImplicit(f, start, dualParams);
+    assert(fabs(root[0].getValue() - x[0]) < 1e-10);
+    assert(fabs(root[0].getDerivative(0) - dxdp[0][0]) < 1e-10);
+    assert(fabs(root[0].getDerivative(1) - dxdp[0][1]) < 1e-10);
+
+    cout << "Implicit differentiation tests passed!" << endl;
+}
+
+template <typename S>
+struct Decay
+{
+    S rate;
+
+    void operator()(double, const std::array<S, 1>& y, std::array<S, 1>& dydt) const
+    {
+        dydt[0] = S(0.0) - rate * y[0];
+    }
+};
+
+void testOdeSensitivities()
+{
+    // y' = -k y, y(0) = y0  =>  y(t) = y0 exp(-k t), dy/dk = -t y, dy/dy0 = exp(-k t)
+    const double k = 0.8;
+    const double y0 = 2.0;
+    const double t1 = 1.5;
+    const double exact = y0 * exp(-k * t1);
+
+    using Sensitivity = Duals<2, double>;
+    Decay<Sensitivity> system = {Sensitivity(k, {1.0, 0.0})};
+
+    {
+        std::array<Sensitivity, 1> y = {Sensitivity(y0, {0.0, 1.0})};
+        RungeKutta4<1, Sensitivity> rk4;
+        rk4.integrate(system, 0.0, t1, 200, y);
+        assert(fabs(y[0].getValue() - exact) < 1e-8);
+        assert(fabs(y[0].getDerivative(0) + t1 * exact) < 1e-8);
+        assert(fabs(y[0].getDerivative(1) - exp(-k * t1)) < 1e-8);
+    }
+
+    {
+        std::array<Sensitivity, 1> y = {Sensitivity(y0, {0.0, 1.0})};
+        DormandPrince<1, Sensitivity> dopri;
+        AdaptiveStats stats = dopri.integrate(system, 0.0, t1, y);
+        assert(stats.accepted > 0);
+        assert(fabs(y[0].getValue() - exact) < 1e-7);
+        assert(fabs(y[0].getDerivative(0) + t1 * exact) < 1e-7);
+        assert(fabs(y[0].getDerivative(1) - exp(-k * t1)) < 1e-7);
+
+        // The plain solution takes exactly the same steps
+        Decay<double> plainSystem = {k};
+        std::array<double, 1> plain = {y0};
+        DormandPrince<1, double> plainDopri;
+        AdaptiveStats plainStats = plainDopri.integrate(plainSystem, 0.0, t1, plain);
+        assert(plainStats.accepted == stats.accepted && plainStats.rejected == stats.rejected);
+        assert(fabs(plain[0] - y[0].getValue()) < 1e-12);
+    }
+
+    cout << "ODE sensitivity tests passed!" << endl;
+}
+
+void testScalarSpecialization()
+{
+    // Duals<1, T> holds two scalars and keeps the general interface
+    static_assert(sizeof(Duals<1, double>) == 2 * sizeof(double), "Duals<1, T> should be two scalars");
+
+    Duals<1, double> x(2.0, 1.0);
+    Duals<1, double> y = x * x * (3.0 - 2.0 * x);
+    assert(fabs(y.getValue() - (4.0 * (3.0 - 4.0))) < EPSILON);
+    assert(y.getAllDerivatives().size() == 1);
+    assert(y.getDerivative(0) == y.getDerivative());
+
+    Duals<1, double> z(1.0, std::array<double, 1>{5.0});
+    z.setAllDerivatives({6.0});
+    assert(z.getDerivative() == 6.0);
+    z.setDerivative(0, 7.0);
+    assert(z.getDerivative() == 7.0);
+    assert((z > Duals<1, double>(1.0, 6.0)) && z >= z && !(z < z) && z != x);
+
+    cout << "Single-variable specialization tests passed!" << endl;
+}
+
+void testJacobianVectorProduct()
+{
+    // Directional derivative of a scalar function matches gradient . v
+    Rosenbrock f;
+    Vector<2, double> x = {-1.2, 1.0};
+    Vector<2, double> v = {0.3, -0.7};
+    Vector<2, double> gradient;
+    valueAndGradient(f, x, gradient);
+    Duals<1, double> directional = jvp(f, x, v);
+    assert(fabs(directional.getDerivative() - (gradient[0] * v[0] + gradient[1] * v[1])) < 1e-10);
+
+    // J * v of a vector function matches the full Jacobian
+    auto g = [](const auto& u)
+    {
+        using S = typename std::decay_t<decltype(u)>::value_type;
+        return std::array<S, 3>{u[0] * u[1], sin(u[0]), exp(u[1]) / u[0]};
+    };
+    Vector<3, double> value;
+    Vector<3, double> tangent;
+    RectMatrix<3, 2, double> jacobian;
+    jvp(g, x, v, value, tangent);
+    valueAndJacobian(g, x, value, jacobian);
+    for (size_t row = 0; row < 3; ++row)
+    {
+        assert(fabs(tangent[row] - (jacobian[row][0] * v[0] + jacobian[row][1] * v[1])) < 1e-10);
+    }
+
+    cout << "Jacobian-vector product tests passed!" << endl;
+}
+
+void testOperationCounters()
+{
+    // Built without DUALS_INSTRUMENT the operators count nothing; TestCounters covers the instrumented build
+    static_assert(!dualsInstrumented());
+    Duals<3, double> x(0.5, {1.0, 0.0, 0.0});
+    Duals<3, double> z = sin(x * x) + x / 2.0;
+    (void)z;
+    assert(dualsCounters().totalCalls() == 0);
+
+    std::stringstream report;
+    reportDualsCounters(report);
+    assert(report.str().find("disabled") != std::string::npos);
+
+    cout << "Operation counter tests passed!" << endl;
+}
+
+struct SharedTerms
+{
+    // Repeats x * x and cos(2y) the way hand-written derivative code tends to
+    template <typename S>
+    std::array<S, 2> operator()(const std::array<S, 2>& v) const
+    {
+        S unused = exp(v[0]) * S(7.0);
+        (void)unused;
+        return {v[0] * v[0] * v[1] + S(2.0) * v[0] + cos(S(2.0) * v[1]) * cos(S(2.0) * v[1]),
+                (S(2.0) * S(3.0)) * (v[0] * v[0]) / sqrt(v[1]) * S(1.0)};
+    }
+};
+
+void testExpressionTracing()
+{
+    ExpressionGraph<double> graph = traceFunction<2, double>(SharedTerms());
+    ExpressionProgram<double> program = graph.compile();
+
+    // x*x, 2y and cos(2y) are recorded once, 2*3 is folded, *1 is dropped and exp(x)*7 is dead
+    size_t constants = 0;
+    for (const ExpressionInstruction<double>& instruction : program.getInstructions())
+    {
+        assert(instruction.op != ExpressionOp::Exp);
+        constants += instruction.op == ExpressionOp::Constant ? 1 : 0;
+    }
+    assert(constants == 2);
+    assert(program.getInstructions().size() == 15);
+    assert(program.getInstructions().size() < graph.getNodes().size());
+
+    // Replaying with duals gives the same values and gradients as evaluating directly
+    std::vector<Duals<2, double>> registers;
+    for (double x : {0.5, 1.5, -2.0})
+    {
+        std::array<Duals<2, double>, 2> inputs = {Duals<2, double>(x, {1.0, 0.0}), Duals<2, double>(0.75, {0.0, 1.0})};
+        std::array<Duals<2, double>, 2> replayed;
+        program.evaluate(inputs, replayed, registers);
+        std::array<Duals<2, double>, 2> direct = SharedTerms()(inputs);
+        for (size_t k = 0; k < 2; ++k)
+        {
+            assert(fabs(replayed[k].getValue() - direct[k].getValue()) < 1e-12);
+            assert(fabs(replayed[k].getDerivative(0) - direct[k].getDerivative(0)) < 1e-12);
+            assert(fabs(replayed[k].getDerivative(1) - direct[k].getDerivative(1)) < 1e-12);
+        }
+
+        // Plain values replay too
+        std::vector<double> valueRegisters;
+        std::array<double, 2> values;
+        program.evaluate(std::array<double, 2>{x, 0.75}, values, valueRegisters);
+        assert(fabs(values[0] - direct[0].getValue()) < 1e-12);
+    }
+
+    // Generic code using unary minus and int literals traces like it evaluates on Duals
+    ExpressionProgram<double> negated = traceFunction<2, double>(NegatedTerms()).compile();
+    size_t negations = 0;
+    for (const ExpressionInstruction<double>& instruction : negated.getInstructions())
+    {
+        negations += instruction.op == ExpressionOp::Negate ? 1 : 0;
+    }
+    assert(negations == 3);
+    for (double x : {0.5, -1.25})
+    {
+        std::array<Duals<2, double>, 2> inputs = {Duals<2, double>(x, {1.0, 0.0}), Duals<2, double>(0.75, {0.0, 1.0})};
+        std::array<Duals<2, double>, 1> replayed;
+        negated.evaluate(inputs, replayed, registers);
+        Duals<2, double> direct = NegatedTerms()(inputs);
+        assert(fabs(replayed[0].getValue() - direct.getValue()) < 1e-12);
+        assert(fabs(replayed[0].getDerivative(0) - direct.getDerivative(0)) < 1e-12);
+        assert(fabs(replayed[0].getDerivative(1) - direct.getDerivative(1)) < 1e-12);
+    }
+    // The sign of zero survives negation
+    auto negatedZero = [](const auto& v) { return -(v[0] * 0.0); };
+    std::array<double, 1> zero;
+    std::vector<double> zeroRegisters;
+    traceFunction<1, double>(negatedZero).compile().evaluate(std::array<double, 1>{1.0}, zero, zeroRegisters);
+    assert(zero[0] == 0.0 && std::signbit(zero[0]));
+
+    // Folded constants meet the domain policy of the live function: log of a
+    // negative constant throws under Throw, and sqrt keeps its NaN default
+    auto logOfConstant = [](const auto& v)
+    {
+        using S = typename std::decay_t<decltype(v)>::value_type;
+        return v[0] + log(S(-1.0));
+    };
+    bool threw = false;
+    try
+    {
+        traceFunction<1, double>(logOfConstant);
+    }
+    catch (const runtime_error&)
+    {
+        threw = true;
+    }
+    assert(threw == (dualsDomain == DualsDomain::Throw));
+    auto sqrtOfConstant = [](const auto& v)
+    {
+        using S = typename std::decay_t<decltype(v)>::value_type;
+        return v[0] + sqrt(S(-1.0));
+    };
+    std::array<double, 1> folded;
+    traceFunction<1, double>(sqrtOfConstant).compile().evaluate(std::array<double, 1>{1.0}, folded, zeroRegisters);
+    assert(std::isnan(folded[0]));
+
+    cout << "Expression tracing tests passed!" << endl;
+}
+
+// Compares a generated kernel with the model evaluated on live Duals
+template <size_t N, size_t M, typename Kernel, typename Model>
+void checkGeneratedKernel(Kernel kernel, const Model& model, const std::array<double, N>& x)
+{
+    std::array<Duals<N, double>, N> inputs;
+    for (size_t i = 0; i < N; ++i)
+    {
+        inputs[i] = Duals<N, double>(x[i]);
+        inputs[i].setDerivative(i, 1.0);
+    }
+    std::array<Duals<N, double>, M> expected;
+    if constexpr (M == 1)
+    {
+        expected[0] = model(inputs);
+    }
+    else
+    {
+        expected = model(inputs);
+    }
+
+    std::array<double, M> value;
+    std::array<double, M * N> gradient;
+    kernel(x.data(), value.data(), gradient.data());
+    for (size_t k = 0; k < M; ++k)
+    {
+        assert(fabs(value[k] - expected[k].getValue()) < 1e-12);
+        for (size_t i = 0; i < N; ++i)
+        {
+            assert(fabs(gradient[k * N + i] - expected[k].getDerivative(i)) < 1e-12);
+        }
+    }
+}
+
+void testGeneratedKernels()
+{
+    for (double t : {-0.7, 0.3, 1.9})
+    {
+        checkGeneratedKernel<3, 1>(separableSumKernel, SeparableSum(), {t, 2.0 * t, 0.5 - t});
+        checkGeneratedKernel<3, 2>(coupledTermsKernel, CoupledTerms(), {t, 1.0 - t, 0.25 * t});
+        checkGeneratedKernel<2, 1>(mixedFunctionsKernel, MixedFunctions(), {t, 0.4 - t});
+        checkGeneratedKernel<2, 1>(negatedTermsKernel, NegatedTerms(), {t, 0.4 - t});
+        checkGeneratedKernel<2, 1>(limitTermsKernel, LimitTerms(), {t, 0.4 - t});
+    }
+
+    // Only the three non-zero lanes of the separable sum are computed
+    ostringstream source;
+    emitGradientKernel<3, double>(source, "separable", SeparableSum());
+    string text = source.str();
+    size_t lanes = 0;
+    for (size_t at = text.find("const double d"); at != string::npos; at = text.find("const double d", at + 1))
+    {
+        ++lanes;
+    }
+    assert(lanes == 3);
+    assert(text.find("* 1") == string::npos);
+    assert(text.find("gradient[2] = d") != string::npos);
+
+    // Non-finite constants are spelled through numeric_limits and whole
+    // numbers keep a floating-point suffix
+    ostringstream limits;
+    emitGradientKernel<1, float>(limits, "limits", [](const auto& v)
+    {
+        using S = typename std::decay_t<decltype(v)>::value_type;
+        return v[0] * S(-std::numeric_limits<float>::infinity()) + v[0] * S(std::numeric_limits<float>::quiet_NaN())
+             + v[0] * S(2.0f);
+    });
+    text = limits.str();
+    assert(text.find("= -std::numeric_limits<float>::infinity();") != string::npos);
+    assert(text.find("= std::numeric_limits<float>::quiet_NaN();") != string::npos);
+    assert(text.find("= 2.0f;") != string::npos);
+    assert(text.find("inf;") == string::npos && text.find("nan") == string::npos);
+
+    // abs follows the domain policy the generator was built with
+    ostringstream kink;
+    emitGradientKernel<1, double>(kink, "kink", [](const auto& v) { return abs(v[0]); });
+    text = kink.str();
+    assert((text.find("throw std::runtime_error") != string::npos) == (dualsDomain == DualsDomain::Throw));
+    assert((text.find("quiet_NaN") != string::npos) == (dualsDomain == DualsDomain::NaN));
+
+    cout << "Generated kernel tests passed!" << endl;
+}
+
+// Compares JIT-compiled code with replaying the same program on Duals
+template <size_t N, size_t INPUTS, size_t OUTPUTS>
+void checkJitProgram(const ExpressionProgram<double>& program, const std::array<double, INPUTS>& x)
+{
+    std::array<Duals<N, double>, INPUTS> inputs;
+    for (size_t k = 0; k < INPUTS; ++k)
+    {
+        inputs[k] = Duals<N, double>(x[k]);
+        for (size_t i = 0; i < N; ++i)
+        {
+            inputs[k].setDerivative(i, double(k + 1) * 0.5 + double(i));
+        }
+    }
+    std::array<Duals<N, double>, OUTPUTS> expected;
+    std::vector<Duals<N, double>> registers;
+    program.evaluate(inputs, expected, registers);
+
+    std::shared_ptr<const JitProgram<N>> native = jitCompile<N>(program);
+    assert(native->isNative() == jitNative());
+    std::array<Duals<N, double>, OUTPUTS> results;
+    std::vector<double> scratch;
+    native->evaluate(inputs, results, scratch);
+    for (size_t k = 0; k < OUTPUTS; ++k)
+    {
+        assert(fabs(results[k].getValue() - expected[k].getValue()) < 1e-12 * (1.0 + fabs(expected[k].getValue())));
+        for (size_t i = 0; i < N; ++i)
+        {
+            double scale = 1.0 + fabs(expected[k].getDerivative(i));
+            assert(fabs(results[k].getDerivative(i) - expected[k].getDerivative(i)) < 1e-12 * scale);
+        }
+    }
+}
+
+void testJitCompilation()
+{
+    ExpressionProgram<double> shared = traceFunction<2, double>(SharedTerms()).compile();
+    ExpressionProgram<double> coupled = traceFunction<3, double>(CoupledTerms()).compile();
+    ExpressionProgram<double> mixed = traceFunction<2, double>(MixedFunctions()).compile();
+    ExpressionProgram<double> negated = traceFunction<2, double>(NegatedTerms()).compile();
+    for (double t : {-0.6, 0.35, 1.2})
+    {
+        // Odd and even block sizes, one and several outputs, every operation
+        checkJitProgram<1, 2, 2>(shared, {t, 0.75});
+        checkJitProgram<2, 2, 2>(shared, {t, 1.5});
+        checkJitProgram<3, 3, 2>(coupled, {t, 1.0 - t, 0.25 * t});
+        checkJitProgram<4, 3, 2>(coupled, {t, 2.0, -t});
+        checkJitProgram<2, 2, 1>(mixed, {t, 0.4 - t});
+        checkJitProgram<3, 2, 1>(negated, {t, 0.4 - t});
+    }
+
+    // Domain errors surface like they do with Duals
+    auto logarithm = [](const auto& v) { return log(v[0]); };
+    std::shared_ptr<const JitProgram<1>> native = jitCompile<1>(traceFunction<1, double>(logarithm).compile());
+    std::array<Duals<1, double>, 1> result;
+    std::vector<double> scratch;
+    native->evaluate(std::array<Duals<1, double>, 1>{Duals<1, double>(2.0, 1.0)}, result, scratch);
+    assert(fabs(result[0].getDerivative() - 0.5) < 1e-15);
+    bool threw = false;
+    try
+    {
+        native->evaluate(std::array<Duals<1, double>, 1>{Duals<1, double>(-1.0, 1.0)}, result, scratch);
+    }
+    catch (const runtime_error&)
+    {
+        threw = true;
+    }
+    assert(threw);
+
+    // Tracing the same model again hits the cache and shares the code
+    size_t hits = JitCache<2>::instance().getHits();
+    ExpressionProgram<double> retraced = traceFunction<2, double>(SharedTerms()).compile();
+    assert(retraced.hash() == shared.hash());
+    assert(jitCompile<2>(retraced) == jitCompile<2>(shared));
+    assert(JitCache<2>::instance().getHits() == hits + 2);
+    assert(jitCompile<3>(retraced) != nullptr);
+
+    // Constants match by bit pattern: a NaN constant hits the cache, signed zeros do not share code
+    auto scaledByNaN = [](const auto& v) { return v[0] * std::numeric_limits<double>::quiet_NaN(); };
+    ExpressionProgram<double> nanProgram = traceFunction<1, double>(scaledByNaN).compile();
+    assert((nanProgram == traceFunction<1, double>(scaledByNaN).compile()));
+    std::shared_ptr<const JitProgram<1>> nanCode = jitCompile<1>(nanProgram);
+    size_t misses = JitCache<1>::instance().getMisses();
+    assert(jitCompile<1>(nanProgram) == nanCode);
+    assert(JitCache<1>::instance().getMisses() == misses);
+
+    auto reciprocalNegativeZero = [](const auto& v) { return 1.0 / (v[0] * -0.0); };
+    auto reciprocalPositiveZero = [](const auto& v) { return 1.0 / (v[0] * 0.0); };
+    ExpressionProgram<double> negativeZero = traceFunction<1, double>(reciprocalNegativeZero).compile();
+    ExpressionProgram<double> positiveZero = traceFunction<1, double>(reciprocalPositiveZero).compile();
+    assert(!(negativeZero == positiveZero) && negativeZero.hash() != positiveZero.hash());
+    jitCompile<1>(negativeZero)->evaluate(std::array<Duals<1, double>, 1>{Duals<1, double>(1.0, 1.0)}, result, scratch);
+    assert(std::isinf(result[0].getValue()) && result[0].getValue() < 0.0);
+    jitCompile<1>(positiveZero)->evaluate(std::array<Duals<1, double>, 1>{Duals<1, double>(1.0, 1.0)}, result, scratch);
+    assert(std::isinf(result[0].getValue()) && result[0].getValue() > 0.0);
+
+    cout << "JIT compilation tests passed!" << endl;
+}
+
+// Counts how often it is actually evaluated
+struct CountedRosenbrock
+{
+    std::atomic<size_t>* evaluations;
+
+    template <typename S>
+    S operator()(const std::array<S, 2>& x) const
+    {
+        evaluations->fetch_add(1);
+        return Rosenbrock()(x);
+    }
+};
+
+void testMemoization()
+{
+    std::atomic<size_t> evaluations{0};
+    auto cached = memoize<2, Duals<2, double>>(CountedRosenbrock{&evaluations}, 64);
+
+    // A hit is a bitwise copy of the first result
+    std::array<Duals<2, double>, 2> point = {Duals<2, double>(0.3, {1.0, 0.0}), Duals<2, double>(-0.7, {0.0, 1.0})};
+    Duals<2, double> first = cached(point);
+    Duals<2, double> second = cached(point);
+    assert(evaluations == 1);
+    assert(memcmp(&first, &second, sizeof(first)) == 0);
+
+    // Other seed directions at the same point are separate entries
+    std::array<Duals<2, double>, 2> swapped = {Duals<2, double>(0.3, {0.0, 1.0}), Duals<2, double>(-0.7, {1.0, 0.0})};
+    Duals<2, double> third = cached(swapped);
+    assert(evaluations == 2);
+    assert(third.getDerivative(0) == first.getDerivative(1));
+
+    // Plain values bypass the cache
+    cached(std::array<double, 2>{0.3, -0.7});
+    assert(evaluations == 3);
+    MemoStats stats = cached.getStats();
+    assert(stats.hits == 1 && stats.misses == 2 && stats.size == 2);
+
+    // Re-running an optimizer from the same start is served entirely from the cache
+    auto repeated = memoize<2, Duals<2, double>>(CountedRosenbrock{&evaluations}, 100000);
+    Vector<2, double> x = {-1.2, 1.0};
+    OptimizerResult<double> result = lbfgs(repeated, x);
+    assert(result.converged);
+    size_t evaluated = evaluations;
+    Vector<2, double> y = {-1.2, 1.0};
+    lbfgs(repeated, y);
+    assert(evaluations == evaluated);
+    assert(x == y);
+    assert(repeated.getStats().hits == repeated.getStats().misses);
+
+    // Least recently used entries are evicted first
+    auto small = memoize<1, double, 1>([](const auto& v) { return v[0] * v[0]; }, 2);
+    small(std::array<double, 1>{1.0});
+    small(std::array<double, 1>{2.0});
+    small(std::array<double, 1>{1.0});
+    small(std::array<double, 1>{3.0});
+    assert(small.getStats().evictions == 1);
+    small(std::array<double, 1>{1.0});
+    assert(small.getStats().hits == 2);
+    small(std::array<double, 1>{2.0});
+    assert(small.getStats().misses == 4);
+
+    // Concurrent callers share one table
+    auto shared = memoize<2, Duals<2, double>>(Rosenbrock(), 1024);
+    std::vector<std::thread> threads;
+    std::atomic<bool> mismatch{false};
+    for (size_t t = 0; t < 4; ++t)
+    {
+        threads.emplace_back([&]()
+        {
+            for (size_t k = 0; k < 200; ++k)
+            {
+                double s = double(k % 50) / 50.0;
+                std::array<Duals<2, double>, 2> p = {Duals<2, double>(s, {1.0, 0.0}), Duals<2, double>(1.0 - s, {0.0, 1.0})};
+                if (!(shared(p) == Rosenbrock()(p)))
+                {
+                    mismatch = true;
+                }
+            }
+        });
+    }
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+    assert(!mismatch);
+    assert(shared.getStats().size == 50);
+    assert(shared.getStats().hits + shared.getStats().misses == 800);
+
+    cout << "Memoization tests passed!" << endl;
+}
+
+void testCheckpointing()
+{
+    // Reverse sweep over RK4 steps of y' = -k y with the rate seeded as a dual
+    using S = Duals<1, double>;
+    Decay<S> decay{S(0.8, 1.0)};
+    RungeKutta4<1, S> rk4;
+    const double h = 0.01;
+    auto step = [&](std::array<S, 1>& y, size_t i) { rk4.step(decay, double(i) * h, h, y); };
+    const std::array<S, 1> initial = {S(2.0)};
+
+    for (size_t steps : {1, 2, 7, 50, 300})
+    {
+        // Reference: every state kept
+        std::vector<std::array<S, 1>> all(1, initial);
+        for (size_t i = 0; i + 1 < steps; ++i)
+        {
+            all.push_back(all.back());
+            step(all.back(), i);
+        }
+
+        for (size_t snapshots : {0, 1, 2, 3, 5, 400})
+        {
+            size_t expected = steps;
+            bool identical = true;
+            auto visit = [&](size_t i, const std::array<S, 1>& y)
+            {
+                identical = identical && i + 1 == expected && memcmp(&y, &all[i], sizeof(y)) == 0;
+                expected = i;
+            };
+            CheckpointStats stats = reverseWithCheckpoints(initial, steps, snapshots, step, visit);
+            assert(identical && expected == 0);
+            assert(stats.forwardSteps == checkpointForwardSteps(steps, snapshots));
+            assert(stats.storedStates <= snapshots + 2);
+        }
+    }
+
+    // 4 snapshots reverse C(5 + 3, 5) = 56 steps with 3 * 56 - C(8, 6) forward steps
+    assert(checkpointRepetitions(56, 5) == 3 && checkpointRepetitions(57, 5) == 4);
+    assert(checkpointForwardSteps(56, 4) == 140);
+    assert(checkpointForwardSteps(100, 99) == 99);
+    assert(checkpointForwardSteps(5, 0) == 10);
+
+    cout << "Checkpointing tests passed!" << endl;
+}
+
+// Checks both derivative lanes of f(a, b) against central differences along the seed directions
+template <typename Function>
+void checkCentralDifference(const Function& f, double x, double y)
+{
+    const double h = 1e-6;
+    const std::array<double, 2> seedX = {1.0, 0.5};
+    const std::array<double, 2> seedY = {-0.3, 1.0};
+    Duals<2, double> result = f(Duals<2, double>(x, seedX), Duals<2, double>(y, seedY));
+    double value = f(x, y);
+    assert(fabs(result.getValue() - value) <= 1e-14 * (1.0 + fabs(value)));
+    for (size_t i = 0; i < 2; ++i)
+    {
+        double expected = (f(x + h * seedX[i], y + h * seedY[i]) - f(x - h * seedX[i], y - h * seedY[i])) / (2.0 * h);
+        assert(fabs(result.getDerivative(i) - expected) < 1e-6 * (1.0 + fabs(expected)));
+    }
+}
+
+void testExtendedMathFunctions()
+{
+    for (double x : {-1.3, -0.2, 0.4, 2.1})
+    {
+        double y = 0.7 - 0.6 * x;
+        checkCentralDifference([](auto a, auto) { return sinh(a); }, x, y);
+        checkCentralDifference([](auto a, auto) { return cosh(a); }, x, y);
+        checkCentralDifference([](auto a, auto) { return tanh(a); }, x, y);
+        checkCentralDifference([](auto a, auto) { return expm1(a); }, x, y);
+        checkCentralDifference([](auto a, auto) { return cbrt(a); }, x, y);
+        checkCentralDifference([](auto a, auto) { return erf(a); }, x, y);
+        checkCentralDifference([](auto a, auto b) { return atan2(a, b); }, x, y);
+        checkCentralDifference([](auto a, auto b) { return hypot(a, b); }, x, y);
+        checkCentralDifference([](auto a, auto b) { return min(a, b); }, x, y);
+        checkCentralDifference([](auto a, auto b) { return max(a, b); }, x, y);
+        checkCentralDifference([](auto a, auto b) { return fmod(a, b); }, x, y);
+        checkCentralDifference([](auto a, auto b) { return log1p(a * a + b); }, x, 0.5);
+        checkCentralDifference([](auto a, auto b) { return pow(a * a + b, a); }, x, 0.5);
+    }
+
+    // Stable formulations: no cancellation in the tails or near zero
+    Duals<1, double> far = tanh(Duals<1, double>(40.0, 1.0));
+    assert(far.getValue() == 1.0);
+    assert(fabs(far.getDerivative() / (4.0 * exp(-80.0)) - 1.0) < 1e-12);
+    assert(tanh(Duals<1, double>(-40.0, 1.0)).getValue() == -1.0);
+    Duals<1, double> tiny = log1p(Duals<1, double>(1e-12, 1.0));
+    assert(tiny.getValue() == log1p(1e-12));
+    assert(fabs(tiny.getDerivative() - 1.0) < 1e-11);
+    assert(expm1(Duals<1, double>(1e-12, 1.0)).getValue() == expm1(1e-12));
+
+    bool threw = false;
+    try
+    {
+        log1p(Duals<1, double>(-1.0, 1.0));
+    }
+    catch (const runtime_error&)
+    {
+        threw = true;
+    }
+    assert(threw);
+
+    // min and max compare values only and carry the chosen derivatives
+    Duals<1, double> a(1.0, 5.0);
+    Duals<1, double> b(1.5, -1.0);
+    assert(min(a, b).getDerivative() == 5.0 && max(a, b).getDerivative() == -1.0);
+
+    // Exponent derivative of a zero base vanishes, that of a negative base is undefined
+    assert(pow(Duals<1, double>(0.0, 0.0), Duals<1, double>(2.0, 1.0)).getDerivative() == 0.0);
+    assert(std::isnan(pow(Duals<1, double>(-2.0, 0.0), Duals<1, double>(2.0, 1.0)).getDerivative()));
+
+    // ... but only in the lanes the exponent moves in: a constant exponent matches pow(x, p)
+    Duals<2, double> negativeBase = pow(Duals<2, double>(-2.0, {1.0, 0.0}), Duals<2, double>(2.0));
+    assert(negativeBase.getValue() == 4.0 && negativeBase.getDerivative(0) == -4.0 && negativeBase.getDerivative(1) == 0.0);
+    Duals<2, double> mixedLanes = pow(Duals<2, double>(-2.0, {1.0, 0.0}), Duals<2, double>(2.0, {0.0, 1.0}));
+    assert(mixedLanes.getDerivative(0) == -4.0 && std::isnan(mixedLanes.getDerivative(1)));
+
+    // Nested duals give second derivatives: tanh'' = -2 tanh sech^2 and (x^x)'' = x^x ((log x + 1)^2 + 1/x)
+    using Nested = Duals<1, Duals<1, double>>;
+    Nested t(Duals<1, double>(0.6, 1.0), Duals<1, double>(1.0, 0.0));
+    Nested th = tanh(t);
+    double sech2 = 1.0 - std::tanh(0.6) * std::tanh(0.6);
+    assert(fabs(th.getDerivative().getDerivative() + 2.0 * std::tanh(0.6) * sech2) < 1e-14);
+    Nested power = pow(t, t);
+    double xx = std::pow(0.6, 0.6);
+    assert(fabs(power.getDerivative().getValue() - xx * (std::log(0.6) + 1.0)) < 1e-14);
+    double second = xx * ((std::log(0.6) + 1.0) * (std::log(0.6) + 1.0) + 1.0 / 0.6);
+    assert(fabs(power.getDerivative().getDerivative() - second) < 1e-13);
+
+    cout << "Extended math function tests passed!" << endl;
+}
+
+void testMixedScalarOperators()
+{
+    // Any arithmetic scalar combines with Duals without explicit conversions
+    Duals<2, double> x(3.0, {1.0, -2.0});
+    Duals<2, double> scaled = 2 * x / 4.0f - 1;
+    assert(scaled.getValue() == 0.5);
+    assert(scaled.getDerivative(0) == 0.5 && scaled.getDerivative(1) == -1.0);
+
+    Duals<2, double> reciprocal = 1 / x;
+    assert(fabs(reciprocal.getDerivative(1) - 2.0 / 9.0) < EPSILON);
+
+    Duals<2, double> negated = -x;
+    assert(negated.getValue() == -3.0 && negated.getDerivative(0) == -1.0 && negated.getDerivative(1) == 2.0);
+    Duals<2, double> difference = 10u - x;
+    assert(difference == negated + 10.0);
+
+    // Float duals with double literals, and nested duals with plain scalars
+    Duals<1, float> f(2.0f, 1.0f);
+    Duals<1, float> g = 0.5 * f * f;
+    assert(g.getValue() == 2.0f && g.getDerivative() == 2.0f);
+
+    Duals<1, Duals<1, double>> nested(Duals<1, double>(2.0, 1.0), Duals<1, double>(1.0, 0.0));
+    Duals<1, Duals<1, double>> cube = 3.0 * nested * nested * nested - 1;
+    assert(cube.getValue().getValue() == 23.0);
+    assert(cube.getDerivative().getValue() == 36.0);      // 9 x^2
+    assert(cube.getDerivative().getDerivative() == 36.0); // 18 x
+
+    // An outer dual combines with a scalar of its own lane type
+    Duals<2, Duals<2, double>> outer(Duals<2, double>(2.0, {1.0, 0.0}),
+                                     {Duals<2, double>(1.0, {0.0, 0.0}), Duals<2, double>(0.0, {0.0, 0.0})});
+    Duals<2, double> inner(3.0, {0.0, 1.0});
+    Duals<2, Duals<2, double>> product = outer * inner;
+    assert(product.getValue().getValue() == 6.0);
+    assert(product.getValue().getDerivative(0) == 3.0 && product.getValue().getDerivative(1) == 2.0);
+    assert(product.getDerivative(0).getValue() == 3.0 && product.getDerivative(0).getDerivative(1) == 1.0);
+    assert((product.getDerivative(1) == Duals<2, double>(0.0, {0.0, 0.0})));
+    assert((inner * outer == product));
+    Duals<2, Duals<2, double>> shifted = inner - outer + inner / outer;
+    assert(shifted.getValue().getValue() == 1.0 + 1.5);
+    assert(shifted.getDerivative(0).getValue() == -1.0 - 0.75);
+
+    cout << "Mixed scalar operator tests passed!" << endl;
+}
+
+void testDomainPolicies()
+{
+    // The default policy throws where the functions always have; sqrt
+    // returns NaN as it always has and throws only when asked to
+    bool threw = false;
+    try
+    {
+        log(Duals<2, double>(-1.0, {1.0, 0.0}));
+    }
+    catch (const runtime_error&)
+    {
+        threw = true;
+    }
+    assert(threw);
+    if constexpr (dualsDomain == DualsDomain::Throw)
+    {
+        Duals<2, double> sqrtNegative = sqrt(Duals<2, double>(-1.0, {1.0, 0.0}));
+        assert(std::isnan(sqrtNegative.getValue()) && std::isnan(sqrtNegative.getDerivative(0)));
+    }
+    threw = false;
+    try
+    {
+        sqrt<DualsDomain::Throw>(Duals<2, double>(-1.0, {1.0, 0.0}));
+    }
+    catch (const runtime_error&)
+    {
+        threw = true;
+    }
+    assert(threw);
+
+    // NaN propagates into the value and every lane instead of throwing
+    Duals<2, double> negative(-2.0, {1.0, 3.0});
+    Duals<2, double> zero(0.0, {1.0, 3.0});
+    Duals<2, double> logNaN = log<DualsDomain::NaN>(negative);
+    assert(std::isnan(logNaN.getValue()) && std::isnan(logNaN.getDerivative(0)) && std::isnan(logNaN.getDerivative(1)));
+    assert(std::isnan(log1p<DualsDomain::NaN>(Duals<2, double>(-1.0, {1.0, 3.0})).getDerivative(1)));
+    Duals<2, double> absNaN = abs<DualsDomain::NaN>(zero);
+    assert(absNaN.getValue() == 0.0 && std::isnan(absNaN.getDerivative(0)));
+    assert(std::isnan(sqrt<DualsDomain::NaN>(negative).getDerivative(0)));
+
+    // Inside the domain every policy agrees with the throwing one
+    Duals<2, double> positive(4.0, {1.0, 3.0});
+    assert(log<DualsDomain::NaN>(positive) == log(positive));
+    assert(log<DualsDomain::Subgradient>(positive) == log(positive));
+    assert(abs<DualsDomain::Subgradient>(negative) == abs(negative));
+    assert(sqrt<DualsDomain::NaN>(positive) == sqrt(positive));
+
+    // Subgradient keeps the lanes finite: 0 at the kink of abs, zero where
+    // the derivative of log or sqrt blows up
+    Duals<2, double> absKink = abs<DualsDomain::Subgradient>(zero);
+    assert(absKink.getValue() == 0.0 && absKink.getDerivative(0) == 0.0 && absKink.getDerivative(1) == 0.0);
+    Duals<2, double> sqrtZero = sqrt<DualsDomain::Subgradient>(zero);
+    assert(sqrtZero.getValue() == 0.0 && sqrtZero.getDerivative(1) == 0.0);
+    Duals<2, double> logZero = log<DualsDomain::Subgradient>(zero);
+    assert(std::isinf(logZero.getValue()) && logZero.getDerivative(0) == 0.0);
+
+    // A norm built on the subgradient policy is differentiable at the origin
+    Duals<1, Duals<1, double>> nested(Duals<1, double>(0.0, 1.0), Duals<1, double>(1.0, 0.0));
+    Duals<1, Duals<1, double>> kink = abs<DualsDomain::Subgradient>(nested);
+    assert(kink.getDerivative().getValue() == 0.0);
+
+    cout << "Domain policy tests passed!" << endl;
+}
+
+void testGradientReduction()
+{
+    // Every item adds a term and its negation to two nodes of a ring, as a
+    // spring or edge term would, with lanes spread over very different scales
+    const size_t nodes = 37;
+    const size_t items = 20000;
+    auto term = [](size_t k)
+    {
+        double x = std::sin(0.37 * double(k)) * std::pow(10.0, double(k % 7) - 3.0);
+        return Duals<3, double>(x, {x * x, 1.0 / (1.0 + x * x), k % 5 == 0 ? 0.0 : -x});
+    };
+    auto contribute = [&](size_t k, auto& sink)
+    {
+        Duals<3, double> t = term(k);
+        sink.add(k % nodes, t);
+        sink.add((k * 7 + 3) % nodes, -t);
+    };
+
+    std::vector<Duals<3, double>> serial(nodes);
+    for (size_t k = 0; k < items; ++k)
+    {
+        DenseGradientSink<3, double> sink(serial);
+        contribute(k, sink);
+    }
+
+    // Deterministic mode gives the same bits for any thread count
+    ReductionOptions options;
+    options.blockSize = 300;
+    options.blocksPerWave = 8;
+    options.numThreads = 1;
+    std::vector<Duals<3, double>> reference = reduceGradient<3, double>(items, nodes, contribute, options);
+    for (size_t threads : {2, 3, 8})
+    {
+        options.numThreads = threads;
+        assert((reduceGradient<3, double>(items, nodes, contribute, options) == reference));
+    }
+
+    // The other modes agree up to rounding
+    options.numThreads = 4;
+    for (ReductionMode mode : {ReductionMode::ThreadLocal, ReductionMode::Atomic})
+    {
+        options.mode = mode;
+        std::vector<Duals<3, double>> total = reduceGradient<3, double>(items, nodes, contribute, options);
+        for (size_t i = 0; i < nodes; ++i)
+        {
+            assert(fabs(total[i].getValue() - serial[i].getValue()) < 1e-9);
+            assert(fabs(reference[i].getValue() - serial[i].getValue()) < 1e-9);
+            for (size_t j = 0; j < 3; ++j)
+            {
+                assert(fabs(total[i].getDerivative(j) - serial[i].getDerivative(j)) < 1e-6);
+            }
+        }
+    }
+
+    // Each thread gets one buffer however often it asks
+    ThreadLocalAccumulator<2, double> accumulator(4);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < 3; ++t)
+    {
+        threads.emplace_back([&accumulator, t]()
+        {
+            for (size_t k = 0; k < 100; ++k)
+            {
+                accumulator.add(k % 4, Duals<2, double>(1.0, {double(t), 0.5}));
+            }
+        });
+    }
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+    assert(accumulator.getBufferCount() == 3);
+    std::vector<Duals<2, double>> combined = accumulator.combine();
+    assert(combined[1].getValue() == 75.0);
+    assert(combined[1].getDerivative(0) == 75.0 && combined[1].getDerivative(1) == 37.5);
+
+    cout << "Gradient reduction tests passed!" << endl;
+}
+
+void testComparisonsAndSelect()
+{
+    Duals<3, double> a(1.0, {1.0, 2.0, 3.0});
+    Duals<3, double> b(1.0, {1.0, 2.0, 4.0});
+    Duals<3, double> c(2.0, {0.0, 0.0, 0.0});
+
+    // <= and >= agree with < and == while scanning the lanes once
+    const Duals<3, double> all[] = {a, b, c};
+    for (const Duals<3, double>& x : all)
+    {
+        for (const Duals<3, double>& y : all)
+        {
+            assert((x <= y) == (x < y || x == y));
+            assert((x >= y) == (x > y || x == y));
+        }
+    }
+    Duals<1, double> p(1.0, 2.0);
+    Duals<1, double> q(1.0, 3.0);
+    assert(p <= q && !(p >= q) && p <= p && p >= p);
+
+    // select picks every lane from one side
+    Duals<3, double> picked = select(true, a, c);
+    assert(picked == a);
+    assert(select(false, a, c) == c);
+    assert(select(primalValue(c) > 1.0, 5.0, 6.0) == 5.0);
+
+    // Nested duals select all the way down
+    Duals<1, Duals<1, double>> inner1(Duals<1, double>(1.0, 2.0), Duals<1, double>(3.0, 4.0));
+    Duals<1, Duals<1, double>> inner2(Duals<1, double>(5.0, 6.0), Duals<1, double>(7.0, 8.0));
+    assert(select(false, inner1, inner2) == inner2);
+
+    // A branch-free |x| and max by value carry the right derivatives
+    auto magnitude = [](const auto& x) { return select(primalValue(x) < 0, -x, x); };
+    assert((magnitude(Duals<3, double>(-2.0, {1.0, -1.0, 0.5})) == Duals<3, double>(2.0, {-1.0, 1.0, -0.5})));
+    assert(max(a, c) == c && min(a, c) == a);
+
+    cout << "Comparison and select tests passed!" << endl;
+}
+
+void testLayoutGuarantees()
+{
+    // Duals copy as raw memory
+    std::vector<Duals<3, double>> source;
+    for (size_t i = 0; i < 10; ++i)
+    {
+        source.emplace_back(double(i), std::array<double, 3>{1.0, double(i), -double(i)});
+    }
+    std::vector<Duals<3, double>> copy(source.size());
+    std::memcpy(static_cast<void*>(copy.data()), source.data(), source.size() * sizeof(Duals<3, double>));
+    assert(copy == source);
+
+    // The uninitialized tag leaves everything to the caller
+    Duals<3, double> filled(dualsUninitialized);
+    filled.setValue(2.0);
+    filled.setAllDerivatives({1.0, 2.0, 3.0});
+    assert((filled == Duals<3, double>(2.0, {1.0, 2.0, 3.0})));
+    Duals<1, double> single(dualsUninitialized);
+    single.setValue(1.0);
+    single.setDerivative(4.0);
+    assert((single == Duals<1, double>(1.0, 4.0)));
+
+    // Arithmetic and the elementary functions cannot throw; only the domain-checked
+    // functions under the Throw policy and indexed lane access can
+    Duals<3, double> x = source[3];
+    static_assert(noexcept(x + x) && noexcept(x * 2.0) && noexcept(1 / x) && noexcept(-x));
+    static_assert(noexcept(x < x) && noexcept(x.getValue()) && noexcept(select(true, x, x)));
+    static_assert(noexcept(log(x)) == (dualsDomain != DualsDomain::Throw) && !noexcept(x.getDerivative(size_t(0))));
+    static_assert(noexcept(sin(x) * exp(x) + pow(x, 2.0f) + atan2(x, x)) && noexcept(sqrt(x)) && !noexcept(sqrt<DualsDomain::Throw>(x)));
+    static_assert(noexcept(log<DualsDomain::NaN>(x) + abs<DualsDomain::Subgradient>(x)));
+
+    cout << "Layout guarantee tests passed!" << endl;
+}
+
+template <typename Storage>
+void checkStorageMatchesPacked()
+{
+    using Packed = Duals<6, double>;
+    using Stored = Duals<6, double, Storage>;
+    std::array<double, 6> xLanes = {1.0, -2.0, 0.5, 0.0, 3.0, -1.5};
+    std::array<double, 6> yLanes = {0.25, 1.0, -1.0, 2.0, 0.0, 4.0};
+    Packed px(1.5, xLanes), py(0.75, yLanes);
+    Stored sx(1.5, xLanes), sy(0.75, yLanes);
+
+    auto same = [](const Packed& p, const Stored& q)
+    {
+        return p.getValue() == q.getValue() && p.getAllDerivatives() == q.getAllDerivatives();
+    };
+    assert(same(px + py, sx + sy));
+    assert(same(px - py, sx - sy));
+    assert(same(px * py, sx * sy));
+    assert(same(px / py, sx / sy));
+    assert(same(2.0 * px - 1, 2.0 * sx - 1));
+    assert(same(sin(px) * log(py) + sqrt(px), sin(sx) * log(sy) + sqrt(sx)));
+    assert(same(select(true, px, py), select(true, sx, sy)));
+    assert(sx + sy == sy + sx && sx < sx + 1.0 && sx <= sx);
+}
+
+void testStorageLayouts()
+{
+    // Aligned lane blocks, padded to the SIMD width where asked
+    using Aligned64 = Duals<8, double, DualsAligned<64>>;
+    static_assert(alignof(Aligned64) == 64 && sizeof(Aligned64) == 128);
+    static_assert(Aligned64::STORED_LANES == 8);
+    using Padded = Duals<6, double, DualsAligned<32, 4>>;
+    static_assert(alignof(Padded) == 32 && Padded::STORED_LANES == 8);
+    static_assert(Duals<6, double>::STORED_LANES == 6 && sizeof(Duals<6, double>) == 7 * sizeof(double));
+    static_assert(std::is_trivially_copyable_v<Padded> && std::is_standard_layout_v<Padded>);
+
+    Aligned64 a(1.0, {1.0, 2.0, 3.0, 4.0, 5.0, 6.0, 7.0, 8.0});
+    assert(reinterpret_cast<uintptr_t>(a.laneData()) % 64 == 0);
+    std::vector<Padded> many(5);
+    for (const Padded& d : many)
+    {
+        assert(reinterpret_cast<uintptr_t>(d.laneData()) % 32 == 0);
+    }
+
+    checkStorageMatchesPacked<DualsAligned<32>>();
+    checkStorageMatchesPacked<DualsAligned<32, 4>>();
+    checkStorageMatchesPacked<DualsAligned<64, 8>>();
+
+    // Padding never shows, whatever the kernels leave in it
+    Padded padded(1.0, {1.0, 2.0, 3.0, 4.0, 5.0, 6.0});
+    padded.laneData()[6] = std::numeric_limits<double>::quiet_NaN();
+    padded.laneData()[7] = 9.0;
+    assert((padded == Padded(1.0, {1.0, 2.0, 3.0, 4.0, 5.0, 6.0})));
+    assert(!(padded < Padded(1.0, {1.0, 2.0, 3.0, 4.0, 5.0, 6.0})));
+    assert(padded.getAllDerivatives().size() == 6);
+    std::ostringstream printed;
+    printed << padded;
+    assert(printed.str() == "Value: 1, Derivatives: [1, 2, 3, 4, 5, 6]");
+
+    // Dividing by zero leaves the padding zero rather than 0 / 0
+    Padded zero(0.0, {0.0, 0.0, 0.0, 0.0, 0.0, 0.0});
+    Padded numerator(1.0, {1.0, 0.0, 0.0, 0.0, 0.0, 0.0});
+    for (const Padded& quotient : {numerator / zero, numerator / 0.0, 1.0 / zero})
+    {
+        assert(quotient.laneData()[6] == 0.0 && quotient.laneData()[7] == 0.0);
+    }
+
+    // Generic code such as the drivers runs unchanged on aligned storage
+    auto f = [](const auto& x) { return x[0] * x[0] * x[1] + sin(x[1]); };
+    std::array<Duals<2, double, DualsAligned<32, 4>>, 2> seeded = {Duals<2, double, DualsAligned<32, 4>>(2.0, {1.0, 0.0}),
+                                                                   Duals<2, double, DualsAligned<32, 4>>(0.5, {0.0, 1.0})};
+    auto y = f(seeded);
+    assert(fabs(y.getDerivative(0) - 2.0) < 1e-15);
+    assert(fabs(y.getDerivative(1) - (4.0 + cos(0.5))) < 1e-15);
+
+    cout << "Storage layout tests passed!" << endl;
+}
+
+struct LogBarrier
+{
+    template <typename S>
+    S operator()(const std::array<S, 3>& x) const
+    {
+        return x[0] * x[1] - log(x[2]) + sin(x[0] * x[2]);
+    }
+};
+
+void testStreaming()
+{
+    // Points as raw doubles, three per point, with a ragged last chunk
+    const size_t points = 10007;
+    std::vector<double> raw(points * 3);
+    for (size_t k = 0; k < points; ++k)
+    {
+        raw[3 * k] = std::sin(0.1 * double(k));
+        raw[3 * k + 1] = 1.0 + 1e-4 * double(k);
+        raw[3 * k + 2] = 0.5 + std::fabs(std::cos(0.3 * double(k)));
+    }
+    std::string bytes(reinterpret_cast<const char*>(raw.data()), raw.size() * sizeof(double));
+
+    StreamOptions options;
+    options.chunkPoints = 100;
+    options.numThreads = 3;
+    options.chunksInFlight = 4;
+    std::istringstream input(bytes);
+    std::ostringstream output;
+    StreamStats stats = streamGradients<3, double>(LogBarrier(), input, output, options);
+    assert(stats.points == points && stats.chunks == 101);
+
+    // Every record is the value and gradient, in input order, as computed directly
+    std::string written = output.str();
+    assert(written.size() == points * 4 * sizeof(double));
+    std::vector<double> records(points * 4);
+    std::memcpy(records.data(), written.data(), written.size());
+    for (size_t k = 0; k < points; ++k)
+    {
+        Vector<3, double> x = {raw[3 * k], raw[3 * k + 1], raw[3 * k + 2]};
+        Vector<3, double> gradient;
+        assert(records[4 * k] == valueAndGradient(LogBarrier(), x, gradient));
+        assert(records[4 * k + 1] == gradient[0] && records[4 * k + 2] == gradient[1] && records[4 * k + 3] == gradient[2]);
+    }
+
+    // Empty input gives empty output
+    std::istringstream empty("");
+    std::ostringstream nothing;
+    assert((streamGradients<3, double>(LogBarrier(), empty, nothing, options).points == 0 && nothing.str().empty()));
+
+    // A torn last point and an exception from the function both surface on the caller
+    std::istringstream torn(bytes.substr(0, bytes.size() - sizeof(double)));
+    std::ostringstream tornOutput;
+    bool threw = false;
+    try
+    {
+        streamGradients<3, double>(LogBarrier(), torn, tornOutput, options);
+    }
+    catch (const runtime_error&)
+    {
+        threw = true;
+    }
+    assert(threw);
+
+    raw[3 * 5000 + 2] = -1.0;
+    std::istringstream poisoned(std::string(reinterpret_cast<const char*>(raw.data()), raw.size() * sizeof(double)));
+    std::ostringstream poisonedOutput;
+    threw = false;
+    try
+    {
+        streamGradients<3, double>(LogBarrier(), poisoned, poisonedOutput, options);
+    }
+    catch (const runtime_error&)
+    {
+        threw = true;
+    }
+    assert(threw);
+    assert(poisonedOutput.str().size() <= 5000 * 4 * sizeof(double));
+
+    // The queue between the stages keeps every item exactly once under contention
+    BoundedQueue<size_t> queue(64);
+    std::atomic<size_t> sum(0);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < 2; ++t)
+    {
+        threads.emplace_back([&queue, t]()
+        {
+            for (size_t k = 1; k <= 20000; ++k)
+            {
+                while (!queue.tryPush(k * 2 + t))
+                {
+                    std::this_thread::yield();
+                }
+            }
+        });
+        threads.emplace_back([&queue, &sum]()
+        {
+            for (size_t k = 0; k < 20000; ++k)
+            {
+                size_t value = 0;
+                while (!queue.tryPop(value))
+                {
+                    std::this_thread::yield();
+                }
+                sum += value;
+            }
+        });
+    }
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+    assert(sum == 2 * 20000 * 20001 + 20000);
+
+    cout << "Streaming tests passed!" << endl;
+}
+
+// Minimal fire-and-forget coroutine for driving asyncEvaluate
+struct Detached
+{
+    struct promise_type
+    {
+        Detached get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+// Counts evaluations in flight across the pool's workers
+struct SlowRosenbrock
+{
+    std::atomic<size_t>* running;
+    std::atomic<size_t>* peak;
+
+    template <typename S>
+    S operator()(const std::array<S, 2>& x) const
+    {
+        size_t now = ++*running;
+        size_t seen = peak->load();
+        while (now > seen && !peak->compare_exchange_weak(seen, now))
+        {
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+        --*running;
+        S a = S(1.0) - x[0];
+        S b = x[1] - x[0] * x[0];
+        return a * a + S(100.0) * b * b;
+    }
+};
+
+Detached evaluateBatch(EvaluationPool& pool, SlowRosenbrock f, std::vector<Vector<2, double>> points, CancellationToken token,
+                       std::vector<GradientSample<2, double>>& out, std::atomic<int>& outcome)
+{
+    try
+    {
+        out = co_await asyncEvaluate(pool, f, std::move(points), token);
+        outcome = 1;
+    }
+    catch (const EvaluationCancelled&)
+    {
+        outcome = 2;
+    }
+    catch (const runtime_error&)
+    {
+        outcome = 3;
+    }
+}
+
+Detached evaluateLogarithm(EvaluationPool& pool, std::vector<Vector<1, double>> points,
+                           std::vector<GradientSample<1, double>>& out, std::atomic<int>& outcome)
+{
+    try
+    {
+        auto logarithm = [](const auto& x) { return log(x[0]); };
+        out = co_await asyncEvaluate(pool, logarithm, std::move(points));
+        outcome = 1;
+    }
+    catch (const runtime_error&)
+    {
+        outcome = 3;
+    }
+}
+
+void waitFor(const std::vector<std::atomic<int>>& outcomes)
+{
+    for (const std::atomic<int>& outcome : outcomes)
+    {
+        while (outcome == 0)
+        {
+            std::this_thread::yield();
+        }
+    }
+}
+
+void testAsyncEvaluation()
+{
+    std::atomic<size_t> running(0);
+    std::atomic<size_t> peak(0);
+    SlowRosenbrock f{&running, &peak};
+
+    // Eight batches through a pool of two workers that admits two at a time
+    EvaluationPool pool(2, 2);
+    std::vector<std::vector<Vector<2, double>>> batches(8);
+    for (size_t b = 0; b < batches.size(); ++b)
+    {
+        for (size_t k = 0; k < 20; ++k)
+        {
+            batches[b].push_back({0.1 * double(b), 0.05 * double(k)});
+        }
+    }
+    std::vector<std::vector<GradientSample<2, double>>> results(batches.size());
+    std::vector<std::atomic<int>> outcomes(batches.size());
+    for (size_t b = 0; b < batches.size(); ++b)
+    {
+        evaluateBatch(pool, f, batches[b], CancellationToken(), results[b], outcomes[b]);
+    }
+    // The launching thread is never blocked; the surplus batches wait suspended
+    assert(pool.getInFlight() <= 2);
+    waitFor(outcomes);
+    assert(peak <= 2);
+    assert(pool.getInFlight() == 0 && pool.getWaiting() == 0);
+    for (size_t b = 0; b < batches.size(); ++b)
+    {
+        assert(outcomes[b] == 1 && results[b].size() == batches[b].size());
+        for (size_t k = 0; k < batches[b].size(); ++k)
+        {
+            Vector<2, double> gradient;
+            double value = valueAndGradient(f, batches[b][k], gradient);
+            assert(results[b][k].value == value && results[b][k].gradient == gradient);
+        }
+    }
+
+    // Cancelling before the await skips the pool; cancelling during the batch stops it early
+    std::vector<std::atomic<int>> cancelled(2);
+    std::vector<std::vector<GradientSample<2, double>>> partial(2);
+    CancellationToken early;
+    early.cancel();
+    evaluateBatch(pool, f, batches[0], early, partial[0], cancelled[0]);
+    std::vector<Vector<2, double>> large(4000, Vector<2, double>{0.5, 0.5});
+    CancellationToken late;
+    evaluateBatch(pool, f, large, late, partial[1], cancelled[1]);
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    late.cancel();
+    waitFor(cancelled);
+    assert(cancelled[0] == 2 && cancelled[1] == 2);
+
+    // A batch cancelled while waiting for a slot gives it up at once and is
+    // resumed by an idle worker while the batch holding the slot still runs
+    EvaluationPool single(2, 1);
+    std::vector<std::atomic<int>> queued(2);
+    std::vector<std::vector<GradientSample<2, double>>> queuedResults(2);
+    CancellationToken holder;
+    CancellationToken waiter;
+    evaluateBatch(single, f, large, holder, queuedResults[0], queued[0]);
+    evaluateBatch(single, f, batches[1], waiter, queuedResults[1], queued[1]);
+    assert(single.getInFlight() == 1 && single.getWaiting() == 1);
+    waiter.cancel();
+    assert(single.getWaiting() == 0);
+    while (queued[1] == 0)
+    {
+        std::this_thread::yield();
+    }
+    assert(queued[1] == 2 && queued[0] == 0 && single.getInFlight() == 1);
+    holder.cancel();
+    waitFor(queued);
+    assert(queued[0] == 2 && single.getInFlight() == 0);
+
+    // Exceptions from the function come back through the co_await
+    std::vector<std::atomic<int>> failed(1);
+    std::vector<GradientSample<1, double>> unused;
+    evaluateLogarithm(pool, {{1.0}, {-1.0}}, unused, failed[0]);
+    waitFor(failed);
+    assert(failed[0] == 3);
+
+    cout << "Async evaluation tests passed!" << endl;
+}
+
+void testNumaBatch()
+{
+    assert((NumaTopology::parseCpuList("0-3,8,10-11\n") == std::vector<size_t>{0, 1, 2, 3, 8, 10, 11}));
+    assert(NumaTopology::parseCpuList("").empty());
+    assert(NumaTopology::detect().nodeCount() >= 1);
+    NumaTopology three = NumaTopology::simulated(3);
+    assert(three.isSimulated() && three.nodeCount() == 3);
+    for (const NumaNode& node : three.getNodes())
+    {
+        assert(!node.cpus.empty());
+    }
+
+    // Three workers on two pretend nodes: node 0 gets two of them and two thirds of the blocks
+    NumaOptions options;
+    options.topology = NumaTopology::simulated(2);
+    options.numThreads = 3;
+    options.blockSize = 64;
+    NumaBatch<2, double> batch(1000, options);
+    assert(batch.ownerNode(0) == 0 && batch.ownerNode(999) == 1);
+    assert(batch.value(500) == 0.0 && batch.gradient(500)[1] == 0.0);
+    batch.fill([](size_t i, Vector<2, double>& x) { x = {0.002 * double(i) - 1.0, 0.5}; });
+    batch.evaluate(Rosenbrock());
+
+    options.numaAware = false;
+    NumaBatch<2, double> shared(1000, options);
+    shared.fill([](size_t i, Vector<2, double>& x) { x = {0.002 * double(i) - 1.0, 0.5}; });
+    shared.evaluate(Rosenbrock());
+    for (size_t i = 0; i < batch.size(); ++i)
+    {
+        Vector<2, double> gradient;
+        double value = valueAndGradient(Rosenbrock(), batch.point(i), gradient);
+        assert(batch.value(i) == value && batch.gradient(i) == gradient);
+        assert(shared.value(i) == value && shared.gradient(i) == gradient);
+    }
+
+    // Exceptions from the function reach the caller
+    bool threw = false;
+    try
+    {
+        batch.evaluate([](const auto& x) { return log(x[0]); });
+    }
+    catch (const runtime_error&)
+    {
+        threw = true;
+    }
+    assert(threw == (dualsDomain == DualsDomain::Throw));
+
+    // The same workers serve every later call, a failed one included
+    size_t unpinned = batch.getUnpinnedWorkers();
+    for (int repeat = 0; repeat < 3; ++repeat)
+    {
+        batch.fill([repeat](size_t i, Vector<2, double>& x) { x = {0.001 * double(i), 0.1 * repeat}; });
+        batch.evaluate(Rosenbrock());
+        for (size_t i = 0; i < batch.size(); i += 37)
+        {
+            Vector<2, double> gradient;
+            assert(batch.value(i) == valueAndGradient(Rosenbrock(), batch.point(i), gradient));
+            assert(batch.gradient(i) == gradient);
+        }
+        assert(batch.getUnpinnedWorkers() == unpinned);
+    }
+
+    cout << "NUMA batch tests passed!" << endl;
+}
+
+// Discrete 1D reaction-diffusion residual; row i depends on x[i - 1], x[i] and x[i + 1]
+struct DiffusionResidual
+{
+    size_t* calls;
+
+    template <typename S>
+    std::array<S, 10> operator()(const std::array<S, 10>& x) const
+    {
+        ++*calls;
+        std::array<S, 10> r;
+        for (size_t i = 0; i < 10; ++i)
+        {
+            S left = i > 0 ? x[i - 1] : S(0.0);
+            S right = i + 1 < 10 ? x[i + 1] : S(0.0);
+            r[i] = left - S(2.0) * x[i] + right + S(0.1) * exp(x[i]) * x[i];
+        }
+        return r;
+    }
+};
+
+void testSparseJacobian()
+{
+    std::vector<std::pair<size_t, size_t>> entries;
+    for (size_t i = 0; i < 10; ++i)
+    {
+        for (size_t j = (i > 0 ? i - 1 : 0); j <= std::min<size_t>(i + 1, 9); ++j)
+        {
+            entries.push_back({i, j});
+            entries.push_back({i, j});
+        }
+    }
+    SparsityPattern pattern = SparsityPattern::fromEntries(10, 10, entries);
+    assert(pattern.nonZeros() == 28 && pattern.contains(4, 5) && !pattern.contains(4, 6));
+
+    // A tridiagonal pattern needs three colors, and columns sharing a row never share one
+    ColumnColoring coloring = colorColumns(pattern);
+    assert(coloring.colors == 3);
+    for (size_t row = 0; row < pattern.rows; ++row)
+    {
+        for (size_t a = pattern.rowStart[row]; a < pattern.rowStart[row + 1]; ++a)
+        {
+            for (size_t b = a + 1; b < pattern.rowStart[row + 1]; ++b)
+            {
+                assert(coloring.color[pattern.columns[a]] != coloring.color[pattern.columns[b]]);
+            }
+        }
+    }
+
+    size_t calls = 0;
+    DiffusionResidual f{&calls};
+    Vector<10, double> x;
+    for (size_t i = 0; i < 10; ++i)
+    {
+        x[i] = 0.1 * double(i) - 0.3;
+    }
+    Vector<10, double> denseValue;
+    RectMatrix<10, 10, double> dense;
+    valueAndJacobian(f, x, denseValue, dense);
+
+    // One pass with three lanes, two passes with two lanes
+    for (size_t lanes : {3, 2})
+    {
+        calls = 0;
+        Vector<10, double> value;
+        CsrMatrix<double> jacobian = lanes == 3 ? sparseJacobian<3>(f, x, pattern, coloring, value)
+                                                : sparseJacobian<2>(f, x, pattern, value);
+        assert(calls == (lanes == 3 ? 1 : 2));
+        assert(value == denseValue);
+        for (size_t i = 0; i < 10; ++i)
+        {
+            for (size_t j = 0; j < 10; ++j)
+            {
+                assert(jacobian.at(i, j) == dense[i][j]);
+            }
+        }
+
+        CscMatrix<double> columns = toCsc(jacobian);
+        assert(columns.colStart.back() == jacobian.values.size());
+        for (size_t j = 0; j < 10; ++j)
+        {
+            for (size_t k = columns.colStart[j]; k < columns.colStart[j + 1]; ++k)
+            {
+                assert(columns.values[k] == dense[columns.rowIndices[k]][j]);
+            }
+        }
+    }
+
+    bool threw = false;
+    try
+    {
+        Vector<10, double> value;
+        sparseJacobian<3>(f, x, SparsityPattern::fromEntries(9, 10, {}), value);
+    }
+    catch (const runtime_error&)
+    {
+        threw = true;
+    }
+    assert(threw);
+
+    cout << "Sparse Jacobian tests passed!" << endl;
+}
+
+// Outputs touching inputs in different 64-bit words of the pattern
+struct WideCoupling
+{
+    template <typename S>
+    std::array<S, 3> operator()(const std::array<S, 130>& x) const
+    {
+        S tail = S(0.0);
+        for (size_t i = 64; i < 70; ++i)
+        {
+            tail = tail + sin(x[i]) * x[i];
+        }
+        return {x[0] * x[129] + S(0.0) * x[5], tail, select(primalValue(x[1]) > 0.0, exp(x[2]), -x[3]) / S(2.0)};
+    }
+};
+
+void testSparsityDetection()
+{
+    size_t calls = 0;
+    DiffusionResidual f{&calls};
+    Vector<10, double> x;
+    for (size_t i = 0; i < 10; ++i)
+    {
+        x[i] = 0.1 * double(i) - 0.3;
+    }
+
+    // The detected pattern is exactly the tridiagonal one, at one evaluation
+    SparsityPattern pattern = jacobianPattern(f, x);
+    assert(calls == 1 && pattern.rows == 10 && pattern.cols == 10 && pattern.nonZeros() == 28);
+    for (size_t i = 0; i < 10; ++i)
+    {
+        for (size_t j = 0; j < 10; ++j)
+        {
+            assert(pattern.contains(i, j) == (j + 1 >= i && j <= i + 1));
+        }
+    }
+
+    Vector<10, double> value;
+    Vector<10, double> denseValue;
+    RectMatrix<10, 10, double> dense;
+    valueAndJacobian(f, x, denseValue, dense);
+    CsrMatrix<double> jacobian = sparseJacobian<3>(f, x, value);
+    for (size_t i = 0; i < 10; ++i)
+    {
+        for (size_t j = 0; j < 10; ++j)
+        {
+            assert(jacobian.at(i, j) == dense[i][j]);
+        }
+    }
+
+    // Dependencies are structural and cross word boundaries; select keeps both sides
+    Vector<130, double> wide{};
+    wide[1] = 1.0;
+    SparsityPattern coupling = jacobianPattern(WideCoupling(), wide);
+    assert((std::vector<size_t>(coupling.columns.begin(), coupling.columns.begin() + coupling.rowStart[1]) ==
+            std::vector<size_t>{0, 5, 129}));
+    assert(coupling.rowStart[2] - coupling.rowStart[1] == 6 && coupling.contains(1, 64) && coupling.contains(1, 69));
+    assert(coupling.contains(2, 2) && coupling.contains(2, 3) && !coupling.contains(2, 1));
+
+    DualsPattern<130, double> a(2.0);
+    a.setDependency(100);
+    DualsPattern<130, double> b = 3.0 * a + a * a;
+    assert(b.getValue() == 10.0 && b.dependencyCount() == 1 && b.dependsOn(100));
+    ostringstream printed;
+    printed << b;
+    assert(printed.str() == "10 depends on {100}");
+
+    cout << "Sparsity detection tests passed!" << endl;
+}
+
+// Couples all four inputs through exp, sin and a product
+struct CoupledEnergy
+{
+    template <typename S>
+    S operator()(const std::array<S, 4>& x) const
+    {
+        return exp(x[0] * x[1]) + sin(x[1] - x[2]) * x[3] + x[0] * x[2] * x[3] * x[3];
+    }
+};
+
+void testHessianVectorProducts()
+{
+    Vector<4, double> x = {0.3, -0.7, 1.1, 0.4};
+    Vector<4, double> gradient;
+    Matrix<4, double> hessian;
+    double value = valueGradientAndHessian(CoupledEnergy(), x, gradient, hessian);
+
+    std::array<Vector<4, double>, 3> directions = {{{1.0, 0.0, 0.0, 0.0}, {0.5, -1.0, 2.0, 0.25}, {-0.3, 0.2, 0.1, 1.5}}};
+    Vector<4, double> hvpGradient;
+    std::array<Vector<4, double>, 3> products;
+    assert(valueGradientAndHvp(CoupledEnergy(), x, directions, hvpGradient, products) == value);
+    for (size_t i = 0; i < 4; ++i)
+    {
+        assert(fabs(hvpGradient[i] - gradient[i]) < 1e-12);
+    }
+
+    // Each batched product matches H v and the single-direction form
+    for (size_t k = 0; k < directions.size(); ++k)
+    {
+        Vector<4, double> single = hvp(CoupledEnergy(), x, directions[k]);
+        for (size_t i = 0; i < 4; ++i)
+        {
+            double expected = 0.0;
+            for (size_t j = 0; j < 4; ++j)
+            {
+                expected += hessian[i][j] * directions[k][j];
+            }
+            assert(fabs(products[k][i] - expected) < 1e-12);
+            assert(fabs(single[i] - products[k][i]) < 1e-12);
+        }
+    }
+    assert((hvp(Rosenbrock(), Vector<2, double>{1.0, 1.0}, Vector<2, double>{0.0, 1.0}) == Vector<2, double>{-400.0, 200.0}));
+
+    std::array<Vector<4, double>, 2> batched = hvp(CoupledEnergy(), x, std::array<Vector<4, double>, 2>{directions[1], directions[2]});
+    assert(batched[0] == products[1] && batched[1] == products[2]);
+
+    cout << "Hessian-vector product tests passed!" << endl;
+}
+
+template <size_t N, typename T>
+void checkAllFunctions(double tolerance)
+{
+    GradientCheckOptions options;
+    options.samples = 200;
+    std::vector<GradientCheckResult> results = checkDualsFunctions<N, T>(options);
+    options.numThreads = 1;
+    std::vector<GradientCheckResult> serial = checkDualsFunctions<N, T>(options);
+    assert(results.size() == serial.size());
+    for (size_t k = 0; k < results.size(); ++k)
+    {
+        const GradientCheckResult& result = results[k];
+        if (result.maxRelativeError >= tolerance || result.samples != 200 || result.skipped != 0)
+        {
+            printGradientChecks(cout, {result});
+        }
+        assert(result.samples == 200 && result.skipped == 0);
+        assert(result.maxRelativeError < tolerance && result.meanRelativeError <= result.maxRelativeError);
+        // The same points and the same numbers for any thread count
+        assert(serial[k].maxRelativeError == result.maxRelativeError);
+        assert(serial[k].meanRelativeError == result.meanRelativeError);
+        assert(serial[k].worstPoint == result.worstPoint && result.worstPoint.size() == N);
+    }
+}
+
+void testGradientCheck()
+{
+    checkAllFunctions<1, double>(1e-8);
+    checkAllFunctions<3, double>(1e-8);
+    checkAllFunctions<1, float>(1e-4);
+    checkAllFunctions<4, float>(1e-4);
+
+    // A wrong derivative is caught, and a different seed checks different points
+    auto skewed = [](const auto& x)
+    {
+        if constexpr (std::is_arithmetic_v<std::decay_t<decltype(x[0])>>)
+        {
+            return x[0] * x[1];
+        }
+        else
+        {
+            using D = std::decay_t<decltype(x[0])>;
+            return x[0] * x[1] + D(0.0, {0.0, 0.01});
+        }
+    };
+    GradientCheckResult caught = checkGradient<2, double>("skewed", skewed, -1.0, 1.0);
+    assert(caught.samples == 1000 && caught.maxRelativeError > 1e-3);
+
+    GradientCheckOptions reseeded;
+    reseeded.seed = 7;
+    GradientCheckResult other = checkGradient<2, double>("skewed", skewed, -1.0, 1.0, reseeded);
+    assert(other.worstPoint != caught.worstPoint);
+
+    // Non-finite values are skipped, not averaged
+    GradientCheckResult outside = checkGradient<1, double>("log", [](const auto& x) { return log(x[0]); }, -1.0, 1.0);
+    assert(outside.skipped > 0 && outside.samples + outside.skipped == 1000);
+
+    cout << "Gradient check tests passed!" << endl;
+}
+
 int main() 
 {
     testConstructorsSingleVariable();
@@ -873,5 +2703,33 @@ int main()
     testMultiVariableMathFunctions();
     testOutputOperatorSingleVariable();
     testOutputOperatorMultivariable();
+    testGradientAndHessian();
+    testOptimizers();
+    testLevenbergMarquardt();
+    testNewtonSolve();
+    testImplicitDifferentiation();
+    testOdeSensitivities();
+    testScalarSpecialization();
+    testJacobianVectorProduct();
+    testOperationCounters();
+    testExpressionTracing();
+    testGeneratedKernels();
+    testJitCompilation();
+    testMemoization();
+    testCheckpointing();
+    testExtendedMathFunctions();
+    testMixedScalarOperators();
+    testDomainPolicies();
+    testGradientReduction();
+    testComparisonsAndSelect();
+    testLayoutGuarantees();
+    testStorageLayouts();
+    testStreaming();
+    testAsyncEvaluation();
+    testNumaBatch();
+    testSparseJacobian();
+    testSparsityDetection();
+    testHessianVectorProducts();
+    testGradientCheck();
     return 0;
 }
@@ -0,0 +1,68 @@
+// The opt-in value-only ordering, built in its own program since it changes
+// the operators every other test relies on
+#define DUALS_VALUE_COMPARISONS
+
+#include "Duals.h"
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+#include <vector>
+
+using namespace std;
+
+void testValueOrderingMultivariable()
+{
+    // Equal values compare equal in order whatever the lanes hold
+    Duals<2, double> a(1.0, {5.0, 0.0});
+    Duals<2, double> b(1.0, {-1.0, 3.0});
+    assert(a <= b && b <= a);
+    assert(a >= b && b >= a);
+    assert(!(a < b) && !(b < a));
+    assert(!(a > b) && !(b > a));
+
+    // Equality still looks at the lanes
+    assert(a != b && !(a == b));
+
+    // Different values order by value alone
+    Duals<2, double> c(0.5, {100.0, 100.0});
+    assert(c < a && a > c && c <= a && a >= c);
+    assert(!(a < c) && !(c > a));
+
+    cout << "Value-only ordering tests passed!" << endl;
+}
+
+void testValueOrderingSingleVariable()
+{
+    Duals<1, double> a(2.0, 7.0);
+    Duals<1, double> b(2.0, -7.0);
+    assert(a <= b && b <= a && a >= b && b >= a);
+    assert(!(a < b) && !(b < a) && !(a > b) && !(b > a));
+    assert(a != b);
+    assert((Duals<1, double>(1.0, 9.0) < b));
+
+    cout << "Single-variable value-only ordering tests passed!" << endl;
+}
+
+void testValueOrderingSort()
+{
+    // A stable sort by value keeps ties in their original order
+    vector<Duals<2, double>> points = {
+        Duals<2, double>(3.0, {0.0, 1.0}),
+        Duals<2, double>(1.0, {9.0, 0.0}),
+        Duals<2, double>(3.0, {-5.0, 2.0}),
+        Duals<2, double>(2.0, {0.0, 0.0}),
+    };
+    stable_sort(points.begin(), points.end());
+    assert(points[0].getValue() == 1.0 && points[1].getValue() == 2.0);
+    assert(points[2].getDerivative(0) == 0.0 && points[3].getDerivative(0) == -5.0);
+
+    cout << "Value-only sort tests passed!" << endl;
+}
+
+int main()
+{
+    testValueOrderingMultivariable();
+    testValueOrderingSingleVariable();
+    testValueOrderingSort();
+    return 0;
+}